@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+#
+# This script creates sparse disk images as understood by x86box. It can
+# either create an empty image of a given size, or convert a raw image, in
+# which case blocks containing only zeroes are not stored.
+#
+import struct
+import sys
+
+MAGIC = b'x86boxSP'
+VERSION = 1
+BLOCK_SIZE = 65536
+HEADER_SIZE = 32
+
+if len(sys.argv) != 3:
+    print('usage: {} (size_in_bytes | source.img) sparse.img'.format(sys.argv[0]))
+    quit()
+
+source, dest_file = sys.argv[1:]
+
+if source.isdigit():
+    length = int(source)
+    raw = None
+else:
+    with open(source, 'rb') as f:
+        raw = f.read()
+    length = len(raw)
+
+number_of_blocks = (length + BLOCK_SIZE - 1) // BLOCK_SIZE
+data_offset = (HEADER_SIZE + 4 * number_of_blocks + BLOCK_SIZE - 1) // BLOCK_SIZE * BLOCK_SIZE
+
+table = [0] * number_of_blocks
+blocks = []
+if raw is not None:
+    for n in range(number_of_blocks):
+        block = raw[n * BLOCK_SIZE:(n + 1) * BLOCK_SIZE]
+        if any(block):
+            blocks.append(block.ljust(BLOCK_SIZE, b'\0'))
+            table[n] = len(blocks)
+
+with open(dest_file, 'wb') as f:
+    f.write(struct.pack('<8sIIQII', MAGIC, VERSION, BLOCK_SIZE, length, number_of_blocks, 0))
+    f.write(struct.pack('<{}I'.format(number_of_blocks), *table))
+    f.write(b'\0' * (data_offset - f.tell()))
+    for block in blocks:
+        f.write(block)
+
+print('{} blocks of {} bytes, {} stored'.format(number_of_blocks, BLOCK_SIZE, len(blocks)))
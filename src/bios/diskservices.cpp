@@ -0,0 +1,236 @@
+#include "diskservices.h"
+#include "handlertrap.h"
+#include "../cpu/state.h"
+#include "../hw/diskgeometry.h"
+#include "../interface/imageprovider.h"
+#include "../interface/memoryinterface.h"
+
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    constexpr inline uint8_t Vector = 0x13;
+    constexpr inline memory::Address MemoryEnd = 0x100000;
+
+    namespace bda
+    {
+        constexpr inline memory::Address FloppyStatus = 0x441;
+        constexpr inline memory::Address HarddiskStatus = 0x474;
+        constexpr inline memory::Address NumberOfHarddisks = 0x475;
+    }
+
+    namespace function
+    {
+        constexpr inline uint8_t Read = 0x02;
+        constexpr inline uint8_t Write = 0x03;
+        constexpr inline uint8_t Verify = 0x04;
+    }
+
+    constexpr inline uint8_t FirstHarddisk = 0x80;
+    constexpr inline unsigned int MaxHarddiskSectors = 128;
+    // Larger drives are translated by the BIOS, which is not emulated here
+    constexpr inline unsigned int MaxUntranslatedCylinders = 1024;
+    // Transfers are split to stay within reach of GetPointer()
+    constexpr inline size_t MaxChunkSize = 64 * disk::SectorSize;
+
+    constexpr memory::Address MakeAddress(uint16_t segment, uint16_t offset)
+    {
+        return (static_cast<memory::Address>(segment) << 4) + offset;
+    }
+
+    struct Request
+    {
+        uint8_t function;
+        Image image;
+        uint64_t offset;
+        size_t length;
+        memory::Address buffer;
+        uint8_t sectors;
+    };
+}
+
+struct DiskServices::Impl
+{
+    Impl(MemoryInterface& memory, ImageProvider& imageProvider);
+    ~Impl();
+
+    MemoryInterface& memory;
+    ImageProvider& imageProvider;
+    std::shared_ptr<spdlog::logger> logger;
+    HandlerTrap trap{ Vector };
+    bool floppyChanged = false;
+
+    std::optional<Request> Decode(const cpu::State& state);
+    bool Transfer(const Request& request);
+    void Complete(cpu::State& state, const Request& request);
+};
+
+DiskServices::Impl::Impl(MemoryInterface& memory, ImageProvider& imageProvider)
+    : memory(memory)
+    , imageProvider(imageProvider)
+    , logger(spdlog::stderr_color_st("int13"))
+{
+}
+
+DiskServices::Impl::~Impl()
+{
+    spdlog::drop("int13");
+}
+
+// Returns the request if it can be completed without the BIOS; anything
+// which the BIOS would (or might) fail is left to it, so that the guest
+// sees the exact error
+std::optional<Request> DiskServices::Impl::Decode(const cpu::State& state)
+{
+    const uint8_t fn = state.m_ax >> 8;
+    if (fn != function::Read && fn != function::Write && fn != function::Verify)
+        return {};
+
+    const unsigned int count = state.m_ax & 0xff;
+    const unsigned int cylinder = (state.m_cx >> 8) | ((state.m_cx & 0xc0) << 2);
+    const unsigned int sector = state.m_cx & 0x3f;
+    const unsigned int head = state.m_dx >> 8;
+    const uint8_t drive = state.m_dx & 0xff;
+    if (count == 0 || sector == 0)
+        return {};
+
+    Image image;
+    disk::Geometry geometry;
+    const bool floppy = drive == 0;
+    if (floppy) {
+        // The BIOS has to notice the disk change line
+        if (std::exchange(floppyChanged, false))
+            return {};
+        image = Image::Floppy0;
+        geometry = disk::GetFloppyGeometry(imageProvider.GetSize(image));
+        if (sector - 1 + count > geometry.sectors_per_track)
+            return {};
+    } else if (drive == FirstHarddisk || drive == FirstHarddisk + 1) {
+        if (memory.ReadByte(bda::NumberOfHarddisks) <= drive - FirstHarddisk)
+            return {};
+        image = drive == FirstHarddisk ? Image::Harddisk0 : Image::Harddisk1;
+        geometry = disk::GetHarddiskGeometry(imageProvider.GetSize(image));
+        if (geometry.cylinders > MaxUntranslatedCylinders || count > MaxHarddiskSectors)
+            return {};
+    } else {
+        return {};
+    }
+
+    const auto size = imageProvider.GetSize(image);
+    if (cylinder >= geometry.cylinders || head >= geometry.heads || sector > geometry.sectors_per_track)
+        return {};
+    const uint64_t lba = (cylinder * geometry.heads + head) * geometry.sectors_per_track + (sector - 1);
+    const size_t length = count * disk::SectorSize;
+    if ((lba + count) * disk::SectorSize > size)
+        return {};
+
+    const auto buffer = MakeAddress(state.m_es, state.m_bx);
+    if (fn != function::Verify) {
+        if (buffer + length > MemoryEnd)
+            return {};
+        // Floppy DMA cannot cross a 64KB boundary; the BIOS reports this
+        if (floppy && (buffer >> 16) != ((buffer + length - 1) >> 16))
+            return {};
+        if (!floppy && state.m_bx + length > 0x10000)
+            return {};
+    }
+    return Request{ fn, image, lba * disk::SectorSize, length, buffer, static_cast<uint8_t>(count) };
+}
+
+bool DiskServices::Impl::Transfer(const Request& request)
+{
+    const bool write = request.function == function::Write;
+    std::vector<uint8_t> staging;
+    for (size_t done = 0; done < request.length; ) {
+        const auto length = std::min(request.length - done, MaxChunkSize);
+        const auto address = request.buffer + done;
+
+        // Guest RAM is used directly unless a peripheral is mapped there
+        std::span<uint8_t> data;
+        if (auto pointer = memory.GetPointer(address, length); pointer) {
+            data = { static_cast<uint8_t*>(pointer), length };
+        } else {
+            staging.resize(length);
+            data = staging;
+            if (write) {
+                for (size_t n = 0; n < length; ++n)
+                    data[n] = memory.ReadByte(address + n);
+            }
+        }
+
+        if (write) {
+            if (imageProvider.Write(request.image, request.offset + done, data) != length)
+                return false;
+        } else {
+            if (imageProvider.Read(request.image, request.offset + done, data) != length)
+                return false;
+            if (data.data() == staging.data()) {
+                for (size_t n = 0; n < length; ++n)
+                    memory.WriteByte(address + n, data[n]);
+            }
+        }
+        done += length;
+    }
+    return true;
+}
+
+// Returns to the caller like the BIOS handler would: AH = 0 (success), AL =
+// number of sectors and the carry flag cleared
+void DiskServices::Impl::Complete(cpu::State& state, const Request& request)
+{
+    memory.WriteByte(request.image == Image::Floppy0 ? bda::FloppyStatus : bda::HarddiskStatus, 0);
+    state.m_ax = request.sectors;
+
+    HandlerTrap::Return(memory, state);
+    state.m_flags &= ~cpu::flag::CF;
+}
+
+DiskServices::DiskServices(MemoryInterface& memory, ImageProvider& imageProvider)
+    : impl(std::make_unique<Impl>(memory, imageProvider))
+{
+}
+
+DiskServices::~DiskServices() = default;
+
+bool DiskServices::Handle(cpu::State& state)
+{
+    if (!impl->trap.IsEntry(impl->memory, state))
+        return false;
+
+    const auto request = impl->Decode(state);
+    if (!request)
+        return false;
+    impl->logger->debug("function {:x} image {} offset {} length {} buffer {:x}",
+        request->function, static_cast<int>(request->image), request->offset, request->length, request->buffer);
+    if (request->function != function::Verify && !impl->Transfer(*request)) {
+        impl->logger->warn("transfer failed, leaving request to the bios");
+        return false;
+    }
+    impl->Complete(state, *request);
+    return true;
+}
+
+void DiskServices::NotifyImageChanged()
+{
+    impl->floppyChanged = true;
+}
+
+bool DiskServices::IsActive() const
+{
+    return impl->trap.HasHandler();
+}
+
+void DiskServices::SaveState(StateWriter& writer) const
+{
+    impl->trap.SaveState(writer);
+}
+
+void DiskServices::LoadState(StateReader& reader)
+{
+    impl->trap.LoadState(reader);
+}
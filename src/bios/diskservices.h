@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+
+struct MemoryInterface;
+struct StateReader;
+struct StateWriter;
+class ImageProvider;
+namespace cpu { class State; }
+
+// High-level emulation of the BIOS disk services (INT 13h). Once the boot
+// sector is reached, the INT 13h handler installed by the BIOS is trapped.
+// Reads, writes and verifies which the BIOS would complete successfully are
+// performed directly on the images; everything else is left to the BIOS.
+class DiskServices final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+  public:
+    DiskServices(MemoryInterface& memory, ImageProvider& imageProvider);
+    ~DiskServices();
+
+    // To be called before each instruction. Returns true if CS:IP was the
+    // handler entry and the request has been completed; CS:IP then points
+    // to the caller.
+    bool Handle(cpu::State& state);
+    // False until the BIOS handler is known, i.e. the boot sector has been
+    // reached or a snapshot holding the handler has been restored
+    bool IsActive() const;
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+    void NotifyImageChanged();
+};
@@ -0,0 +1,51 @@
+#include "handlertrap.h"
+#include "../cpu/state.h"
+#include "../interface/stateinterface.h"
+
+namespace
+{
+    constexpr inline memory::Address BootSectorAddress = 0x7c00;
+    // Handlers in RAM belong to the operating system, not to the BIOS
+    constexpr inline memory::Address ROMStart = 0xc0000;
+
+    constexpr memory::Address MakeAddress(uint16_t segment, uint16_t offset)
+    {
+        return (static_cast<memory::Address>(segment) << 4) + offset;
+    }
+}
+
+bool HandlerTrap::IsEntry(MemoryInterface& memory, const cpu::State& state)
+{
+    const auto address = MakeAddress(state.m_cs, state.m_ip);
+    if (address == BootSectorAddress) {
+        const auto entry = MakeAddress(memory.ReadWord(vector * 4 + 2), memory.ReadWord(vector * 4 + 0));
+        if (entry >= ROMStart)
+            handler = entry;
+        return false;
+    }
+    return address == handler;
+}
+
+void HandlerTrap::Return(MemoryInterface& memory, cpu::State& state)
+{
+    const auto stack = MakeAddress(state.m_ss, state.m_sp);
+    state.m_ip = memory.ReadWord(stack + 0);
+    state.m_cs = memory.ReadWord(stack + 2);
+    state.m_flags = memory.ReadWord(stack + 4);
+    state.m_sp += 6;
+}
+
+// Handlers are in ROM, so zero means no handler has been seen yet
+void HandlerTrap::SaveState(StateWriter& writer) const
+{
+    writer.Write(handler.value_or(0));
+}
+
+void HandlerTrap::LoadState(StateReader& reader)
+{
+    memory::Address address;
+    reader.Read(address);
+    handler.reset();
+    if (address != 0)
+        handler = address;
+}
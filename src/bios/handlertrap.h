@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include "../interface/memoryinterface.h"
+
+namespace cpu { class State; }
+struct StateReader;
+struct StateWriter;
+
+// Recognizes the entry of the handler which the BIOS (or an option ROM) has
+// installed for an interrupt vector. The handler is taken from the vector
+// when the boot sector starts: the BIOS is done installing its handlers and
+// the operating system has yet to hook in. As the vector is likely hooked
+// by then, the handler is part of the machine state.
+class HandlerTrap final
+{
+    const uint8_t vector;
+    std::optional<memory::Address> handler;
+
+  public:
+    explicit HandlerTrap(uint8_t vector) : vector(vector) { }
+
+    // Returns true if CS:IP is the entry of the BIOS handler
+    bool IsEntry(MemoryInterface& memory, const cpu::State& state);
+
+    bool HasHandler() const { return handler.has_value(); }
+
+    // Returns to the caller of the handler, as IRET would
+    static void Return(MemoryInterface& memory, cpu::State& state);
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+};
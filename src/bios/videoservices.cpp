@@ -0,0 +1,260 @@
+#include "videoservices.h"
+#include "handlertrap.h"
+#include "../cpu/state.h"
+#include "../interface/iointerface.h"
+#include "../interface/memoryinterface.h"
+#include "../interface/textdisplayinterface.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr inline uint8_t Vector = 0x10;
+
+    namespace bda
+    {
+        constexpr inline memory::Address VideoMode = 0x449;
+        constexpr inline memory::Address Columns = 0x44a;
+        constexpr inline memory::Address PageOffset = 0x44e;
+        constexpr inline memory::Address CursorPosition = 0x450; // column, row
+        constexpr inline memory::Address ActivePage = 0x462;
+        constexpr inline memory::Address CRTCPort = 0x463;
+    }
+
+    namespace function
+    {
+        constexpr inline uint8_t SetCursorPosition = 0x02;
+        constexpr inline uint8_t ScrollUp = 0x06;
+        constexpr inline uint8_t ScrollDown = 0x07;
+        constexpr inline uint8_t WriteCharacterAndAttribute = 0x09;
+        constexpr inline uint8_t Teletype = 0x0e;
+    }
+
+    namespace crtc
+    {
+        constexpr inline uint8_t CursorLocationHigh = 0x0e;
+        constexpr inline uint8_t CursorLocationLow = 0x0f;
+    }
+
+    namespace ascii
+    {
+        constexpr inline uint8_t Bell = 0x07;
+        constexpr inline uint8_t Backspace = 0x08;
+        constexpr inline uint8_t LineFeed = 0x0a;
+        constexpr inline uint8_t CarriageReturn = 0x0d;
+    }
+
+    constexpr inline unsigned int Columns = 80;
+    constexpr inline unsigned int Rows = 25;
+    constexpr inline unsigned int RowSize = Columns * 2;
+
+    struct Window
+    {
+        unsigned int top, left, bottom, right;
+    };
+}
+
+struct VideoServices::Impl
+{
+    Impl(MemoryInterface& memory, IOInterface& io, TextDisplayInterface& display);
+
+    MemoryInterface& memory;
+    IOInterface& io;
+    TextDisplayInterface& display;
+    HandlerTrap trap{ Vector };
+
+    bool IsTextMode();
+    std::pair<unsigned int, unsigned int> GetCursorPosition();
+    void SetCursorPosition(unsigned int column, unsigned int row);
+    void Scroll(const Window& window, unsigned int lines, bool up, uint8_t attribute);
+
+    bool Execute(const cpu::State& state);
+    bool Teletype(uint8_t ch);
+};
+
+VideoServices::Impl::Impl(MemoryInterface& memory, IOInterface& io, TextDisplayInterface& display)
+    : memory(memory)
+    , io(io)
+    , display(display)
+{
+}
+
+// Only the first page of 80x25 color text mode is handled
+bool VideoServices::Impl::IsTextMode()
+{
+    const auto mode = memory.ReadByte(bda::VideoMode) & 0x7f;
+    return (mode == 2 || mode == 3) && memory.ReadWord(bda::Columns) == Columns &&
+           memory.ReadWord(bda::PageOffset) == 0 && memory.ReadByte(bda::ActivePage) == 0;
+}
+
+std::pair<unsigned int, unsigned int> VideoServices::Impl::GetCursorPosition()
+{
+    return { memory.ReadByte(bda::CursorPosition + 0), memory.ReadByte(bda::CursorPosition + 1) };
+}
+
+// Like the BIOS, this updates both the BDA and the CRTC
+void VideoServices::Impl::SetCursorPosition(unsigned int column, unsigned int row)
+{
+    memory.WriteByte(bda::CursorPosition + 0, column);
+    memory.WriteByte(bda::CursorPosition + 1, row);
+
+    const auto port = memory.ReadWord(bda::CRTCPort);
+    const uint16_t location = row * Columns + column;
+    io.Out8(port, crtc::CursorLocationHigh);
+    io.Out8(port + 1, location >> 8);
+    io.Out8(port, crtc::CursorLocationLow);
+    io.Out8(port + 1, location & 0xff);
+}
+
+// Zero lines (or more than fit) blanks the window
+void VideoServices::Impl::Scroll(const Window& window, unsigned int lines, bool up, uint8_t attribute)
+{
+    auto text = display.GetTextMemory();
+    const auto height = window.bottom - window.top + 1;
+    const auto width = (window.right - window.left + 1) * 2;
+    if (lines == 0 || lines > height)
+        lines = height;
+
+    auto row = [&](unsigned int n) { return text.subspan(n * RowSize + window.left * 2, width); };
+    for (unsigned int n = 0; n < height - lines; ++n) {
+        const auto destination = up ? window.top + n : window.bottom - n;
+        const auto source = up ? destination + lines : destination - lines;
+        std::ranges::copy(row(source), row(destination).begin());
+    }
+    for (unsigned int n = 0; n < lines; ++n) {
+        auto blank = row(up ? window.bottom - n : window.top + n);
+        for (size_t offset = 0; offset < blank.size(); offset += 2) {
+            blank[offset + 0] = ' ';
+            blank[offset + 1] = attribute;
+        }
+    }
+    display.InvalidateText(window.top * RowSize, height * RowSize);
+}
+
+// Follows the IBM BIOS: a new line at the bottom scrolls the screen up using
+// the attribute found at the cursor
+bool VideoServices::Impl::Teletype(uint8_t ch)
+{
+    auto [ column, row ] = GetCursorPosition();
+    switch (ch) {
+        case ascii::Bell:
+            // Sounding the speaker is left to the BIOS
+            return false;
+        case ascii::Backspace:
+            if (column > 0)
+                --column;
+            break;
+        case ascii::CarriageReturn:
+            column = 0;
+            break;
+        case ascii::LineFeed:
+            ++row;
+            break;
+        default: {
+            const auto offset = (row * Columns + column) * 2;
+            display.GetTextMemory()[offset] = ch;
+            display.InvalidateText(offset, 1);
+            if (++column == Columns) {
+                column = 0;
+                ++row;
+            }
+            break;
+        }
+    }
+
+    if (row == Rows) {
+        row = Rows - 1;
+        const auto attribute = display.GetTextMemory()[(row * Columns + column) * 2 + 1];
+        Scroll({ 0, 0, Rows - 1, Columns - 1 }, 1, true, attribute);
+    }
+    SetCursorPosition(column, row);
+    return true;
+}
+
+// Returns false if the request is to be left to the BIOS
+bool VideoServices::Impl::Execute(const cpu::State& state)
+{
+    const uint8_t fn = state.m_ax >> 8;
+    if (fn != function::SetCursorPosition && fn != function::ScrollUp && fn != function::ScrollDown &&
+        fn != function::WriteCharacterAndAttribute && fn != function::Teletype)
+        return false;
+    if (!IsTextMode())
+        return false;
+
+    const uint8_t page = state.m_bx >> 8;
+    if (fn == function::ScrollUp || fn == function::ScrollDown) {
+        const Window window{ static_cast<unsigned int>(state.m_cx >> 8), static_cast<unsigned int>(state.m_cx & 0xff),
+                             static_cast<unsigned int>(state.m_dx >> 8), static_cast<unsigned int>(state.m_dx & 0xff) };
+        if (window.top > window.bottom || window.left > window.right || window.bottom >= Rows || window.right >= Columns)
+            return false;
+        Scroll(window, state.m_ax & 0xff, fn == function::ScrollUp, state.m_bx >> 8);
+        return true;
+    }
+
+    if (page != 0)
+        return false;
+    const auto [ column, row ] = GetCursorPosition();
+    if (column >= Columns || row >= Rows)
+        return false;
+
+    switch (fn) {
+        case function::SetCursorPosition: {
+            const unsigned int newColumn = state.m_dx & 0xff;
+            const unsigned int newRow = state.m_dx >> 8;
+            if (newColumn >= Columns || newRow >= Rows)
+                return false;
+            SetCursorPosition(newColumn, newRow);
+            return true;
+        }
+        case function::WriteCharacterAndAttribute: {
+            auto text = display.GetTextMemory();
+            const auto offset = (row * Columns + column) * 2;
+            const auto length = static_cast<size_t>(state.m_cx) * 2;
+            if (offset + length > Rows * RowSize)
+                return false;
+            for (size_t n = 0; n < length; n += 2) {
+                text[offset + n + 0] = state.m_ax & 0xff;
+                text[offset + n + 1] = state.m_bx & 0xff;
+            }
+            display.InvalidateText(offset, length);
+            return true;
+        }
+        case function::Teletype:
+            return Teletype(state.m_ax & 0xff);
+    }
+    return false;
+}
+
+VideoServices::VideoServices(MemoryInterface& memory, IOInterface& io, TextDisplayInterface& display)
+    : impl(std::make_unique<Impl>(memory, io, display))
+{
+}
+
+VideoServices::~VideoServices() = default;
+
+bool VideoServices::Handle(cpu::State& state)
+{
+    if (!impl->trap.IsEntry(impl->memory, state))
+        return false;
+    if (!impl->Execute(state))
+        return false;
+
+    // All registers are preserved
+    HandlerTrap::Return(impl->memory, state);
+    return true;
+}
+
+bool VideoServices::IsActive() const
+{
+    return impl->trap.HasHandler();
+}
+
+void VideoServices::SaveState(StateWriter& writer) const
+{
+    impl->trap.SaveState(writer);
+}
+
+void VideoServices::LoadState(StateReader& reader)
+{
+    impl->trap.LoadState(reader);
+}
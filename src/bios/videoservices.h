@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+
+struct IOInterface;
+struct MemoryInterface;
+struct StateReader;
+struct StateWriter;
+struct TextDisplayInterface;
+namespace cpu { class State; }
+
+// High-level emulation of the common BIOS video services (INT 10h) in 80x25
+// text mode: set cursor position, scroll up/down, write character and
+// attribute, and teletype output. Text memory is changed in bulk rather
+// than one word at a time; anything else is left to the BIOS.
+class VideoServices final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+  public:
+    VideoServices(MemoryInterface& memory, IOInterface& io, TextDisplayInterface& display);
+    ~VideoServices();
+
+    // To be called before each instruction. Returns true if CS:IP was the
+    // handler entry and the request has been completed; CS:IP then points
+    // to the caller.
+    bool Handle(cpu::State& state);
+    // False until the BIOS handler is known, i.e. the boot sector has been
+    // reached or a snapshot holding the handler has been restored
+    bool IsActive() const;
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+};
@@ -1,5 +1,6 @@
 #include "io.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "spdlog/spdlog.h"
@@ -93,6 +94,44 @@ uint16_t IO::In16(io_port port)
     }
 }
 
+void IO::InBlock8(io_port port, std::span<uint8_t> data)
+{
+    if (auto p = impl->FindPeripheral(port); p) {
+        p->InBlock8(port, data);
+    } else {
+        impl->logger->warn("inblock8(): read of {} bytes from unmapped port {:x}", data.size(), port);
+        std::fill(data.begin(), data.end(), 0);
+    }
+}
+
+void IO::InBlock16(io_port port, std::span<uint8_t> data)
+{
+    if (auto p = impl->FindPeripheral(port); p) {
+        p->InBlock16(port, data);
+    } else {
+        impl->logger->warn("inblock16(): read of {} bytes from unmapped port {:x}", data.size(), port);
+        std::fill(data.begin(), data.end(), 0);
+    }
+}
+
+void IO::OutBlock8(io_port port, std::span<const uint8_t> data)
+{
+    if (auto p = impl->FindPeripheral(port); p) {
+        p->OutBlock8(port, data);
+    } else {
+        impl->logger->warn("outblock8(): ignoring write of {} bytes to unmapped port {:x}", data.size(), port);
+    }
+}
+
+void IO::OutBlock16(io_port port, std::span<const uint8_t> data)
+{
+    if (auto p = impl->FindPeripheral(port); p) {
+        p->OutBlock16(port, data);
+    } else {
+        impl->logger->warn("outblock16(): ignoring write of {} bytes to unmapped port {:x}", data.size(), port);
+    }
+}
+
 void IO::AddPeripheral(io_port base, uint16_t length, IOPeripheral& peripheral)
 {
     impl->peripherals.emplace_back(base, length, peripheral);
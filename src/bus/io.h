@@ -20,4 +20,9 @@ public:
 
     uint8_t In8(io_port port) override;
     uint16_t In16(io_port port) override;
+
+    void InBlock8(io_port port, std::span<uint8_t> data) override;
+    void InBlock16(io_port port, std::span<uint8_t> data) override;
+    void OutBlock8(io_port port, std::span<const uint8_t> data) override;
+    void OutBlock16(io_port port, std::span<const uint8_t> data) override;
 };
@@ -1,12 +1,20 @@
 #include "memory.h"
+#include "../interface/stateinterface.h"
 #include <string.h>
 #include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <stdio.h>
 
 namespace
 {
     static constexpr size_t memorySize = 1048576;
+    // As on an 8088, addresses beyond 1MB (i.e. FFFF:0010 and up) wrap around
+    static constexpr memory::Address addressMask = memorySize - 1;
 
     struct Mapping
     {
@@ -20,14 +28,26 @@ namespace
     };
 }
 
+struct Memory::Checkpoint
+{
+    const int fd;
+
+    Checkpoint(int fd) : fd(fd) { }
+    ~Checkpoint() { close(fd); }
+};
+
 struct Memory::Impl
 {
-    std::unique_ptr<uint8_t[]> memory;
+    uint8_t* memory{};
+    std::array<bool, Memory::s_page_count> dirty{};
 
     std::vector<Mapping> mappings;
 
     Impl();
+    ~Impl();
     void Reset();
+    void Map(int fd);
+    void MarkDirty(memory::Address addr, size_t length);
     MemoryMappedPeripheral* FindPeripheralByAddress(const memory::Address addr);
 };
 
@@ -39,14 +59,42 @@ Memory::Memory()
 Memory::~Memory() = default;
 
 Memory::Impl::Impl()
-    : memory(std::make_unique<uint8_t[]>(memorySize))
 {
-    Reset();
+    Map(-1);
+}
+
+Memory::Impl::~Impl()
+{
+    munmap(memory, memorySize);
 }
 
 void Memory::Impl::Reset()
 {
-    std::fill(memory.get(), memory.get() + memorySize, 0);
+    // Replacing the pages is cheaper than clearing them, and also drops any
+    // pages shared with a checkpoint
+    Map(-1);
+}
+
+// Maps fresh zero pages (fd < 0) or a private copy-on-write view of the
+// given file in place of the current memory; the address stays the same
+void Memory::Impl::Map(int fd)
+{
+    const int flags = MAP_PRIVATE | (fd < 0 ? MAP_ANONYMOUS : 0) | (memory ? MAP_FIXED : 0);
+    auto ptr = mmap(memory, memorySize, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (ptr == MAP_FAILED)
+        throw std::runtime_error("unable to map guest memory");
+    memory = static_cast<uint8_t*>(ptr);
+    dirty.fill(true);
+}
+
+void Memory::Impl::MarkDirty(memory::Address addr, size_t length)
+{
+    if (length == 0)
+        return;
+    const auto first = addr / Memory::s_page_size;
+    const auto last = std::min((addr + length - 1) / Memory::s_page_size, Memory::s_page_count - 1);
+    for (auto page = first; page <= last; ++page)
+        dirty[page] = true;
 }
 
 MemoryMappedPeripheral* Memory::Impl::FindPeripheralByAddress(const memory::Address addr)
@@ -59,8 +107,61 @@ MemoryMappedPeripheral* Memory::Impl::FindPeripheralByAddress(const memory::Addr
 
 void Memory::Reset() { impl->Reset(); }
 
+void Memory::SaveState(StateWriter& writer) const
+{
+    writer.WriteBytes({ impl->memory, memorySize });
+}
+
+void Memory::LoadState(StateReader& reader)
+{
+    reader.ReadBytes({ impl->memory, memorySize });
+    impl->dirty.fill(true);
+}
+
+std::shared_ptr<const Memory::Checkpoint> Memory::CreateCheckpoint()
+{
+    const int fd = memfd_create("x86box-memory", MFD_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("unable to create memory checkpoint");
+    auto checkpoint = std::make_shared<const Checkpoint>(fd);
+
+    for (size_t offset = 0; offset < memorySize; ) {
+        const auto n = write(fd, impl->memory + offset, memorySize - offset);
+        if (n <= 0)
+            throw std::runtime_error("unable to write memory checkpoint");
+        offset += n;
+    }
+
+    // Share the checkpoint pages from now on, so that only pages written
+    // after this point occupy additional memory
+    impl->Map(fd);
+    return checkpoint;
+}
+
+void Memory::RestoreCheckpoint(const Checkpoint& checkpoint)
+{
+    impl->Map(checkpoint.fd);
+}
+
+std::vector<uint16_t> Memory::CollectDirtyPages()
+{
+    std::vector<uint16_t> pages;
+    for (size_t page = 0; page < s_page_count; ++page) {
+        if (impl->dirty[page])
+            pages.push_back(page);
+    }
+    impl->dirty.fill(false);
+    return pages;
+}
+
+std::span<uint8_t> Memory::GetPage(size_t page)
+{
+    return { impl->memory + page * s_page_size, s_page_size };
+}
+
 uint8_t Memory::ReadByte(memory::Address addr)
 {
+    addr &= addressMask;
     if (const auto p = impl->FindPeripheralByAddress(addr); p)
         return p->ReadByte(addr);
     else
@@ -69,28 +170,36 @@ uint8_t Memory::ReadByte(memory::Address addr)
 
 uint16_t Memory::ReadWord(memory::Address addr)
 {
+    addr &= addressMask;
     if (const auto p = impl->FindPeripheralByAddress(addr); p)
         return p->ReadWord(addr);
     else
-        return impl->memory[addr] | static_cast<uint16_t>(impl->memory[addr + 1]) << 8;
+        return impl->memory[addr] | static_cast<uint16_t>(impl->memory[(addr + 1) & addressMask]) << 8;
 }
 
 void Memory::WriteByte(memory::Address addr, uint8_t data)
 {
+    addr &= addressMask;
     if (const auto p = impl->FindPeripheralByAddress(addr); p) {
         p->WriteByte(addr, data);
     } else {
         impl->memory[addr] = data;
+        impl->dirty[addr / s_page_size] = true;
     }
 }
 
 void Memory::WriteWord(memory::Address addr, uint16_t data)
 {
+    addr &= addressMask;
     if (const auto p = impl->FindPeripheralByAddress(addr); p) {
         p->WriteWord(addr, data);
+    } else if (addr == addressMask) {
+        WriteByte(addr, data & 0xff);
+        WriteByte(0, data >> 8);
     } else {
         impl->memory[addr + 0] = data & 0xff;
         impl->memory[addr + 1] = data >> 8;
+        impl->MarkDirty(addr, 2);
     }
 }
 
@@ -113,8 +222,14 @@ std::string Memory::GetASCIIZString(memory::Address addr)
 
 void* Memory::GetPointer(memory::Address addr, uint16_t length)
 {
-    if (const auto p = impl->FindPeripheralByAddress(addr); p)
+    // The whole range must be plain memory
+    if (addr + length > memorySize)
         return nullptr;
-    else
-        return &impl->memory[addr];
+    const auto overlaps = [&](const auto& m) { return addr < m.base + m.length && m.base < addr + length; };
+    if (std::any_of(impl->mappings.begin(), impl->mappings.end(), overlaps))
+        return nullptr;
+
+    // The caller may write through the pointer
+    impl->MarkDirty(addr, length);
+    return &impl->memory[addr];
 }
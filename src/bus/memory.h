@@ -3,18 +3,40 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <span>
 #include "../interface/memoryinterface.h"
 
+struct StateWriter;
+struct StateReader;
+
 class Memory : public MemoryInterface
 {
     struct Impl;
     std::unique_ptr<Impl> impl;
 
   public:
+    // Immutable copy of guest RAM; memory restored from a checkpoint shares
+    // its pages until they are written to
+    struct Checkpoint;
+
     Memory();
     ~Memory();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+
+    std::shared_ptr<const Checkpoint> CreateCheckpoint();
+    void RestoreCheckpoint(const Checkpoint& checkpoint);
+
+    // Writes are tracked per page to allow incremental snapshots
+    static constexpr inline size_t s_page_size = 4096;
+    static constexpr inline size_t s_page_count = 256;
+
+    // Returns the pages written to since the previous call
+    std::vector<uint16_t> CollectDirtyPages();
+    // Direct page access; this does not mark the page as dirty
+    std::span<uint8_t> GetPage(size_t page);
 
     uint8_t ReadByte(memory::Address addr) override;
     uint16_t ReadWord(memory::Address addr) override;
@@ -1,6 +1,8 @@
 #include "cpux86.h"
 #include "../interface/iointerface.h"
 #include "../interface/memoryinterface.h"
+#include "../interface/stateinterface.h"
+#include <array>
 #include <bit>
 #include <utility>
 #include <variant>
@@ -8,6 +10,9 @@
 
 #include "spdlog/spdlog.h"
 
+// Unless counting is compiled in, the statistics take no space at all
+static_assert(cpu::collectStatistics || sizeof(CPUx86) < sizeof(cpu::Statistics));
+
 namespace
 {
     // 80186/80188 always mask a shift count in ROL/ROR/SHL/SHR/etc; this is
@@ -27,6 +32,17 @@ namespace
         flags |= cpu::flag::ON;
         return flags;
     }
+
+    // Whether a ModR/M byte follows the opcode, for the statistics
+    constexpr bool HasModRM(uint8_t opcode)
+    {
+        if (opcode < 0x40) return (opcode & 7) < 4;
+        if (opcode >= 0x80 && opcode <= 0x8f) return true;
+        if (opcode >= 0xc4 && opcode <= 0xc7) return true;
+        if (opcode >= 0xd0 && opcode <= 0xd3) return true;
+        if (opcode >= 0xd8 && opcode <= 0xdf) return true;
+        return opcode == 0xf6 || opcode == 0xf7 || opcode == 0xfe || opcode == 0xff;
+    }
 }
 
 CPUx86::CPUx86(MemoryInterface& memory, IOInterface& io)
@@ -448,6 +464,15 @@ void CPUx86::RunInstruction()
         reg.Store(op(m_State.m_flags, reg.Load(), ReadEA8(m_Memory, m_State, modRm)));
     };
 
+    // Returns guest memory for a forward block transfer of count elements,
+    // provided it neither wraps around the segment nor touches peripherals
+    auto getStringBlock = [&](uint16_t seg, uint16_t off, unsigned int count, unsigned int size) -> uint8_t* {
+        const auto length = count * size;
+        if (cpu::FlagDirection(m_State.m_flags) || length == 0 || length > 0xffff || off + length > 0x10000)
+            return nullptr;
+        return static_cast<uint8_t*>(m_Memory.GetPointer(MakeAddr(seg, off), length));
+    };
+
 
     // Handle prefixes first
     m_State.m_seg_override = {};
@@ -475,9 +500,21 @@ void CPUx86::RunInstruction()
         } else {
             break;
         }
+        if constexpr (cpu::collectStatistics) {
+            m_Statistics.CountPrefix(opcode);
+        }
         opcode = GetCodeImm8(m_Memory, m_State);
     }
 
+    [[maybe_unused]] uint16_t repCount{};
+    if constexpr (cpu::collectStatistics) {
+        m_Statistics.CountOpcode(opcode);
+        if (HasModRM(opcode)) {
+            m_Statistics.CountModRm(m_Memory.ReadByte(MakeAddr(m_State.m_cs, m_State.m_ip)));
+        }
+        repCount = m_State.m_cx;
+    }
+
     switch (opcode) {
         case 0x00: /* ADD Eb Gb */ {
             opEbGb(cpu::alu::ADD<8>);
@@ -946,20 +983,94 @@ void CPUx86::RunInstruction()
             invalidOpcode();
             break;
         }
-        case 0x6c: /* -- */ {
-            invalidOpcode();
+        case 0x6c: /* INSB */ {
+            if (rep) {
+                if (auto ptr = getStringBlock(m_State.m_es, m_State.m_di, m_State.m_cx, 1); ptr) {
+                    m_IO.InBlock8(m_State.m_dx, { ptr, m_State.m_cx });
+                    m_State.m_di += m_State.m_cx;
+                    m_State.m_cx = 0;
+                    break;
+                }
+            }
+            int delta = cpu::FlagDirection(m_State.m_flags) ? -1 : 1;
+            if (rep) {
+                while (m_State.m_cx != 0) {
+                    m_State.m_cx--;
+                    m_Memory.WriteByte(MakeAddr(m_State.m_es, m_State.m_di), m_IO.In8(m_State.m_dx));
+                    m_State.m_di += delta;
+                }
+            } else {
+                m_Memory.WriteByte(MakeAddr(m_State.m_es, m_State.m_di), m_IO.In8(m_State.m_dx));
+                m_State.m_di += delta;
+            }
             break;
         }
-        case 0x6d: /* -- */ {
-            invalidOpcode();
+        case 0x6d: /* INSW */ {
+            if (rep) {
+                if (auto ptr = getStringBlock(m_State.m_es, m_State.m_di, m_State.m_cx, 2); ptr) {
+                    m_IO.InBlock16(m_State.m_dx, { ptr, m_State.m_cx * 2u });
+                    m_State.m_di += m_State.m_cx * 2;
+                    m_State.m_cx = 0;
+                    break;
+                }
+            }
+            int delta = cpu::FlagDirection(m_State.m_flags) ? -2 : 2;
+            if (rep) {
+                while (m_State.m_cx != 0) {
+                    m_State.m_cx--;
+                    m_Memory.WriteWord(MakeAddr(m_State.m_es, m_State.m_di), m_IO.In16(m_State.m_dx));
+                    m_State.m_di += delta;
+                }
+            } else {
+                m_Memory.WriteWord(MakeAddr(m_State.m_es, m_State.m_di), m_IO.In16(m_State.m_dx));
+                m_State.m_di += delta;
+            }
             break;
         }
-        case 0x6e: /* -- */ {
-            invalidOpcode();
+        case 0x6e: /* OUTSB */ {
+            const auto seg = HandleSegmentOverride(m_State, cpu::Segment::DS);
+            if (rep) {
+                if (auto ptr = getStringBlock(GetSReg16(m_State, seg), m_State.m_si, m_State.m_cx, 1); ptr) {
+                    m_IO.OutBlock8(m_State.m_dx, { ptr, m_State.m_cx });
+                    m_State.m_si += m_State.m_cx;
+                    m_State.m_cx = 0;
+                    break;
+                }
+            }
+            int delta = cpu::FlagDirection(m_State.m_flags) ? -1 : 1;
+            if (rep) {
+                while (m_State.m_cx != 0) {
+                    m_State.m_cx--;
+                    m_IO.Out8(m_State.m_dx, m_Memory.ReadByte(MakeAddr(GetSReg16(m_State, seg), m_State.m_si)));
+                    m_State.m_si += delta;
+                }
+            } else {
+                m_IO.Out8(m_State.m_dx, m_Memory.ReadByte(MakeAddr(GetSReg16(m_State, seg), m_State.m_si)));
+                m_State.m_si += delta;
+            }
             break;
         }
-        case 0x6f: /* -- */ {
-            invalidOpcode();
+        case 0x6f: /* OUTSW */ {
+            const auto seg = HandleSegmentOverride(m_State, cpu::Segment::DS);
+            if (rep) {
+                if (auto ptr = getStringBlock(GetSReg16(m_State, seg), m_State.m_si, m_State.m_cx, 2); ptr) {
+                    m_IO.OutBlock16(m_State.m_dx, { ptr, m_State.m_cx * 2u });
+                    m_State.m_si += m_State.m_cx * 2;
+                    m_State.m_cx = 0;
+                    break;
+                }
+            }
+            int delta = cpu::FlagDirection(m_State.m_flags) ? -2 : 2;
+            if (rep) {
+                while (m_State.m_cx != 0) {
+                    m_State.m_cx--;
+                    m_IO.Out16(m_State.m_dx, m_Memory.ReadWord(MakeAddr(GetSReg16(m_State, seg), m_State.m_si)));
+                    m_State.m_si += delta;
+                }
+            } else {
+                m_IO.Out16(m_State.m_dx, m_Memory.ReadWord(MakeAddr(GetSReg16(m_State, seg), m_State.m_si)));
+                m_State.m_si += delta;
+            }
             break;
         }
         case 0x70: /* JO Jb */ {
@@ -2071,6 +2182,35 @@ void CPUx86::RunInstruction()
             break;
         }
     }
+
+    if constexpr (cpu::collectStatistics) {
+        if (rep) {
+            m_Statistics.CountRep(repCount - m_State.m_cx);
+        }
+    }
+}
+
+namespace
+{
+    constexpr auto stateRegisters = std::to_array({
+        &cpu::State::m_ax, &cpu::State::m_cx, &cpu::State::m_dx, &cpu::State::m_bx,
+        &cpu::State::m_sp, &cpu::State::m_bp, &cpu::State::m_si, &cpu::State::m_di,
+        &cpu::State::m_ip, &cpu::State::m_es, &cpu::State::m_cs, &cpu::State::m_ss,
+        &cpu::State::m_ds, &cpu::State::m_flags
+    });
+}
+
+void CPUx86::SaveState(StateWriter& writer) const
+{
+    for (const auto reg: stateRegisters)
+        writer.Write(m_State.*reg);
+}
+
+void CPUx86::LoadState(StateReader& reader)
+{
+    for (const auto reg: stateRegisters)
+        reader.Read(m_State.*reg);
+    m_State.m_seg_override = {};
 }
 
 CPUx86::addr_t CPUx86::MakeAddr(uint16_t seg, uint16_t off)
@@ -2,9 +2,12 @@
 
 #include <cstdint>
 #include "state.h"
+#include "statistics.h"
 
 struct IOInterface;
 struct MemoryInterface;
+struct StateWriter;
+struct StateReader;
 
 class CPUx86
 {
@@ -16,9 +19,12 @@ class CPUx86
 
     void RunInstruction();
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 
     cpu::State& GetState() { return m_State; }
     const cpu::State& GetState() const { return m_State; }
+    const cpu::CollectedStatistics& GetStatistics() const { return m_Statistics; }
 
     static addr_t MakeAddr(uint16_t seg, uint16_t off);
 
@@ -28,4 +34,5 @@ class CPUx86
     MemoryInterface& m_Memory;
     IOInterface& m_IO;
     cpu::State m_State;
+    [[no_unique_address]] cpu::CollectedStatistics m_Statistics;
 };
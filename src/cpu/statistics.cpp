@@ -0,0 +1,83 @@
+#include "statistics.h"
+
+#include <algorithm>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "spdlog/fmt/fmt.h"
+
+namespace
+{
+    constexpr std::array<const char*, 8> modRmMemoryForms{
+        "[bx+si]", "[bx+di]", "[bp+si]", "[bp+di]", "[si]", "[di]", "[bp]", "[bx]"
+    };
+
+    const char* GetPrefixName(size_t prefix)
+    {
+        switch(prefix) {
+            case 0x26: return "es:";
+            case 0x2e: return "cs:";
+            case 0x36: return "ss:";
+            case 0x3e: return "ds:";
+            case 0xf0: return "lock";
+            case 0xf2: return "repnz";
+            case 0xf3: return "repz";
+        }
+        return "?";
+    }
+
+    double Percentage(uint64_t count, uint64_t total)
+    {
+        return total > 0 ? 100.0 * count / total : 0.0;
+    }
+}
+
+void cpu::DumpStatistics(std::ostream& os, const Statistics& statistics)
+{
+    const auto instructions = std::accumulate(statistics.opcodes.begin(), statistics.opcodes.end(), uint64_t{});
+    os << fmt::format("{} instructions\n", instructions);
+
+    os << "\nOpcodes:\n";
+    std::vector<size_t> opcodes(statistics.opcodes.size());
+    std::iota(opcodes.begin(), opcodes.end(), 0);
+    std::stable_sort(opcodes.begin(), opcodes.end(), [&](size_t a, size_t b) {
+        return statistics.opcodes[a] > statistics.opcodes[b];
+    });
+    for (const auto opcode : opcodes) {
+        if (const auto count = statistics.opcodes[opcode]; count > 0)
+            os << fmt::format("  {:02x} {:14} {:6.2f}%\n", opcode, count, Percentage(count, instructions));
+    }
+
+    os << "\nPrefixes:\n";
+    for (size_t prefix = 0; prefix < statistics.prefixes.size(); ++prefix) {
+        if (const auto count = statistics.prefixes[prefix]; count > 0)
+            os << fmt::format("  {:02x} {:6} {:14}\n", prefix, GetPrefixName(prefix), count);
+    }
+
+    const auto operands = std::accumulate(statistics.modRm.begin(), statistics.modRm.end(), uint64_t{});
+    const auto registerOperands = std::accumulate(statistics.modRm.begin() + 24, statistics.modRm.end(), uint64_t{});
+    os << fmt::format("\nModR/M operands: {} register ({:.2f}%), {} memory ({:.2f}%)\n",
+        registerOperands, Percentage(registerOperands, operands),
+        operands - registerOperands, Percentage(operands - registerOperands, operands));
+    for (size_t mod = 0; mod < 3; ++mod) {
+        for (size_t rm = 0; rm < 8; ++rm) {
+            const auto count = statistics.modRm[mod * 8 + rm];
+            if (count == 0) continue;
+            const auto form = mod == 0 && rm == 6 ? std::string("[disp16]")
+                : mod == 0 ? std::string(modRmMemoryForms[rm])
+                : fmt::format("{}+disp{}", modRmMemoryForms[rm], mod == 1 ? 8 : 16);
+            os << fmt::format("  mod={} rm={} {:14} {:14} {:6.2f}%\n", mod, rm, form, count, Percentage(count, operands));
+        }
+    }
+
+    const auto repInstructions = std::accumulate(statistics.repInstructions.begin(), statistics.repInstructions.end(), uint64_t{});
+    os << fmt::format("\nREP: {} instructions, {} iterations\n", repInstructions, statistics.repIterations);
+    for (size_t bucket = 0; bucket < statistics.repInstructions.size(); ++bucket) {
+        const auto count = statistics.repInstructions[bucket];
+        if (count == 0) continue;
+        const auto low = bucket == 0 ? 0 : 1u << (bucket - 1);
+        const auto high = bucket == 0 ? 0 : (1u << bucket) - 1;
+        os << fmt::format("  {:5}-{:<5} {:14}\n", low, high, count);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iosfwd>
+#include <type_traits>
+
+namespace cpu
+{
+    // Counting is compiled in using -DENABLE_INSTRUCTION_STATISTICS=ON
+#ifdef ENABLE_INSTRUCTION_STATISTICS
+    constexpr inline bool collectStatistics = true;
+#else
+    constexpr inline bool collectStatistics = false;
+#endif
+
+    // Instruction mix, to determine which instructions deserve a fast path
+    struct Statistics
+    {
+        // REP iterations are counted per power of two: 0, 1, 2-3, 4-7, ..., 32768-65535
+        static constexpr inline size_t NumberOfRepBuckets = 17;
+
+        std::array<uint64_t, 256> opcodes{};
+        // Indexed by prefix byte
+        std::array<uint64_t, 256> prefixes{};
+        // Indexed by mod * 8 + rm; mod 3 is a register operand
+        std::array<uint64_t, 32> modRm{};
+        std::array<uint64_t, NumberOfRepBuckets> repInstructions{};
+        uint64_t repIterations{};
+
+        void CountPrefix(uint8_t prefix) { ++prefixes[prefix]; }
+        void CountOpcode(uint8_t opcode) { ++opcodes[opcode]; }
+        void CountModRm(uint8_t byte) { ++modRm[(byte >> 6) * 8 + (byte & 7)]; }
+        void CountRep(uint16_t iterations)
+        {
+            ++repInstructions[std::bit_width(iterations)];
+            repIterations += iterations;
+        }
+    };
+
+    // Takes the place of Statistics when counting is not compiled in
+    struct NoStatistics
+    {
+        void CountPrefix(uint8_t) { }
+        void CountOpcode(uint8_t) { }
+        void CountModRm(uint8_t) { }
+        void CountRep(uint16_t) { }
+    };
+
+    using CollectedStatistics = std::conditional_t<collectStatistics, Statistics, NoStatistics>;
+
+    void DumpStatistics(std::ostream& os, const Statistics& statistics);
+    inline void DumpStatistics(std::ostream&, const NoStatistics&) { }
+}
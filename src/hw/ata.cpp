@@ -1,6 +1,8 @@
 #include "ata.h"
 #include "../interface/imageprovider.h"
 #include "../interface/iointerface.h"
+#include "../interface/stateinterface.h"
+#include "diskgeometry.h"
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
@@ -60,6 +62,8 @@ namespace
         static constexpr inline uint8_t ReadSectors = 0x20;
         static constexpr inline uint8_t WriteSectors = 0x30;
         static constexpr inline uint8_t ReadSectorsWithVerify = 0x40;
+        static constexpr inline uint8_t ReadMultiple = 0xc4;
+        static constexpr inline uint8_t WriteMultiple = 0xc5;
         static constexpr inline uint8_t SetMultipleMode = 0xc6;
         static constexpr inline uint8_t Identify = 0xec;
         static constexpr inline uint8_t SetFeatures = 0xef;
@@ -107,15 +111,23 @@ namespace
     } __attribute__((packed));
     static_assert(sizeof(Identify) == 512);
 
-    // Emulate type 3 (30.6MB) - https://vintage-pc.tripod.com/types.html
-    constexpr inline int NumCylinders = 615;
-    constexpr inline int NumHeads = 6;
-    constexpr inline int SectorsPerTrack = 17;
+    using disk::SectorSize;
+    using disk::Geometry;
 
-    uint32_t CHStoLBA(unsigned int cyl, unsigned int head, unsigned int sector)
+    // Largest block accepted by SET MULTIPLE MODE
+    constexpr inline size_t MaxMultipleSectors = 16;
+    constexpr inline uint8_t DriveHeadLBA = (1 << 6);
+    constexpr inline uint64_t MaxLBA28Sectors = (1 << 28) - 1;
+
+    uint64_t GetNumberOfSectors(Bytes imageSize)
+    {
+        return std::min<uint64_t>(imageSize / SectorSize, MaxLBA28Sectors);
+    }
+
+    uint32_t CHStoLBA(const Geometry& geometry, unsigned int cyl, unsigned int head, unsigned int sector)
     {
         // https://en.wikipedia.org/wiki/Logical_block_addressing
-        return (cyl * NumHeads + head) * SectorsPerTrack + (sector - 1);
+        return (cyl * geometry.heads + head) * geometry.sectors_per_track + (sector - 1);
     }
 
     std::optional<Image> SelectedDeviceToImage(ImageProvider& imageProvider, int selected_device)
@@ -139,8 +151,20 @@ struct ATA::Impl : IOPeripheral
     void Out16(io_port port, uint16_t val) override;
     uint8_t In8(io_port port) override;
     uint16_t In16(io_port port) override;
+    void InBlock8(io_port port, std::span<uint8_t> data) override;
+    void InBlock16(io_port port, std::span<uint8_t> data) override;
+    void OutBlock8(io_port port, std::span<const uint8_t> data) override;
+    void OutBlock16(io_port port, std::span<const uint8_t> data) override;
 
+    size_t ReadData(std::span<uint8_t> data);
+    size_t WriteData(std::span<const uint8_t> data);
     void ExecuteCommand(uint8_t cmd);
+    bool SetupTransfer();
+    void NextBlock();
+    void StartTransfer();
+    void CompleteTransfer(size_t result);
+    void WaitForTransfer();
+    bool IsBusy();
 
     size_t selected_device{};
     uint8_t sector_count{};
@@ -148,10 +172,16 @@ struct ATA::Impl : IOPeripheral
     uint16_t cylinder{};
     uint8_t feature{};
     uint8_t head{};
+    bool lba_mode{};
     uint8_t error{};
 
-    std::array<uint8_t, 512> sector_data{};
-    size_t sector_data_offset = sector_data.size();
+    // Data is transferred in blocks of block_sectors sectors, one data
+    // request per block
+    std::array<uint8_t, MaxMultipleSectors * SectorSize> sector_data{};
+    size_t sector_data_offset{};
+    size_t block_length{};
+    uint8_t block_sectors{1};
+    uint8_t multiple_count{};
 
     enum class TransferMode {
         Idle,
@@ -160,6 +190,29 @@ struct ATA::Impl : IOPeripheral
     } transferMode{TransferMode::Idle};
     uint64_t current_lba{};
     size_t sectors_left{};
+    // Sector transfer in progress; the device is busy until it completes
+    std::unique_ptr<ImageRequest> request;
+
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        fn(selected_device);
+        fn(sector_count);
+        fn(sector_nr);
+        fn(cylinder);
+        fn(feature);
+        fn(head);
+        fn(lba_mode);
+        fn(error);
+        fn(sector_data);
+        fn(sector_data_offset);
+        fn(block_length);
+        fn(block_sectors);
+        fn(multiple_count);
+        fn(transferMode);
+        fn(current_lba);
+        fn(sectors_left);
+    }
 };
 
 ATA::ATA(IOInterface& io, ImageProvider& imageProvider)
@@ -175,6 +228,18 @@ void ATA::Reset()
     impl->Reset();
 }
 
+void ATA::SaveState(StateWriter& writer) const
+{
+    impl->WaitForTransfer();
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+}
+
+void ATA::LoadState(StateReader& reader)
+{
+    impl->request.reset();
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+}
+
 ATA::Impl::Impl(ImageProvider& imageProvider)
     : imageProvider(imageProvider)
     , logger(spdlog::stderr_color_st("ata"))
@@ -189,14 +254,19 @@ ATA::Impl::~Impl()
 
 void ATA::Impl::Reset()
 {
+    request.reset();
     selected_device = 0;
     sector_count = 0;
     sector_nr = 0;
     cylinder = 0;
     feature = 0;
     head = 0;
+    lba_mode = false;
     error = 0;
-    sector_data_offset = sector_data.size();
+    sector_data_offset = 0;
+    block_length = 0;
+    block_sectors = 1;
+    multiple_count = 0;
 
     transferMode = TransferMode::Idle;
     current_lba = 0;
@@ -208,25 +278,7 @@ void ATA::Impl::Out8(io_port port, uint8_t val)
     logger->info("out8({:x}, {:x})", port, val);
     switch (port) {
         case io::Data:
-            if (transferMode == TransferMode::HostToPeripheral && sector_data_offset < sector_data.size()) {
-                sector_data[sector_data_offset] = val;
-                ++sector_data_offset;
-
-                if (sector_data_offset == sector_data.size()) {
-                    const auto image = SelectedDeviceToImage(imageProvider, selected_device);
-                    if (!image || imageProvider.Write(*image, current_lba * sector_data.size(), sector_data) != sector_data.size()) {
-                        logger->critical("write error!!!");
-                    }
-
-                    --sectors_left;
-                    if (sectors_left > 0) {
-                        ++current_lba;
-                        sector_data_offset = 0;
-                    } else {
-                        transferMode = TransferMode::Idle;
-                    }
-                }
-            } else {
+            if (WriteData({ &val, 1 }) == 0) {
                 logger->error("out8: Data, but no data needed");
             }
             break;
@@ -248,8 +300,10 @@ void ATA::Impl::Out8(io_port port, uint8_t val)
         case io::DriveHead:
             selected_device = (val & 0x10) ? 1 : 0;
             head = val & 0xf;
+            lba_mode = (val & DriveHeadLBA) != 0;
             break;
         case io::DevControl:
+            WaitForTransfer();
             ExecuteCommand(val);
             break;
         default:
@@ -264,28 +318,9 @@ uint8_t ATA::Impl::In8(io_port port)
     switch (port)
     {
         case io::Data: {
-            if (transferMode == TransferMode::PeripheralToHost && sector_data_offset < sector_data.size()) {
-                const auto data = sector_data[sector_data_offset];
-                ++sector_data_offset;
+            uint8_t data;
+            if (ReadData({ &data, 1 }) == 1) {
                 logger->debug("in8: Data ({:x})", data);
-
-                if (sector_data_offset == sector_data.size()) {
-                    logger->warn("in8: Sector completed");
-
-                    --sectors_left;
-                    if (sectors_left > 0) {
-                        ++current_lba;
-                        const auto image = SelectedDeviceToImage(imageProvider, selected_device);
-                        if (!image || imageProvider.Read(*image, current_lba * sector_data.size(), sector_data) != sector_data.size()) {
-                            logger->critical("read error!!!");
-                            std::fill(sector_data.begin(), sector_data.end(), 0xff);
-                        }
-                        sector_data_offset = 0;
-                    } else {
-                        transferMode = TransferMode::Idle;
-                    }
-                }
-
                 return data;
             } else {
                 logger->error("in8: Data, but no data available");
@@ -294,7 +329,7 @@ uint8_t ATA::Impl::In8(io_port port)
         }
         case io::Error_Read:
             logger->info("in8: Error");
-            break;
+            return error;
         case io::SectorCount:
             logger->info("in8: SectorCount");
             break;
@@ -311,10 +346,15 @@ uint8_t ATA::Impl::In8(io_port port)
             logger->info("in8: Drivehead");
             break;
         case io::AltStatus: {
+            if (IsBusy()) {
+                logger->info("in8: AltStatus busy");
+                return status::Busy;
+            }
+
             uint8_t status = 0;
             if (SelectedDeviceToImage(imageProvider, selected_device))
                 status |= status::Ready;
-            if (sector_data_offset < sector_data.size())
+            if (sector_data_offset < block_length)
                 status |= status::DataRequest;
             if (error != 0)
                 status |= status::Error;
@@ -328,33 +368,137 @@ uint8_t ATA::Impl::In8(io_port port)
 void ATA::Impl::Out16(io_port port, uint16_t val)
 {
     logger->info("out16({:x}, {:x})", port, val);
+    if (port == io::Data) {
+        const std::array<uint8_t, 2> data{ static_cast<uint8_t>(val & 0xff), static_cast<uint8_t>(val >> 8) };
+        OutBlock16(port, data);
+    }
 }
 
 uint16_t ATA::Impl::In16(io_port port)
 {
     logger->info("in16({:x})", port);
+    if (port == io::Data) {
+        std::array<uint8_t, 2> data;
+        InBlock16(port, data);
+        return data[0] | (data[1] << 8);
+    }
     return 0;
 }
 
-void ATA::Impl::ExecuteCommand(uint8_t cmd)
+void ATA::Impl::InBlock8(io_port port, std::span<uint8_t> data)
 {
-    switch(cmd) {
-        case command::ReadSectors: {
-            logger->info("command: Read Sectors ({:x}), device {}, sector_count {} cylinder {} head {} sector_nr {} feature {}",
-                cmd, selected_device, sector_count, cylinder, head, sector_nr, feature);
+    if (port != io::Data) {
+        IOPeripheral::InBlock8(port, data);
+        return;
+    }
 
-            current_lba = CHStoLBA(cylinder, head, sector_nr);
+    logger->info("inblock({:x}, {} bytes)", port, data.size());
+    while (!data.empty()) {
+        const auto length = ReadData(data);
+        if (length == 0) {
+            logger->error("inblock: Data, but no data available ({} bytes left)", data.size());
+            std::fill(data.begin(), data.end(), 0);
+            break;
+        }
+        data = data.subspan(length);
+    }
+}
 
-            logger->info("read from c/h/s {}/{}/{} -> lba {}", cylinder, head, sector_nr, current_lba);
-            const auto image = SelectedDeviceToImage(imageProvider, selected_device);
-            if (!image || imageProvider.Read(*image, current_lba * sector_data.size(), sector_data) != sector_data.size()) {
-                logger->critical("read error!!!");
-                std::fill(sector_data.begin(), sector_data.end(), 0xff);
+void ATA::Impl::InBlock16(io_port port, std::span<uint8_t> data)
+{
+    // The data register delivers the sector bytes in order regardless of
+    // the access width
+    InBlock8(port, data);
+}
+
+void ATA::Impl::OutBlock8(io_port port, std::span<const uint8_t> data)
+{
+    if (port != io::Data) {
+        IOPeripheral::OutBlock8(port, data);
+        return;
+    }
+
+    logger->info("outblock({:x}, {} bytes)", port, data.size());
+    while (!data.empty()) {
+        const auto length = WriteData(data);
+        if (length == 0) {
+            logger->error("outblock: Data, but no data needed ({} bytes left)", data.size());
+            break;
+        }
+        data = data.subspan(length);
+    }
+}
+
+void ATA::Impl::OutBlock16(io_port port, std::span<const uint8_t> data)
+{
+    OutBlock8(port, data);
+}
+
+// Copies data from the current block, up to its end; the next block is
+// fetched once this one has been consumed
+size_t ATA::Impl::ReadData(std::span<uint8_t> data)
+{
+    WaitForTransfer();
+    if (transferMode != TransferMode::PeripheralToHost || sector_data_offset >= block_length)
+        return 0;
+
+    const auto length = std::min(data.size(), block_length - sector_data_offset);
+    std::copy_n(sector_data.begin() + sector_data_offset, length, data.begin());
+    sector_data_offset += length;
+
+    if (sector_data_offset == block_length) {
+        logger->debug("Block completed");
+
+        const auto block_sectors_done = block_length / SectorSize;
+        sectors_left -= block_sectors_done;
+        if (sectors_left > 0) {
+            current_lba += block_sectors_done;
+            NextBlock();
+            StartTransfer();
+        } else {
+            transferMode = TransferMode::Idle;
+        }
+    }
+    return length;
+}
+
+// Copies data into the current block, up to its end; the block is written
+// once it is complete
+size_t ATA::Impl::WriteData(std::span<const uint8_t> data)
+{
+    WaitForTransfer();
+    if (transferMode != TransferMode::HostToPeripheral || sector_data_offset >= block_length)
+        return 0;
+
+    const auto length = std::min(data.size(), block_length - sector_data_offset);
+    std::copy_n(data.begin(), length, sector_data.begin() + sector_data_offset);
+    sector_data_offset += length;
+
+    if (sector_data_offset == block_length)
+        StartTransfer();
+    return length;
+}
+
+void ATA::Impl::ExecuteCommand(uint8_t cmd)
+{
+    switch(cmd) {
+        case command::ReadSectors:
+        case command::ReadMultiple: {
+            logger->info("command: Read {} ({:x}), device {}, sector_count {} cylinder {} head {} sector_nr {} feature {}",
+                cmd == command::ReadMultiple ? "Multiple" : "Sectors", cmd, selected_device, sector_count, cylinder, head, sector_nr, feature);
+
+            block_sectors = (cmd == command::ReadMultiple) ? multiple_count : 1;
+            if (block_sectors == 0) {
+                logger->error("read multiple without multiple mode");
+                error = error::AbortedCommand;
+                break;
             }
-            sector_data_offset = 0;
-            sectors_left = sector_count;
+            if (!SetupTransfer())
+                break;
+            logger->info("read from c/h/s {}/{}/{} -> lba {}", cylinder, head, sector_nr, current_lba);
             transferMode = TransferMode::PeripheralToHost;
-            error = 0;
+            NextBlock();
+            StartTransfer();
             break;
         }
         case command::ReadSectorsWithVerify: {
@@ -363,17 +507,22 @@ void ATA::Impl::ExecuteCommand(uint8_t cmd)
             error = 0;
             break;
         }
-        case command::WriteSectors: {
-            logger->info("command: Write Sectors ({:x}), device {}, sector_count {} cylinder {} head {} sector_nr {} feature {}",
-                cmd, selected_device, sector_count, cylinder, head, sector_nr, feature);
-
+        case command::WriteSectors:
+        case command::WriteMultiple: {
+            logger->info("command: Write {} ({:x}), device {}, sector_count {} cylinder {} head {} sector_nr {} feature {}",
+                cmd == command::WriteMultiple ? "Multiple" : "Sectors", cmd, selected_device, sector_count, cylinder, head, sector_nr, feature);
+
+            block_sectors = (cmd == command::WriteMultiple) ? multiple_count : 1;
+            if (block_sectors == 0) {
+                logger->error("write multiple without multiple mode");
+                error = error::AbortedCommand;
+                break;
+            }
+            if (!SetupTransfer())
+                break;
             logger->info("write to c/h/s {}/{}/{} -> lba {}", cylinder, head, sector_nr, current_lba);
-            current_lba = CHStoLBA(cylinder, head, sector_nr);
-
-            sector_data_offset = 0;
-            sectors_left = sector_count;
             transferMode = TransferMode::HostToPeripheral;
-            error = 0;
+            NextBlock();
             break;
         }
         case command::Identify: {
@@ -381,11 +530,28 @@ void ATA::Impl::ExecuteCommand(uint8_t cmd)
                 cmd, selected_device, sector_count, cylinder, head, sector_nr, feature);
             const auto image = SelectedDeviceToImage(imageProvider, selected_device);
             if (image) {
+                const auto imageSize = imageProvider.GetSize(*image);
+                const auto geometry = disk::GetHarddiskGeometry(imageSize);
+                const auto chs_sectors = geometry.cylinders * geometry.heads * geometry.sectors_per_track;
+                const auto lba_sectors = GetNumberOfSectors(imageSize);
+
                 Identify id{};
                 id.general_config = (1 << 15);
-                id.num_cylinders = NumCylinders;
-                id.num_heads = NumHeads;
-                id.sectors_per_track = SectorsPerTrack;
+                id.num_cylinders = geometry.cylinders;
+                id.num_heads = geometry.heads;
+                id.sectors_per_track = geometry.sectors_per_track;
+                id.vendor47 = 0x8000 | MaxMultipleSectors;
+                id.capabilities = (1 << 9); // LBA supported
+                id.valid_54to58_64to70 = (1 << 0);
+                id.current_num_cylinders = geometry.cylinders;
+                id.current_num_heads = geometry.heads;
+                id.current_sectors_per_track = geometry.sectors_per_track;
+                id.current_capacity[0] = chs_sectors & 0xffff;
+                id.current_capacity[1] = chs_sectors >> 16;
+                if (multiple_count != 0)
+                    id.max_sectors_per_transfer = (1 << 8) | multiple_count;
+                id.total_user_addressable_sectors[0] = lba_sectors & 0xffff;
+                id.total_user_addressable_sectors[1] = lba_sectors >> 16;
 
                 auto write_string = [&](uint16_t* dest, size_t num_words, const char* s) {
                     for(size_t n = 0; n < num_words; ++n)
@@ -401,8 +567,9 @@ void ATA::Impl::ExecuteCommand(uint8_t cmd)
 
                 write_string(&id.model[0], 20, "DUMMY DRIVE");
 
-                memcpy(sector_data.data(), reinterpret_cast<const void*>(&id), sector_data.size());
+                memcpy(sector_data.data(), reinterpret_cast<const void*>(&id), sizeof(id));
                 sector_data_offset = 0;
+                block_length = sizeof(id);
                 sectors_left = 1;
                 transferMode = TransferMode::PeripheralToHost;
                 error = 0;
@@ -414,7 +581,9 @@ void ATA::Impl::ExecuteCommand(uint8_t cmd)
         case command::SetMultipleMode: {
             logger->info("command: Set Multiple Mode ({:x}), device {}, sector_count {} cylinder {} head {} sector_nr {} feature {}",
                 cmd, selected_device, sector_count, cylinder, head, sector_nr, feature);
-            if (sector_count == 0 || sector_count == 1)  {
+            // Zero disables multiple mode
+            if (sector_count <= MaxMultipleSectors && (sector_count & (sector_count - 1)) == 0)  {
+                multiple_count = sector_count;
                 error = 0;
             } else {
                 error = error::AbortedCommand;
@@ -433,3 +602,99 @@ void ATA::Impl::ExecuteCommand(uint8_t cmd)
             break;
     }
 }
+
+// The next block covers the remaining sectors, up to block_sectors
+void ATA::Impl::NextBlock()
+{
+    block_length = std::min<size_t>(sectors_left, block_sectors) * SectorSize;
+    sector_data_offset = 0;
+}
+
+// Reads the current block into sector_data, or writes it from there. Until
+// the transfer completes, there is no data request and the device is busy.
+void ATA::Impl::StartTransfer()
+{
+    sector_data_offset = block_length;
+
+    const auto image = SelectedDeviceToImage(imageProvider, selected_device);
+    if (!image) {
+        CompleteTransfer(0);
+        return;
+    }
+
+    const auto offset = current_lba * SectorSize;
+    const auto block = std::span{ sector_data.data(), block_length };
+    if (transferMode == TransferMode::PeripheralToHost)
+        request = imageProvider.ReadAsync(*image, offset, block);
+    else
+        request = imageProvider.WriteAsync(*image, offset, block);
+    IsBusy();
+}
+
+void ATA::Impl::CompleteTransfer(size_t result)
+{
+    if (transferMode == TransferMode::PeripheralToHost) {
+        if (result != block_length) {
+            logger->critical("read error!!!");
+            std::fill(sector_data.begin(), sector_data.begin() + block_length, 0xff);
+        }
+        sector_data_offset = 0;
+    } else {
+        if (result != block_length) {
+            logger->critical("write error!!!");
+        }
+
+        const auto block_sectors_done = block_length / SectorSize;
+        sectors_left -= block_sectors_done;
+        if (sectors_left > 0) {
+            current_lba += block_sectors_done;
+            NextBlock();
+        } else {
+            transferMode = TransferMode::Idle;
+        }
+    }
+}
+
+void ATA::Impl::WaitForTransfer()
+{
+    if (!request)
+        return;
+    const auto result = request->Wait();
+    request.reset();
+    CompleteTransfer(result);
+}
+
+bool ATA::Impl::IsBusy()
+{
+    if (!request)
+        return false;
+    const auto result = request->Poll();
+    if (!result)
+        return true;
+    request.reset();
+    CompleteTransfer(*result);
+    return false;
+}
+
+// Determines the first sector and number of sectors of a read/write command
+bool ATA::Impl::SetupTransfer()
+{
+    const auto image = SelectedDeviceToImage(imageProvider, selected_device);
+    const auto imageSize = image ? imageProvider.GetSize(*image) : 0;
+    if (lba_mode) {
+        current_lba = (static_cast<uint64_t>(head) << 24) | (cylinder << 8) | sector_nr;
+    } else {
+        current_lba = CHStoLBA(disk::GetHarddiskGeometry(imageSize), cylinder, head, sector_nr);
+    }
+    // A sector count of zero means 256 sectors
+    sectors_left = (sector_count != 0) ? sector_count : 256;
+
+    if (image && current_lba + sectors_left > GetNumberOfSectors(imageSize)) {
+        logger->error("lba {} count {} beyond end of disk", current_lba, sectors_left);
+        transferMode = TransferMode::Idle;
+        error = error::IDNotFound;
+        return false;
+    }
+    error = 0;
+    return true;
+}
@@ -5,6 +5,8 @@
 struct IOInterface;
 
 class ImageProvider;
+struct StateWriter;
+struct StateReader;
 
 class ATA final
 {
@@ -16,4 +18,6 @@ class ATA final
     ~ATA();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 };
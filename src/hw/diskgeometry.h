@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include "../interface/imageprovider.h"
+
+// Drive geometry as derived from the image size; shared by the disk
+// controllers and the high-level BIOS disk services
+namespace disk
+{
+    constexpr inline size_t SectorSize = 512;
+
+    struct Geometry
+    {
+        unsigned int cylinders;
+        unsigned int heads;
+        unsigned int sectors_per_track;
+    };
+
+    // Standard PC formats, by image size; anything else is treated as 1.44MB
+    constexpr inline std::array<Geometry, 5> KnownFloppyGeometries{ {
+        { 40, 2, 9 }, // 360KB
+        { 80, 2, 9 }, // 720KB
+        { 80, 2, 15 }, // 1.2MB
+        { 80, 2, 18 }, // 1.44MB
+        { 80, 2, 36 }, // 2.88MB
+    } };
+    constexpr inline Geometry DefaultFloppyGeometry{ 80, 2, 18 };
+
+    inline Geometry GetFloppyGeometry(Bytes imageSize)
+    {
+        for (const auto& g : KnownFloppyGeometries) {
+            if (imageSize == g.cylinders * g.heads * g.sectors_per_track * SectorSize)
+                return g;
+        }
+        return DefaultFloppyGeometry;
+    }
+
+    // Images up to 32MB use type 3 (30.6MB) - https://vintage-pc.tripod.com/types.html
+    // This keeps the partition tables of existing images valid. Smaller
+    // images keep its heads and sectors, but only the cylinders they fill.
+    constexpr inline Geometry Type3Geometry{ 615, 6, 17 };
+    constexpr inline Bytes MaxType3ImageSize = 32 * 1024 * 1024;
+
+    inline Geometry GetHarddiskGeometry(Bytes imageSize)
+    {
+        if (imageSize <= MaxType3ImageSize) {
+            const auto cylinderSize = Type3Geometry.heads * Type3Geometry.sectors_per_track * SectorSize;
+            const auto cylinders = std::clamp<uint64_t>(imageSize / cylinderSize, 1, Type3Geometry.cylinders);
+            return { static_cast<unsigned int>(cylinders), Type3Geometry.heads, Type3Geometry.sectors_per_track };
+        }
+
+        // Larger images use the usual translated geometry, limited to what
+        // fits in IDENTIFY; anything beyond is reachable using LBA only
+        constexpr unsigned int heads = 16;
+        constexpr unsigned int sectors_per_track = 63;
+        constexpr unsigned int max_cylinders = 16383;
+        const auto cylinders = imageSize / SectorSize / (heads * sectors_per_track);
+        return { static_cast<unsigned int>(std::min<uint64_t>(cylinders, max_cylinders)), heads, sectors_per_track };
+    }
+}
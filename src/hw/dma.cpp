@@ -1,6 +1,10 @@
 #include "dma.h"
 #include "../interface/iointerface.h"
 #include "../interface/memoryinterface.h"
+#include "../interface/stateinterface.h"
+#include <algorithm>
+#include <array>
+#include <utility>
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
@@ -41,6 +45,8 @@ namespace
         constexpr inline io_port Ch1_PageAddr = 0x83;
         constexpr inline io_port Ch2_PageAddr = 0x81;
         constexpr inline io_port Ch3_PageAddr = 0x82;
+
+        constexpr inline std::array<io_port, 4> PageAddr{ Ch0_PageAddr, Ch1_PageAddr, Ch2_PageAddr, Ch3_PageAddr };
     }
 
     namespace status {
@@ -79,11 +85,22 @@ namespace
     {
         const int ch_num;
         DMA::Impl& impl;
+        bool terminal_count{};
 
         Transfer(int ch, DMA::Impl& impl) : ch_num(ch), impl(impl) { }
+        bool CanTransfer(const char* what, uint8_t transfer1, uint8_t transfer2);
+        bool CanTransfer(const char* what, uint16_t offset, size_t length, uint8_t transfer1, uint8_t transfer2);
+        template<typename Fn> size_t Stream(const char* what, size_t length, uint8_t transfer1, uint8_t transfer2, Fn fn);
+
         size_t WriteFromPeripheral(uint16_t offset, std::span<const uint8_t> data) override;
+        size_t ReadToPeripheral(uint16_t offset, std::span<uint8_t> data) override;
+        std::span<uint8_t> GetMemory(uint16_t offset, size_t length, bool toMemory) override;
         size_t GetTotalLength() override;
         void Complete() override;
+
+        size_t Push(std::span<const uint8_t> data) override;
+        size_t Pull(std::span<uint8_t> data) override;
+        bool ReachedTerminalCount() override;
     };
 }
 
@@ -94,12 +111,23 @@ struct DMA::Impl : IOPeripheral
 
     struct Channel {
         uint8_t mode{};
-        uint8_t status{};
-        uint32_t address{};
+        uint8_t page{};
+        uint16_t base_address{};
+        uint16_t base_count{};
+        uint16_t address{};
         uint16_t count{};
+
+        // Address of the given byte, counting from the current address. The
+        // page register is not updated, so transfers wrap within 64KB.
+        memory::Address GetAddress(size_t offset) const
+        {
+            const uint16_t a = (mode & mode::Reverse) ? address - offset : address + offset;
+            return (static_cast<memory::Address>(page) << 16) | a;
+        }
     };
 
     std::array<Channel, 4> channel;
+    uint8_t command{};
     uint8_t mask{};
     uint8_t status{};
     bool flipflop{};
@@ -113,6 +141,26 @@ struct DMA::Impl : IOPeripheral
     uint16_t In16(io_port port) override;
 
     void Reset();
+    void WriteRegister16(uint16_t& base, uint16_t& current, uint8_t val);
+    uint8_t ReadRegister16(uint16_t value);
+    void Advance(int ch_num, size_t length);
+
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        for (auto& ch: channel) {
+            fn(ch.mode);
+            fn(ch.page);
+            fn(ch.base_address);
+            fn(ch.base_count);
+            fn(ch.address);
+            fn(ch.count);
+        }
+        fn(command);
+        fn(mask);
+        fn(status);
+        fn(flipflop);
+    }
 };
 
 DMA::DMA(IOInterface& io, MemoryInterface& memory)
@@ -127,6 +175,16 @@ void DMA::Reset()
     impl->Reset();
 }
 
+void DMA::SaveState(StateWriter& writer) const
+{
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+}
+
+void DMA::LoadState(StateReader& reader)
+{
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+}
+
 std::unique_ptr<DMATransfer> DMA::InitiateTransfer(int ch_num)
 {
     return std::make_unique<Transfer>(ch_num, *impl);
@@ -137,10 +195,8 @@ DMA::Impl::Impl(IOInterface& io, MemoryInterface& memory)
     , logger(spdlog::stderr_color_st("dma"))
 {
     io.AddPeripheral(io::Base, 16, *this);
-    io.AddPeripheral(io::Ch0_PageAddr, 1, *this);
-    io.AddPeripheral(io::Ch1_PageAddr, 1, *this);
-    io.AddPeripheral(io::Ch2_PageAddr, 1, *this);
-    io.AddPeripheral(io::Ch3_PageAddr, 1, *this);
+    for (const auto port : io::PageAddr)
+        io.AddPeripheral(port, 1, *this);
 }
 
 DMA::Impl::~Impl()
@@ -151,104 +207,247 @@ DMA::Impl::~Impl()
 void DMA::Impl::Reset()
 {
     std::fill(channel.begin(), channel.end(), Channel{});
+    command = 0;
     status = 0;
-    mask = 0xff;
+    mask = 0x0f;
     flipflop = false;
 }
 
+// Address and count registers take the low byte first; writes set both the
+// base and current register
+void DMA::Impl::WriteRegister16(uint16_t& base, uint16_t& current, uint8_t val)
+{
+    if (flipflop) {
+        base = (base & 0xff) | (static_cast<uint16_t>(val) << 8);
+    } else {
+        base = (base & 0xff00) | val;
+    }
+    current = base;
+    flipflop = !flipflop;
+}
+
+uint8_t DMA::Impl::ReadRegister16(uint16_t value)
+{
+    const auto v = flipflop ? (value >> 8) : (value & 0xff);
+    flipflop = !flipflop;
+    return v;
+}
+
 void DMA::Impl::Out8(io_port port, uint8_t val)
 {
     logger->info("out8({:x}, {:x})", port, val);
+    if (port >= io::Ch0_BaseAddress_Write && port <= io::Ch3_WordCount) {
+        auto& ch = channel[(port - io::Base) / 2];
+        if ((port & 1) == 0)
+            WriteRegister16(ch.base_address, ch.address, val);
+        else
+            WriteRegister16(ch.base_count, ch.count, val);
+        return;
+    }
+    if (const auto it = std::find(io::PageAddr.begin(), io::PageAddr.end(), port); it != io::PageAddr.end()) {
+        channel[it - io::PageAddr.begin()].page = val;
+        return;
+    }
+
     switch(port) {
-        case io::MasterClear_Write:
-            Reset();
+        case io::Command_Write:
+            command = val;
             break;
-        case io::ClearByte_Write:
-            flipflop = false;
-            break;
-        case io::Ch2_BaseAddress_Write:
-            if (flipflop) {
-                channel[2].address = channel[2].address | (static_cast<uint32_t>(val) << 8);
-            } else {
-                channel[2].address = val;
-                flipflop = true;
-            }
-            break;
-        case io::Ch2_WordCount:
-            if (flipflop) {
-                channel[2].count = channel[2].count | (static_cast<uint16_t>(val) << 8);
-            } else {
-                channel[2].count = val;
-                flipflop = true;
-            }
-            break;
-        case io::Ch2_PageAddr:
-            channel[2].address = channel[2].address | (static_cast<uint32_t>(val) << 16);
-            break;
-        case io::Mode: {
+        case io::WriteRequest_Write: {
             const auto ch = val & 3;
-            channel[ch].mode = val;
+            if ((val & 0b100) != 0)
+                status |= (1 << (4 + ch));
+            else
+                status &= ~(1 << (4 + ch));
             break;
         }
         case io::Mask: {
             const auto sel10 = val & 3;
             if ((val & 0b100) != 0) /* MASK_ON */ {
                 mask |= (1 << sel10);
-                status |= (1 << (4 + sel10)); // TODO is this correct?
             } else {
                 mask &= ~(1 << sel10);
-                status &= ~(1 << (4 + sel10)); // TODO is this correct?
             }
             break;
         }
+        case io::Mode: {
+            const auto ch = val & mode::ChSelectMask;
+            channel[ch].mode = val;
+            break;
+        }
+        case io::ClearByte_Write:
+            flipflop = false;
+            break;
+        case io::MasterClear_Write:
+            Reset();
+            break;
+        case io::ClearMask_Write:
+            mask = 0;
+            break;
+        case io::WriteMask:
+            mask = val & 0x0f;
+            break;
+    }
+}
+
+// Moves the current address and count past the given number of bytes,
+// handling terminal count once the count wraps
+void DMA::Impl::Advance(int ch_num, size_t length)
+{
+    auto& ch = channel[ch_num];
+    const auto remaining = static_cast<size_t>(ch.count) + 1;
+    if (length < remaining) {
+        ch.address = ch.GetAddress(length) & 0xffff;
+        ch.count -= length;
+        return;
+    }
+
+    status |= (1 << ch_num); // set transfer complete
+    if (ch.mode & mode::AutoInit) {
+        ch.address = ch.base_address;
+        ch.count = ch.base_count;
+    } else {
+        ch.address = ch.GetAddress(remaining) & 0xffff;
+        ch.count = 0xffff;
+        mask |= (1 << ch_num); // mask channel
+    }
+}
+
+bool Transfer::CanTransfer(const char* what, uint8_t transfer1, uint8_t transfer2)
+{
+    if (impl.mask & (1 << ch_num)) {
+        impl.logger->error("ch{}: ignoring {}, channel is masked", ch_num, what);
+        return false;
+    }
+
+    const auto transfer = impl.channel[ch_num].mode & mode::TransferMask;
+    if (transfer != transfer1 && transfer != transfer2) {
+        impl.logger->error("ch{}: ignoring {}: channel not set for this transfer ({})", ch_num, what, transfer);
+        return false;
     }
+    return true;
+}
+
+// As above, and verifies the range lies within the remaining count
+bool Transfer::CanTransfer(const char* what, uint16_t offset, size_t length, uint8_t transfer1, uint8_t transfer2)
+{
+    if (!CanTransfer(what, transfer1, transfer2))
+        return false;
+
+    const auto total_length = GetTotalLength();
+    if (offset + length > total_length) {
+        impl.logger->error("ch{}: ignoring {}: attempt to access beyond buffer (needed {}, have {})", ch_num, what, offset + length, total_length);
+        return false;
+    }
+    return true;
 }
 
 size_t Transfer::GetTotalLength()
 {
     auto& ch = impl.channel[ch_num];
-    return ch.count + 1;
+    return static_cast<size_t>(ch.count) + 1;
 }
 
 size_t Transfer::WriteFromPeripheral(uint16_t offset, std::span<const uint8_t> data)
 {
     impl.logger->info("ch{}: write data from periphal, offset {}, length {}", ch_num, offset, data.size());
-    if (impl.mask & (1 << ch_num)) {
-        impl.logger->error("ch{}: ignoring write data from periphal, channel is masked", ch_num);
+    if (!CanTransfer("write data from peripheral", offset, data.size(), mode::WriteTransfer, mode::VerifyTransfer))
         return 0;
-    }
 
     auto& ch = impl.channel[ch_num];
-    const auto transfer = ch.mode & mode::TransferMask;
-    if (transfer != mode::WriteTransfer && transfer != mode::VerifyTransfer) {
-        impl.logger->error("ch{}: ignoring write data from periphal: channel not set for write/verify transfer ({})", ch_num, transfer);
-        return 0;
+    if ((ch.mode & mode::TransferMask) == mode::WriteTransfer) {
+        impl.logger->debug("ch{}: write data from periphal, length {} to address {:x}", ch_num, data.size(), ch.GetAddress(offset));
+        for(size_t n = 0; n < data.size(); ++n) {
+            impl.memory.WriteByte(ch.GetAddress(offset + n), data[n]);
+        }
     }
-    if ((ch.mode & (mode::AutoInit | mode::Reverse)) != 0) {
-        impl.logger->error("ch{}: ignoring write data from periphal: unsupported mode {:x}", ch_num, ch.mode);
+    return data.size();
+}
+
+size_t Transfer::ReadToPeripheral(uint16_t offset, std::span<uint8_t> data)
+{
+    impl.logger->info("ch{}: read data to periphal, offset {}, length {}", ch_num, offset, data.size());
+    if (!CanTransfer("read data to peripheral", offset, data.size(), mode::ReadTransfer, mode::ReadTransfer))
         return 0;
+
+    auto& ch = impl.channel[ch_num];
+    impl.logger->debug("ch{}: read data to periphal, length {} from address {:x}", ch_num, data.size(), ch.GetAddress(offset));
+    for(size_t n = 0; n < data.size(); ++n) {
+        data[n] = impl.memory.ReadByte(ch.GetAddress(offset + n));
     }
+    return data.size();
+}
 
-    const auto total_length = GetTotalLength();
-    if (offset + data.size() > total_length) {
-        impl.logger->error("ch{}: ignoring write data from periphal: attempt to write beyond buffer (needed {}, have {})", ch_num, offset + data.size(), total_length);
+std::span<uint8_t> Transfer::GetMemory(uint16_t offset, size_t length, bool toMemory)
+{
+    const auto transfer = toMemory ? mode::WriteTransfer : mode::ReadTransfer;
+    if (!CanTransfer("memory access", offset, length, transfer, toMemory ? mode::VerifyTransfer : transfer))
+        return {};
+
+    // Verify transfers leave memory alone; only ascending ranges that do not
+    // wrap within the page are contiguous
+    const auto& ch = impl.channel[ch_num];
+    const auto address = ch.GetAddress(offset);
+    if ((ch.mode & mode::TransferMask) != transfer || (ch.mode & mode::Reverse) || length == 0 || length > 0xffff || (address & 0xffff) + length > 0x10000)
+        return {};
+
+    const auto ptr = static_cast<uint8_t*>(impl.memory.GetPointer(address, length));
+    if (!ptr)
+        return {};
+    return { ptr, length };
+}
+
+void Transfer::Complete()
+{
+    impl.Advance(ch_num, GetTotalLength());
+}
+
+// Transfers up to length bytes at the current address, advancing it; stops
+// at terminal count unless the channel auto-initializes
+template<typename Fn>
+size_t Transfer::Stream(const char* what, size_t length, uint8_t transfer1, uint8_t transfer2, Fn fn)
+{
+    if (!CanTransfer(what, transfer1, transfer2))
         return 0;
-    }
 
-    if (transfer == mode::WriteTransfer) {
-        const auto address = ch.address + offset;
-        impl.logger->debug("ch{}: write data from periphal, length {} to address {:x}", ch_num, data.size(), address);
-        for(size_t n = 0; n < data.size(); ++n) {
-            impl.memory.WriteByte(address + n, data[n]);
+    auto& ch = impl.channel[ch_num];
+    size_t done = 0;
+    while (done < length) {
+        const auto chunk = std::min(length - done, GetTotalLength());
+        for (size_t n = 0; n < chunk; ++n)
+            fn(done + n, ch.GetAddress(n));
+        done += chunk;
+
+        const auto tc = chunk == GetTotalLength();
+        impl.Advance(ch_num, chunk);
+        if (tc) {
+            terminal_count = true;
+            if ((ch.mode & mode::AutoInit) == 0)
+                break;
         }
     }
-    return data.size();
+    return done;
 }
 
-void Transfer::Complete()
+size_t Transfer::Push(std::span<const uint8_t> data)
+{
+    const auto verify = (impl.channel[ch_num].mode & mode::TransferMask) == mode::VerifyTransfer;
+    return Stream("push", data.size(), mode::WriteTransfer, mode::VerifyTransfer, [&](size_t n, memory::Address address) {
+        if (!verify)
+            impl.memory.WriteByte(address, data[n]);
+    });
+}
+
+size_t Transfer::Pull(std::span<uint8_t> data)
 {
-    impl.status |= (1 << ch_num); // set transfer complete
-    impl.mask |= (1 << ch_num); // mask channel
+    return Stream("pull", data.size(), mode::ReadTransfer, mode::ReadTransfer, [&](size_t n, memory::Address address) {
+        data[n] = impl.memory.ReadByte(address);
+    });
+}
+
+bool Transfer::ReachedTerminalCount()
+{
+    return std::exchange(terminal_count, false);
 }
 
 void DMA::Impl::Out16(io_port port, uint16_t val)
@@ -259,6 +458,14 @@ void DMA::Impl::Out16(io_port port, uint16_t val)
 uint8_t DMA::Impl::In8(io_port port)
 {
     logger->info("in8({:x})", port);
+    if (port >= io::Ch0_CurrentAddress_Read && port <= io::Ch3_WordCount) {
+        const auto& ch = channel[(port - io::Base) / 2];
+        return ReadRegister16((port & 1) == 0 ? ch.address : ch.count);
+    }
+    if (const auto it = std::find(io::PageAddr.begin(), io::PageAddr.end(), port); it != io::PageAddr.end()) {
+        return channel[it - io::PageAddr.begin()].page;
+    }
+
     switch(port) {
         case io::Status_Read: {
             const auto v = status;
@@ -5,6 +5,8 @@
 
 struct IOInterface;
 struct MemoryInterface;
+struct StateWriter;
+struct StateReader;
 
 class DMA final : public DMAInterface
 {
@@ -19,5 +21,7 @@ private:
     ~DMA();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
     std::unique_ptr<DMATransfer> InitiateTransfer(int ch_num) override;
 };
@@ -3,10 +3,14 @@
 #include "../interface/dmainterface.h"
 #include "../interface/iointerface.h"
 #include "../interface/imageprovider.h"
+#include "../interface/stateinterface.h"
+#include "diskgeometry.h"
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 
+#include <array>
+#include <vector>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -128,6 +132,9 @@ namespace
         constexpr inline uint8_t DiskChanged = (0b1 << 7); // DSKCHG
     }
 
+    using disk::SectorSize;
+    using disk::Geometry;
+
     size_t DetermineNumberOfInputBytes(uint8_t cmd)
     {
         switch(cmd & 0b00011111)
@@ -177,6 +184,22 @@ struct FDC::Impl : IOPeripheral
     ~Impl();
     void Reset();
     bool ExecuteCurrentCommand();
+    void TransferData(bool write, uint8_t& st1);
+    void FormatTrack(uint8_t& st1);
+
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        fn(dor);
+        fn(fifo);
+        fn(fifoWriteOffset);
+        fn(fifoReadOffset);
+        fn(fifoReadBytesAvailable);
+        fn(st0);
+        fn(current_track);
+        fn(disk_changed);
+        fn(state);
+    }
 
     void Out8(io_port port, uint8_t val) override;
     void Out16(io_port port, uint16_t val) override;
@@ -197,6 +220,16 @@ void FDC::Reset()
     impl->Reset();
 }
 
+void FDC::SaveState(StateWriter& writer) const
+{
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+}
+
+void FDC::LoadState(StateReader& reader)
+{
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+}
+
 FDC::Impl::Impl(PICInterface& pic, DMAInterface& dma, ImageProvider& imageProvider)
     : pic(pic), dma(dma), imageProvider(imageProvider)
     , logger(spdlog::stderr_color_st("fdc"))
@@ -325,7 +358,8 @@ bool FDC::Impl::ExecuteCurrentCommand()
         logger->info("command: read id -> st0 {:x} st1 {:x} st2 {:x} c {:x} h {:x} r {:x} n {:x}", st0, st1, st2, c, h, r, n);
         return true;
     }
-    if ((cmd & 0b11111) == command::ReadData) {
+    if ((cmd & 0b11111) == command::ReadData || (cmd & 0b11111) == command::WriteData) {
+        const auto write = (cmd & 0b11111) == command::WriteData;
         const auto mt = (fifo[0] & 0x80) != 0;
         const auto mfm = (fifo[0] & 0x40) != 0;
         const auto sk = (fifo[0] & 0x20) != 0;
@@ -339,43 +373,11 @@ bool FDC::Impl::ExecuteCurrentCommand()
         const auto eot = fifo[6]; // end-of-track (final sector number)
         const auto gpl = fifo[7]; // gap length
         const auto dtl = fifo[8]; // special sector size (if n==0)
-        logger->info("command: read data -> mt {} mfm {} sk {} hds {} ds1 {} ds0 {} c {} h {} r {} n {} eot {} gpl {} dtl {}", mt, mfm, sk, hds, ds1, ds0, c, h, r, n, eot, gpl, dtl);
-
-        std::array<uint8_t, 512> sector;
-        constexpr auto NUM_HEADS = 2;
-        constexpr auto NUM_SPT = 18;
-        size_t image_offset = (c * NUM_HEADS + h) * NUM_SPT + (r - 1);
-        image_offset *= sector.size();
-        logger->debug("reading c {} h {} s {} from offset {}", c, h, r, image_offset);
-
-        // Initiate DMA transfer
-        constexpr int DMA_FLOPPY = 2;
-        auto xfer = dma.InitiateTransfer(DMA_FLOPPY);
-
-        const auto total_length = xfer->GetTotalLength();
-        if ((total_length % sector.size()) != 0) {
-            logger->error("reading partial sectors?! ({})", total_length);
-            std::abort();
-        }
+        logger->info("command: {} data -> mt {} mfm {} sk {} hds {} ds1 {} ds0 {} c {} h {} r {} n {} eot {} gpl {} dtl {}", write ? "write" : "read", mt, mfm, sk, hds, ds1, ds0, c, h, r, n, eot, gpl, dtl);
 
         uint8_t st1 = 0;
         const uint8_t st2 = 0;
-        for(size_t transfer_offset = 0; transfer_offset < total_length; transfer_offset += sector.size()) {
-            if (imageProvider.Read(Image::Floppy0, image_offset + transfer_offset, sector) != sector.size()) {
-                std::fill(sector.begin(), sector.end(), 0xff);
-                logger->critical("read error from floppy0");
-                st0 &= ~st0::InterruptCode1;
-                st0 |= st0::InterruptCode0; // 01: Abnormal termination
-                st1 |= st1::NoData;
-                break;
-            }
-            if (xfer->WriteFromPeripheral(transfer_offset, sector) == 0) {
-                logger->critical("dma rejected our data");
-                std::abort();
-                break;
-            }
-        }
-        xfer->Complete();
+        TransferData(write, st1);
 
         storeByteInFifo(st0);
         storeByteInFifo(st1);
@@ -386,6 +388,20 @@ bool FDC::Impl::ExecuteCurrentCommand()
         storeByteInFifo(n);
         return true;
     }
+    if ((cmd & 0b11111) == command::FormatTrack) {
+        uint8_t st1 = 0;
+        const uint8_t st2 = 0;
+        FormatTrack(st1);
+
+        storeByteInFifo(st0);
+        storeByteInFifo(st1);
+        storeByteInFifo(st2);
+        storeByteInFifo(0); // c, h, r, n are undefined
+        storeByteInFifo(0);
+        storeByteInFifo(0);
+        storeByteInFifo(fifo[2]);
+        return true;
+    }
     logger->warn("command: unimplemented command {:x}", fifo[0]);
     return false;
 }
@@ -458,3 +474,166 @@ void FDC::NotifyImageChanged()
 {
     impl->disk_changed = true;
 }
+
+// Transfers sectors between the image and memory using a single DMA
+// transfer and a single image access. The transfer runs until the DMA count
+// is exhausted or the end of the track is reached; with MT, the track on
+// head 1 follows head 0. A sector outside the track ends with No Data.
+void FDC::Impl::TransferData(bool write, uint8_t& st1)
+{
+    const auto mt = (fifo[0] & command::MultiTrack) != 0;
+    const auto c = fifo[2];
+    const auto h = fifo[3] & 1;
+    const auto r = fifo[4];
+    const auto eot = fifo[6];
+
+    const auto geometry = disk::GetFloppyGeometry(imageProvider.GetSize(Image::Floppy0));
+    const unsigned int last_sector = (eot != 0 && eot < geometry.sectors_per_track) ? eot : geometry.sectors_per_track;
+    const auto image_offset = ((c * geometry.heads + h) * geometry.sectors_per_track + (r - 1)) * SectorSize;
+    logger->debug("{} c {} h {} s {} at offset {}", write ? "writing" : "reading", c, h, r, image_offset);
+
+    const auto sector_found = r >= 1 && r <= last_sector;
+    size_t sectors_available = 0;
+    if (sector_found) {
+        sectors_available = last_sector - r + 1;
+        if (mt && h == 0)
+            sectors_available += last_sector;
+    }
+
+    // Initiate DMA transfer
+    constexpr int DMA_FLOPPY = 2;
+    auto xfer = dma.InitiateTransfer(DMA_FLOPPY);
+
+    auto abnormalTermination = [&](uint8_t st1_bits) {
+        st0 &= ~st0::InterruptCode1;
+        st0 |= st0::InterruptCode0; // 01: Abnormal termination
+        st1 |= st1_bits;
+    };
+
+    const auto total_length = xfer->GetTotalLength();
+    if ((total_length % SectorSize) != 0) {
+        logger->error("transferring partial sectors?! ({})", total_length);
+    }
+    auto length = std::min(total_length / SectorSize, sectors_available) * SectorSize;
+    if (!sector_found) {
+        abnormalTermination(st1::NoData);
+    } else if (length < total_length) {
+        // Ran past the final sector before the DMA count was exhausted
+        abnormalTermination(st1::EndOfCylinder);
+    }
+
+    // The track on head 1 only directly follows in the image if the whole
+    // track on head 0 was used
+    struct Extent
+    {
+        uint64_t offset;
+        size_t length;
+    };
+    std::array<Extent, 2> extents{ { { image_offset, length }, { 0, 0 } } };
+    if (last_sector < geometry.sectors_per_track && length > (last_sector - r + 1) * SectorSize) {
+        extents[0].length = (last_sector - r + 1) * SectorSize;
+        extents[1] = { (c * geometry.heads + 1) * geometry.sectors_per_track * SectorSize, length - extents[0].length };
+    }
+
+    // Use guest memory directly if possible, and stage the data otherwise
+    std::vector<uint8_t> buffer;
+    auto memory = xfer->GetMemory(0, length, !write);
+    if (memory.empty() && length > 0) {
+        buffer.resize(length);
+        memory = buffer;
+    }
+
+    if (write) {
+        if (!buffer.empty() && xfer->ReadToPeripheral(0, buffer) != buffer.size()) {
+            logger->critical("dma did not provide our data");
+            abnormalTermination(st1::Overrun);
+            length = 0;
+        }
+        for (size_t done = 0; const auto& extent : extents) {
+            if (done == length)
+                break;
+            if (imageProvider.Write(Image::Floppy0, extent.offset, memory.subspan(done, extent.length)) != extent.length) {
+                logger->critical("write error to floppy0");
+                abnormalTermination(st1::NotWritable);
+                break;
+            }
+            done += extent.length;
+        }
+    } else if (length > 0) {
+        size_t done = 0;
+        for (const auto& extent : extents) {
+            if (done == length || imageProvider.Read(Image::Floppy0, extent.offset, memory.subspan(done, extent.length)) != extent.length)
+                break;
+            done += extent.length;
+        }
+        if (done != length) {
+            std::fill(memory.begin(), memory.end(), 0xff);
+            logger->critical("read error from floppy0");
+            abnormalTermination(st1::NoData);
+        } else if (!buffer.empty() && xfer->WriteFromPeripheral(0, buffer) == 0) {
+            logger->critical("dma rejected our data");
+            abnormalTermination(st1::Overrun);
+        }
+    }
+    xfer->Complete();
+}
+
+// The sector IDs (C, H, R, N) are supplied by DMA; sectors are filled with
+// the filler byte. A track formatted in the usual order is written at once.
+void FDC::Impl::FormatTrack(uint8_t& st1)
+{
+    const auto hds = (fifo[1] & 0x4) != 0;
+    const auto n = fifo[2]; // sector size code
+    const auto sc = fifo[3]; // sectors per track
+    const auto gpl = fifo[4];
+    const auto d = fifo[5]; // filler byte
+    logger->info("command: format track -> hds {} n {} sc {} gpl {} d {:x}", hds, n, sc, gpl, d);
+
+    constexpr int DMA_FLOPPY = 2;
+    auto xfer = dma.InitiateTransfer(DMA_FLOPPY);
+    std::vector<uint8_t> ids(sc * 4);
+    const auto ids_length = xfer->ReadToPeripheral(0, ids);
+    xfer->Complete();
+    if (ids_length != ids.size()) {
+        logger->critical("dma did not provide sector ids");
+        st0 &= ~st0::InterruptCode1;
+        st0 |= st0::InterruptCode0; // 01: Abnormal termination
+        st1 |= st1::Overrun;
+        return;
+    }
+
+    const auto geometry = disk::GetFloppyGeometry(imageProvider.GetSize(Image::Floppy0));
+    auto sectorOffset = [&](size_t index) {
+        const auto c = ids[index * 4 + 0];
+        const auto h = ids[index * 4 + 1] & 1;
+        const auto r = ids[index * 4 + 2];
+        return ((c * geometry.heads + h) * geometry.sectors_per_track + (r - 1)) * SectorSize;
+    };
+
+    bool sequential = sc > 0 && sc <= geometry.sectors_per_track;
+    for (size_t i = 0; sequential && i < sc; ++i) {
+        sequential = ids[i * 4 + 2] == i + 1 && sectorOffset(i) == sectorOffset(0) + i * SectorSize;
+    }
+
+    bool ok = true;
+    if (sequential) {
+        const std::vector<uint8_t> track(sc * SectorSize, d);
+        ok = imageProvider.Write(Image::Floppy0, sectorOffset(0), track) == track.size();
+    } else {
+        const std::vector<uint8_t> sector(SectorSize, d);
+        for (size_t i = 0; i < sc; ++i) {
+            const auto r = ids[i * 4 + 2];
+            if (r < 1 || r > geometry.sectors_per_track) {
+                logger->warn("format: ignoring sector {} beyond track", r);
+                continue;
+            }
+            ok = ok && imageProvider.Write(Image::Floppy0, sectorOffset(i), sector) == sector.size();
+        }
+    }
+    if (!ok) {
+        logger->critical("format error on floppy0");
+        st0 &= ~st0::InterruptCode1;
+        st0 |= st0::InterruptCode0; // 01: Abnormal termination
+        st1 |= st1::NotWritable;
+    }
+}
@@ -7,6 +7,8 @@ struct IOInterface;
 struct PICInterface;
 class PIC;
 class ImageProvider;
+struct StateWriter;
+struct StateReader;
 
 class FDC final
 {
@@ -18,5 +20,7 @@ class FDC final
     ~FDC();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
     void NotifyImageChanged();
 };
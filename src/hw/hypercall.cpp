@@ -0,0 +1,173 @@
+#include "hypercall.h"
+#include "../bus/memory.h"
+#include "../cpu/state.h"
+#include "../interface/iointerface.h"
+#include "../interface/tickinterface.h"
+
+#include <array>
+#include <ostream>
+#include "spdlog/spdlog.h"
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+namespace
+{
+    namespace io
+    {
+        constexpr inline io_port Base = 0xe0;
+
+        constexpr inline io_port Command = Base + 0x0;
+        constexpr inline io_port Argument0 = Base + 0x2;
+        constexpr inline size_t NumberOfArguments = 4;
+        constexpr inline uint16_t Length = Argument0 + NumberOfArguments * 2 - Base;
+    }
+
+    namespace command
+    {
+        // Exit code in argument 0
+        constexpr inline uint8_t Exit = 0x01;
+        // Marker in argument 0; returns the emulated time in ns in arguments 0-3
+        constexpr inline uint8_t Timestamp = 0x02;
+        // ASCIIZ string at argument 1 (segment) : argument 0 (offset)
+        constexpr inline uint8_t Print = 0x03;
+        constexpr inline uint8_t DumpState = 0x04;
+    }
+
+    constexpr memory::Address MakeAddress(uint16_t segment, uint16_t offset)
+    {
+        return (static_cast<memory::Address>(segment) << 4) + offset;
+    }
+}
+
+struct Hypercall::Impl : IOPeripheral
+{
+    Memory& memory;
+    const cpu::State& state;
+    TickInterface& tick;
+    std::ostream& output;
+    std::shared_ptr<spdlog::logger> logger;
+
+    std::array<uint16_t, io::NumberOfArguments> arguments{};
+    std::optional<std::chrono::nanoseconds> previousTimestamp;
+    std::optional<int> exitCode;
+
+    Impl(IOInterface& io, Memory& memory, const cpu::State& state, TickInterface& tick, std::ostream& output);
+    ~Impl();
+
+    void Out8(io_port port, uint8_t val) override;
+    void Out16(io_port port, uint16_t val) override;
+    uint8_t In8(io_port port) override;
+    uint16_t In16(io_port port) override;
+
+    uint16_t* GetArgument(io_port port);
+    void Execute(uint8_t cmd);
+};
+
+Hypercall::Impl::Impl(IOInterface& io, Memory& memory, const cpu::State& state, TickInterface& tick, std::ostream& output)
+    : memory(memory)
+    , state(state)
+    , tick(tick)
+    , output(output)
+    , logger(spdlog::stderr_color_st("hypercall"))
+{
+    io.AddPeripheral(io::Base, io::Length, *this);
+}
+
+Hypercall::Impl::~Impl()
+{
+    spdlog::drop("hypercall");
+}
+
+uint16_t* Hypercall::Impl::GetArgument(io_port port)
+{
+    if (port < io::Argument0)
+        return nullptr;
+    const size_t index = (port - io::Argument0) / 2;
+    return index < arguments.size() ? &arguments[index] : nullptr;
+}
+
+void Hypercall::Impl::Execute(uint8_t cmd)
+{
+    switch(cmd) {
+        case command::Exit:
+            exitCode = arguments[0];
+            logger->info("guest requested exit with code {}", *exitCode);
+            break;
+        case command::Timestamp: {
+            const auto now = tick.GetTickCount();
+            output << fmt::format("hypercall: timestamp {} at {} ns", arguments[0], now.count());
+            if (previousTimestamp)
+                output << fmt::format(" (+{} ns)", (now - *previousTimestamp).count());
+            output << std::endl;
+            previousTimestamp = now;
+
+            const auto ns = static_cast<uint64_t>(now.count());
+            for (size_t n = 0; n < arguments.size(); ++n)
+                arguments[n] = static_cast<uint16_t>(ns >> (16 * n));
+            break;
+        }
+        case command::Print:
+            output << memory.GetASCIIZString(MakeAddress(arguments[1], arguments[0])) << std::flush;
+            break;
+        case command::DumpState:
+            output << fmt::format("ax={:04x} bx={:04x} cx={:04x} dx={:04x} si={:04x} di={:04x} bp={:04x} flags={:04x}\n",
+                state.m_ax, state.m_bx, state.m_cx, state.m_dx, state.m_si, state.m_di, state.m_bp, state.m_flags);
+            output << fmt::format("cs:ip={:04x}:{:04x} ds={:04x} es={:04x} ss:sp={:04x}:{:04x}",
+                state.m_cs, state.m_ip, state.m_ds, state.m_es, state.m_ss, state.m_sp) << std::endl;
+            break;
+        default:
+            logger->warn("unknown command {:x}", cmd);
+            break;
+    }
+}
+
+void Hypercall::Impl::Out8(io_port port, uint8_t val)
+{
+    if (port == io::Command) {
+        Execute(val);
+        return;
+    }
+    if (auto argument = GetArgument(port); argument) {
+        // Byte-wise access to the low (even port) or high (odd port) byte
+        if (port % 2 == 0)
+            *argument = (*argument & 0xff00) | val;
+        else
+            *argument = (*argument & 0x00ff) | (static_cast<uint16_t>(val) << 8);
+    }
+}
+
+void Hypercall::Impl::Out16(io_port port, uint16_t val)
+{
+    if (port == io::Command) {
+        Execute(val & 0xff);
+        return;
+    }
+    if (auto argument = GetArgument(port); argument && port % 2 == 0)
+        *argument = val;
+}
+
+uint8_t Hypercall::Impl::In8(io_port port)
+{
+    if (auto argument = GetArgument(port); argument)
+        return port % 2 == 0 ? *argument & 0xff : *argument >> 8;
+    return 0;
+}
+
+uint16_t Hypercall::Impl::In16(io_port port)
+{
+    if (auto argument = GetArgument(port); argument && port % 2 == 0)
+        return *argument;
+    return 0;
+}
+
+Hypercall::Hypercall(IOInterface& io, Memory& memory, const cpu::State& state, TickInterface& tick, std::ostream& output)
+    : impl(std::make_unique<Impl>(io, memory, state, tick, output))
+{
+}
+
+Hypercall::~Hypercall() = default;
+
+std::optional<int> Hypercall::GetExitCode() const
+{
+    return impl->exitCode;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <optional>
+
+class Memory;
+struct IOInterface;
+struct TickInterface;
+namespace cpu { class State; }
+
+// Emulator-specific device that lets guest programs talk to the host. They
+// use it to mark points in time for benchmarks, print diagnostics, dump the
+// CPU state or stop the emulator with an exit code.
+//
+// A guest first writes the arguments to the 16-bit argument registers, then
+// writes the command to the command register. Results are returned in the
+// argument registers.
+class Hypercall final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+  public:
+    Hypercall(IOInterface& io, Memory& memory, const cpu::State& state, TickInterface& tick, std::ostream& output);
+    ~Hypercall();
+
+    // Set once the guest has requested to exit
+    std::optional<int> GetExitCode() const;
+};
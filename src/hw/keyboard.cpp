@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "../interface/iointerface.h"
+#include "../interface/stateinterface.h"
 #include "../platform/hostio.h"
 
 #include <deque>
@@ -62,6 +63,25 @@ void Keyboard::Reset()
     impl->scancode.clear();
 }
 
+void Keyboard::SaveState(StateWriter& writer) const
+{
+    writer.Write(static_cast<uint32_t>(impl->scancode.size()));
+    for (const auto v: impl->scancode)
+        writer.Write(v);
+}
+
+void Keyboard::LoadState(StateReader& reader)
+{
+    uint32_t size;
+    reader.Read(size);
+    impl->scancode.clear();
+    for (uint32_t n = 0; n < size; ++n) {
+        uint8_t v;
+        reader.Read(v);
+        impl->scancode.push_back(v);
+    }
+}
+
 void Keyboard::EnqueueScancode(uint16_t scancode)
 {
     impl->logger->info("enqueue scancode {:x}", scancode);
@@ -5,6 +5,8 @@
 
 class HostIO;
 struct IOInterface;
+struct StateWriter;
+struct StateReader;
 
 class Keyboard final
 {
@@ -16,6 +18,8 @@ public:
     ~Keyboard();
 
     virtual void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
     bool IsQueueFilled() const;
     void EnqueueScancode(uint16_t scancode);
 };
@@ -1,5 +1,6 @@
 #include "pic.h"
 #include "../interface/iointerface.h"
+#include "../interface/stateinterface.h"
 #include <bit>
 
 #include "spdlog/spdlog.h"
@@ -53,6 +54,19 @@ struct PIC::Impl : IOPeripheral
 
     Impl(IOInterface& io);
     ~Impl();
+
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        fn(irq_base);
+        fn(init_stage);
+        fn(expect_icw3);
+        fn(expect_icw4);
+        fn(irr);
+        fn(isr);
+        fn(imr);
+    }
+
     void SetPendingIRQState(IRQ irq, bool pending);
     std::optional<int> DequeuePendingIRQ();
 
@@ -78,6 +92,16 @@ void PIC::Reset()
     impl->imr = 0xff;
 }
 
+void PIC::SaveState(StateWriter& writer) const
+{
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+}
+
+void PIC::LoadState(StateReader& reader)
+{
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+}
+
 std::optional<int> PIC::DequeuePendingIRQ()
 {
     return impl->DequeuePendingIRQ();
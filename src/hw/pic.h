@@ -4,6 +4,8 @@
 #include "../interface/picinterface.h"
 
 struct IOInterface;
+struct StateWriter;
+struct StateReader;
 
 class PIC final : public PICInterface
 {
@@ -20,4 +22,6 @@ class PIC final : public PICInterface
     std::optional<int> DequeuePendingIRQ() override;
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 };
@@ -1,6 +1,7 @@
 #include "pit.h"
 #include "../interface/iointerface.h"
 #include "../interface/tickinterface.h"
+#include "../interface/stateinterface.h"
 
 #include <array>
 #include <chrono>
@@ -64,6 +65,24 @@ struct PIT::Impl : IOPeripheral
     uint16_t In16(io_port port) override;
 
     bool TickChannel(size_t ch_num, std::chrono::nanoseconds now);
+
+    // count_time is relative to the host tick count and thus handled separately
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        for (auto& ch: channel) {
+            fn(ch.counter);
+            fn(ch.reload);
+            fn(ch.access);
+            fn(ch.mode);
+            fn(ch.prev_mode);
+            fn(ch.latch);
+            fn(ch.active);
+            fn(ch.current_output);
+            fn(ch.state);
+        }
+        fn(control);
+    }
 };
 
 PIT::PIT(IOInterface& io, TickInterface& tick)
@@ -79,6 +98,26 @@ void PIT::Reset()
     std::fill(impl->channel.begin(), impl->channel.end(), Impl::Channel{});
 }
 
+void PIT::SaveState(StateWriter& writer) const
+{
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+    const auto now = impl->tick.GetTickCount();
+    for (const auto& ch: impl->channel) {
+        writer.Write(now - ch.count_time);
+    }
+}
+
+void PIT::LoadState(StateReader& reader)
+{
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+    const auto now = impl->tick.GetTickCount();
+    for (auto& ch: impl->channel) {
+        std::chrono::nanoseconds elapsed;
+        reader.Read(elapsed);
+        ch.count_time = now - elapsed;
+    }
+}
+
  bool PIT::Tick()
  {
     const auto now = impl->tick.GetTickCount();
@@ -6,6 +6,8 @@
 
 struct IOInterface;
 struct TickInterface;
+struct StateWriter;
+struct StateReader;
 
 class PIT final : public PITInterface
 {
@@ -17,6 +19,8 @@ class PIT final : public PITInterface
     ~PIT();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
     bool Tick();
     bool GetTimer2Output() const override;
 };
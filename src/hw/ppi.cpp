@@ -1,6 +1,7 @@
 #include "ppi.h"
 #include "../interface/iointerface.h"
 #include "../interface/pitinterface.h"
+#include "../interface/stateinterface.h"
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
@@ -55,6 +56,15 @@ struct PPI::Impl : IOPeripheral
     void Out16(io_port port, uint16_t val) override;
     uint8_t In8(io_port port) override;
     uint16_t In16(io_port port) override;
+
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        fn(controlReg);
+        fn(selectedSwitchReg);
+        fn(switchReg);
+        fn(sw);
+    }
 };
 
 PPI::PPI(IOInterface& io, PITInterface& pit)
@@ -68,6 +78,16 @@ void PPI::Reset()
 {
 }
 
+void PPI::SaveState(StateWriter& writer) const
+{
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+}
+
+void PPI::LoadState(StateReader& reader)
+{
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+}
+
 PPI::Impl::Impl(IOInterface& io, PITInterface& pit)
     : pit(pit)
     , logger(spdlog::stderr_color_st("ppi"))
@@ -4,6 +4,8 @@
 
 struct IOInterface;
 struct PITInterface;
+struct StateWriter;
+struct StateReader;
 
 class PPI final
 {
@@ -15,4 +17,6 @@ class PPI final
     ~PPI();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 };
@@ -1,7 +1,9 @@
 #include "rtc.h"
 #include "../interface/iointerface.h"
 #include "../interface/timeinterface.h"
+#include "../interface/stateinterface.h"
 
+#include <algorithm>
 #include <array>
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
@@ -30,8 +32,26 @@ namespace
         constexpr inline uint8_t StatusC = 0xc;
         constexpr inline uint8_t StatusD = 0xd;
         constexpr inline uint8_t Century = 0x32;
+        constexpr inline uint8_t FloppyTypes = 0x10;
     };
 
+    namespace rtc_index
+    {
+        constexpr inline uint8_t NMIDisable = (1 << 7);
+        constexpr inline uint8_t RegisterMask = 0x7f;
+    }
+
+    bool IsTimeRegister(const uint8_t reg)
+    {
+        return reg < rtc_register::StatusA || reg == rtc_register::Century;
+    }
+
+    void SetDefaults(std::span<uint8_t> cmos)
+    {
+        std::fill(cmos.begin(), cmos.end(), 0);
+        cmos[rtc_register::FloppyTypes] = 0x40; // first floppy: 1.44MB
+    }
+
     uint8_t ValueToBcd(const uint8_t v)
     {
         return (v / 10) * 16 + (v % 10);
@@ -67,7 +87,8 @@ struct RTC::Impl : IOPeripheral
 {
     TimeInterface& time;
     std::shared_ptr<spdlog::logger> logger;
-    std::array<uint8_t, 0x2f> cmosData{};
+    std::array<uint8_t, RTC::s_cmos_size> cmosData{};
+    std::span<uint8_t> cmos{cmosData};
     uint8_t selectedRegister{};
 
     Impl(IOInterface& io, TimeInterface& time);
@@ -89,9 +110,35 @@ RTC::~RTC() = default;
 void RTC::Reset()
 {
     impl->selectedRegister = {};
-    std::fill(impl->cmosData.begin(), impl->cmosData.end(), 0);
+    // Battery-backed CMOS contents survive a reset
+    if (impl->cmos.data() == impl->cmosData.data())
+        SetDefaults(impl->cmos);
+}
 
-    impl->cmosData[0x10] = 0x40;
+void RTC::SetCMOSStorage(std::span<uint8_t> storage)
+{
+    if (storage.size() < s_cmos_size) {
+        impl->logger->error("cmos storage too small ({} bytes), ignoring", storage.size());
+        return;
+    }
+
+    impl->cmos = storage.first(s_cmos_size);
+    if (std::all_of(impl->cmos.begin(), impl->cmos.end(), [](auto v) { return v == 0; })) {
+        impl->logger->info("cmos storage is blank, applying defaults");
+        SetDefaults(impl->cmos);
+    }
+}
+
+void RTC::SaveState(StateWriter& writer) const
+{
+    writer.Write(impl->selectedRegister);
+    writer.WriteBytes(impl->cmos);
+}
+
+void RTC::LoadState(StateReader& reader)
+{
+    reader.Read(impl->selectedRegister);
+    reader.ReadBytes(impl->cmos);
 }
 
 RTC::Impl::Impl(IOInterface& io, TimeInterface& time)
@@ -111,7 +158,14 @@ void RTC::Impl::Out8(io_port port, uint8_t val)
     logger->info("out8({:x}, {:x})", port, val);
     switch(port) {
         case io::Index:
-            selectedRegister = val;
+            selectedRegister = val & rtc_index::RegisterMask;
+            break;
+        case io::Data:
+            if (IsTimeRegister(selectedRegister)) {
+                logger->warn("ignoring write to time register {:x}", selectedRegister);
+                break;
+            }
+            cmos[selectedRegister] = val;
             break;
     }
 }
@@ -126,10 +180,10 @@ uint8_t RTC::Impl::In8(io_port port)
     logger->info("in8({:x})", port);
     switch(port) {
         case io::Data:
-            if (selectedRegister < rtc_register::StatusA || selectedRegister == rtc_register::Century) {
+            if (IsTimeRegister(selectedRegister)) {
                 return ReadRtc(selectedRegister, time);
             }
-            return cmosData[selectedRegister % cmosData.size()];
+            return cmos[selectedRegister];
     }
     return 0;
 }
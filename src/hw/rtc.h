@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <span>
 
 struct IOInterface;
 struct TimeInterface;
+struct StateWriter;
+struct StateReader;
 
 class RTC final
 {
@@ -15,4 +19,11 @@ class RTC final
     ~RTC();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+
+    // Use external storage (i.e. a mapped file) as battery-backed CMOS RAM
+    void SetCMOSStorage(std::span<uint8_t> storage);
+
+    static constexpr inline size_t s_cmos_size = 128;
 };
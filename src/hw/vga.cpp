@@ -1,10 +1,12 @@
 #include "vga.h"
+#include <bitset>
 #include <cstdio>
 #include <cstring>
 
 #include "../interface/iointerface.h"
 #include "../interface/memoryinterface.h"
 #include "../interface/tickinterface.h"
+#include "../interface/stateinterface.h"
 #include "../platform/hostio.h"
 #include "vgafont.h"
 
@@ -36,6 +38,12 @@ namespace
 
     static const unsigned int WholeFrame = WholeLineHSyncCounter * WholeFrameVSyncCounter;
 
+    static const unsigned int TextColumns = 80;
+    static const unsigned int TextRows = 25;
+    static const unsigned int TextRowSize = TextColumns * 2;
+    static const memory::Address TextMemoryStart = 0xb8000;
+    static const memory::Address TextMemoryEnd = 0xb8fff;
+
     uint64_t NsToPixels(std::chrono::nanoseconds ns)
     {
         const auto pixelsPerNs = PixelClock / 1'000'000'000.0;
@@ -155,6 +163,8 @@ struct VGA::Impl : MemoryMappedPeripheral, IOPeripheral
     std::chrono::nanoseconds first_tick{};
     uint64_t current_frame_counter{};
     std::array<uint8_t, VideoMemorySize> videomem{};
+    // Rows to draw on the next update
+    std::bitset<TextRows> dirty_rows;
 
     uint8_t crtc_address{};
     std::array<uint8_t, 25> crtc_reg{};
@@ -181,6 +191,18 @@ struct VGA::Impl : MemoryMappedPeripheral, IOPeripheral
     uint16_t In16(io_port port) override;
 
     bool Update();
+    void Invalidate(size_t offset, size_t length);
+
+    template<typename Fn>
+    void VisitState(Fn fn)
+    {
+        fn(videomem);
+        fn(crtc_address);
+        fn(crtc_reg);
+        fn(attr_flipflop);
+        fn(attr_address);
+        fn(attr_reg);
+    }
 };
 
 
@@ -219,10 +241,15 @@ bool VGA::Impl::Update()
     //logger->critical("rendering frame {}", this_frame_number);
     current_frame_counter = this_frame_number;
 
-    for (unsigned int y = 0; y < 25; y++)
-        for (unsigned int x = 0; x < 80; x++) {
-            const auto ch = videomem[160 * y + 2 * x + 0];
-            const auto cl = videomem[160 * y + 2 * x + 1];
+    if (dirty_rows.none())
+        return false;
+
+    for (unsigned int y = 0; y < TextRows; y++) {
+        if (!dirty_rows[y])
+            continue;
+        for (unsigned int x = 0; x < TextColumns; x++) {
+            const auto ch = videomem[TextRowSize * y + 2 * x + 0];
+            const auto cl = videomem[TextRowSize * y + 2 * x + 1];
             const auto d = &font_data[ch * 8];
             for (unsigned int j = 0; j < 8; j++)
                 for (unsigned int i = 0; i < 8; i++) {
@@ -234,10 +261,21 @@ bool VGA::Impl::Update()
                     hostio.putpixel(x * 8 + i, y * 8 + j, color);
                 }
         }
+    }
+    dirty_rows.reset();
 
     return true;
 }
 
+void VGA::Impl::Invalidate(size_t offset, size_t length)
+{
+    if (length == 0)
+        return;
+    const auto last = std::min<size_t>((offset + length - 1) / TextRowSize, TextRows - 1);
+    for (auto row = offset / TextRowSize; row <= last; ++row)
+        dirty_rows.set(row);
+}
+
 VGA::VGA(MemoryInterface& memory, IOInterface& io, HostIO& hostio, TickInterface& tick)
     : impl(std::make_unique<Impl>(memory, io, hostio, tick))
 {
@@ -251,21 +289,36 @@ void VGA::Reset()
     std::fill(impl->videomem.begin(), impl->videomem.end(), 0);
     impl->first_tick = impl->tick.GetTickCount();
     impl->current_frame_counter = 0;
+    impl->dirty_rows.set();
+}
+
+void VGA::SaveState(StateWriter& writer) const
+{
+    impl->VisitState([&](const auto& v) { writer.Write(v); });
+}
+
+void VGA::LoadState(StateReader& reader)
+{
+    impl->VisitState([&](auto& v) { reader.Read(v); });
+    // Frame timing is relative to the host, so restart it
+    impl->first_tick = impl->tick.GetTickCount();
+    impl->current_frame_counter = 0;
+    impl->dirty_rows.set();
 }
 
 uint8_t VGA::Impl::ReadByte(memory::Address addr)
 {
-    if (addr >= 0xb8000 && addr <= 0xb8fff) {
-        return videomem[addr - 0xb8000];
+    if (addr >= TextMemoryStart && addr <= TextMemoryEnd) {
+        return videomem[addr - TextMemoryStart];
     }
     return 0;
 }
 
 uint16_t VGA::Impl::ReadWord(memory::Address addr)
 {
-    if (addr >= 0xb8000 && addr <= 0xb8fff - 1) {
-        const auto a = videomem[addr - 0xb8000 + 0];
-        const auto b = videomem[addr - 0xb8000 + 1];
+    if (addr >= TextMemoryStart && addr <= TextMemoryEnd - 1) {
+        const auto a = videomem[addr - TextMemoryStart + 0];
+        const auto b = videomem[addr - TextMemoryStart + 1];
         return a | (static_cast<uint16_t>(b) << 8);
     } else {
         return 0;
@@ -274,16 +327,18 @@ uint16_t VGA::Impl::ReadWord(memory::Address addr)
 
 void VGA::Impl::WriteByte(memory::Address addr, uint8_t data)
 {
-    if (addr >= 0xb8000 && addr <= 0xb8fff) {
-        videomem[addr - 0xb8000] = data;
+    if (addr >= TextMemoryStart && addr <= TextMemoryEnd) {
+        videomem[addr - TextMemoryStart] = data;
+        Invalidate(addr - TextMemoryStart, 1);
     }
 }
 
 void VGA::Impl::WriteWord(memory::Address addr, uint16_t data)
 {
-    if (addr >= 0xb8000 && addr <= 0xb8fff - 1) {
-        videomem[addr - 0xb8000 + 0] = data & 0xff;
-        videomem[addr - 0xb8000 + 1] = data >> 8;
+    if (addr >= TextMemoryStart && addr <= TextMemoryEnd - 1) {
+        videomem[addr - TextMemoryStart + 0] = data & 0xff;
+        videomem[addr - TextMemoryStart + 1] = data >> 8;
+        Invalidate(addr - TextMemoryStart, 2);
     }
 }
 
@@ -356,3 +411,13 @@ bool VGA::Update()
 {
     return impl->Update();
 }
+
+std::span<uint8_t> VGA::GetTextMemory()
+{
+    return { impl->videomem.data(), TextMemoryEnd - TextMemoryStart + 1 };
+}
+
+void VGA::InvalidateText(size_t offset, size_t length)
+{
+    impl->Invalidate(offset, length);
+}
@@ -1,13 +1,16 @@
 #pragma once
 
 #include <memory>
+#include "../interface/textdisplayinterface.h"
 
 class HostIO;
 struct IOInterface;
 struct MemoryInterface;
 struct TickInterface;
+struct StateWriter;
+struct StateReader;
 
-class VGA final
+class VGA final : public TextDisplayInterface
 {
     struct Impl;
     std::unique_ptr<Impl> impl;
@@ -17,8 +20,13 @@ public:
     ~VGA();
 
     void Reset();
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
     bool Update();
 
+    std::span<uint8_t> GetTextMemory() override;
+    void InvalidateText(size_t offset, size_t length) override;
+
     // XXX Resolution for now
     static constexpr inline unsigned int s_video_width = 640;
     static constexpr inline unsigned int s_video_height = 400;
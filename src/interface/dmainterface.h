@@ -6,9 +6,27 @@
 struct DMATransfer
 {
     virtual ~DMATransfer() = default;
+    // Accesses relative to the current address, for devices which transfer
+    // the entire count at once and then call Complete()
     virtual size_t WriteFromPeripheral(uint16_t offset, std::span<const uint8_t> data) = 0;
+    virtual size_t ReadToPeripheral(uint16_t offset, std::span<uint8_t> data) = 0;
+    // Guest memory at the given transfer offset, if it is contiguous RAM the
+    // peripheral may access directly in the given direction (toMemory for
+    // data from the peripheral); otherwise, or if the channel is programmed
+    // for the other direction, empty, and the data must go through
+    // WriteFromPeripheral/ReadToPeripheral
+    virtual std::span<uint8_t> GetMemory(uint16_t offset, size_t length, bool toMemory) = 0;
     virtual size_t GetTotalLength() = 0;
     virtual void Complete() = 0;
+
+    // Streaming access: transfers at the channel's current address and
+    // advances it, so a device can move data in chunks as it needs it. The
+    // result is smaller than requested when terminal count was reached on a
+    // channel that does not auto-initialize.
+    virtual size_t Push(std::span<const uint8_t> data) = 0;
+    virtual size_t Pull(std::span<uint8_t> data) = 0;
+    // Whether terminal count was reached since the previous call
+    virtual bool ReachedTerminalCount() = 0;
 };
 
 struct DMAInterface
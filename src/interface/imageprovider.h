@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <span>
 
 enum class Image
@@ -13,6 +15,28 @@ enum class Image
 
 using Bytes = size_t;
 
+// Outstanding asynchronous transfer; destroying it waits for completion
+class ImageRequest
+{
+public:
+    virtual ~ImageRequest() = default;
+
+    // Returns the number of bytes transferred once completed
+    virtual std::optional<size_t> Poll() = 0;
+    virtual size_t Wait() = 0;
+};
+
+class CompletedImageRequest final : public ImageRequest
+{
+    const size_t result;
+
+public:
+    CompletedImageRequest(size_t result) : result(result) { }
+
+    std::optional<size_t> Poll() override { return result; }
+    size_t Wait() override { return result; }
+};
+
 class ImageProvider
 {
 public:
@@ -21,4 +45,16 @@ public:
     virtual Bytes GetSize(const Image image) = 0;
     virtual size_t Read(const Image image, uint64_t offset, std::span<uint8_t> data) = 0;
     virtual size_t Write(const Image image, uint64_t offset, std::span<const uint8_t> data) = 0;
+
+    // The data must remain valid until the request has completed. Unless
+    // overridden, these complete immediately.
+    virtual std::unique_ptr<ImageRequest> ReadAsync(const Image image, uint64_t offset, std::span<uint8_t> data)
+    {
+        return std::make_unique<CompletedImageRequest>(Read(image, offset, data));
+    }
+
+    virtual std::unique_ptr<ImageRequest> WriteAsync(const Image image, uint64_t offset, std::span<const uint8_t> data)
+    {
+        return std::make_unique<CompletedImageRequest>(Write(image, offset, data));
+    }
 };
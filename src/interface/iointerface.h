@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <span>
+
 using io_port = uint16_t;
 
 struct IOPeripheral
@@ -10,6 +13,36 @@ struct IOPeripheral
     virtual void Out16(io_port port, uint16_t val) = 0;
     virtual uint8_t In8(io_port port) = 0;
     virtual uint16_t In16(io_port port) = 0;
+
+    // Transfers a block through a single port, as REP INS/OUTS do; 16-bit
+    // values are stored little-endian, as in guest memory. Peripherals with
+    // a data buffer can override these to copy it at once.
+    virtual void InBlock8(io_port port, std::span<uint8_t> data)
+    {
+        for (auto& value : data)
+            value = In8(port);
+    }
+
+    virtual void InBlock16(io_port port, std::span<uint8_t> data)
+    {
+        for (size_t n = 0; n + 1 < data.size(); n += 2) {
+            const auto value = In16(port);
+            data[n + 0] = value & 0xff;
+            data[n + 1] = value >> 8;
+        }
+    }
+
+    virtual void OutBlock8(io_port port, std::span<const uint8_t> data)
+    {
+        for (const auto value : data)
+            Out8(port, value);
+    }
+
+    virtual void OutBlock16(io_port port, std::span<const uint8_t> data)
+    {
+        for (size_t n = 0; n + 1 < data.size(); n += 2)
+            Out16(port, data[n + 0] | (data[n + 1] << 8));
+    }
 };
 
 struct IOInterface
@@ -22,4 +55,33 @@ struct IOInterface
 
     virtual uint8_t In8(io_port port) = 0;
     virtual uint16_t In16(io_port port) = 0;
+
+    // Block transfers, see IOPeripheral; these are passed on to the
+    // peripheral as a whole
+    virtual void InBlock8(io_port port, std::span<uint8_t> data)
+    {
+        for (auto& value : data)
+            value = In8(port);
+    }
+
+    virtual void InBlock16(io_port port, std::span<uint8_t> data)
+    {
+        for (size_t n = 0; n + 1 < data.size(); n += 2) {
+            const auto value = In16(port);
+            data[n + 0] = value & 0xff;
+            data[n + 1] = value >> 8;
+        }
+    }
+
+    virtual void OutBlock8(io_port port, std::span<const uint8_t> data)
+    {
+        for (const auto value : data)
+            Out8(port, value);
+    }
+
+    virtual void OutBlock16(io_port port, std::span<const uint8_t> data)
+    {
+        for (size_t n = 0; n + 1 < data.size(); n += 2)
+            Out16(port, data[n + 0] | (data[n + 1] << 8));
+    }
 };
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+// Used to serialize the internal state of the emulated hardware. Values are
+// stored in host byte order, so snapshots are not portable between hosts of
+// different endianness.
+struct StateWriter
+{
+    virtual ~StateWriter() = default;
+
+    virtual void WriteBytes(std::span<const uint8_t> data) = 0;
+
+    template<typename T>
+    void Write(const T& value)
+        requires (std::is_trivially_copyable_v<T>)
+    {
+        WriteBytes({ reinterpret_cast<const uint8_t*>(&value), sizeof(T) });
+    }
+};
+
+struct StateReader
+{
+    virtual ~StateReader() = default;
+
+    // Throws std::runtime_error if not enough data is available
+    virtual void ReadBytes(std::span<uint8_t> data) = 0;
+
+    template<typename T>
+    void Read(T& value)
+        requires (std::is_trivially_copyable_v<T>)
+    {
+        ReadBytes({ reinterpret_cast<uint8_t*>(&value), sizeof(T) });
+    }
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// Text mode video memory (80x25, at b8000), for direct access by the BIOS
+// video services
+struct TextDisplayInterface
+{
+    virtual ~TextDisplayInterface() = default;
+
+    virtual std::span<uint8_t> GetTextMemory() = 0;
+    // Changes made through GetTextMemory() are only drawn once invalidated
+    virtual void InvalidateText(size_t offset, size_t length) = 0;
+};
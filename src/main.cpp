@@ -1,3 +1,5 @@
+#include "bios/diskservices.h"
+#include "bios/videoservices.h"
 #include "cpu/cpux86.h"
 #include "platform/hostio.h"
 #include "bus/io.h"
@@ -11,7 +13,15 @@
 #include "hw/ppi.h"
 #include "hw/rtc.h"
 #include "hw/fdc.h"
+#include "hw/hypercall.h"
 #include "platform/imagelibrary.h"
+#include "platform/inputlog.h"
+#include "platform/inputscript.h"
+#include "platform/mappedfile.h"
+#include "platform/profiler.h"
+#include "platform/rewind.h"
+#include "platform/rununtil.h"
+#include "platform/snapshot.h"
 #include "platform/tickprovider.h"
 #include "platform/timeprovider.h"
 
@@ -19,6 +29,7 @@
 
 #include <fstream>
 #include <csignal>
+#include <sys/time.h>
 #include <iostream>
 #include <iomanip>
 
@@ -31,8 +42,13 @@ namespace {
 
 std::shared_ptr<spdlog::logger> trace_logger;
 bool running = true;
+volatile std::sig_atomic_t profileSamplePending = 0;
+volatile std::sig_atomic_t statisticsDumpPending = 0;
+volatile std::sig_atomic_t diskFlushPending = 0;
 
 constexpr inline auto emulatorCyclesPriorToUpdate = 500;
+constexpr inline auto profileReportEntries = 100;
+constexpr inline auto profileTimerInterval = std::chrono::milliseconds(1);
 
 template<typename Fn>
 void load_rom(Memory& memory, const std::string& fname, Fn determineBaseAddr)
@@ -76,6 +92,44 @@ CPUx86::addr_t decode_address(const std::string& s)
     return result;
 }
 
+bool add_run_until_condition(RunUntil& runUntil, const std::string& s)
+{
+    const auto n = s.find('=');
+    if (n == std::string::npos) return false;
+    const auto key = s.substr(0, n);
+    const auto value = s.substr(n + 1);
+
+    if (key == "address") {
+        runUntil.SetAddress(decode_address(value));
+        return true;
+    }
+    if (key == "screen") {
+        return runUntil.SetScreenPattern(value);
+    }
+
+    uint64_t number{};
+    if (const auto [ ptr, ec ] = std::from_chars(value.data(), value.data() + value.size(), number); ec != std::errc() || ptr != value.data() + value.size()) {
+        return false;
+    }
+    if (key == "instructions") {
+        runUntil.SetInstructionCount(number);
+    } else if (key == "time") {
+        runUntil.SetGuestTime(std::chrono::milliseconds(number));
+    } else if (key == "timeout") {
+        runUntil.SetTimeout(std::chrono::seconds(number));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool write_statistics(const std::string& path, const cpu::CollectedStatistics& statistics)
+{
+    std::ofstream ofs(path);
+    cpu::DumpStatistics(ofs, statistics);
+    return static_cast<bool>(ofs);
+}
+
 void LogState(const cpu::State& st)
 {
     trace_logger->info("ax={:04x} bx={:04x} cx={:04x} dx={:04x} si={:04x} di={:04x} bp={:04x} flags={:04x}", st.m_ax,
@@ -98,13 +152,81 @@ int main(int argc, char** argv)
         .help("use option rom");
     prog.add_argument("--fd0")
         .append()
-        .help("use specified image for floppy disk 0");
+        .help("use specified image or directory for floppy disk 0");
     prog.add_argument("--hd0")
-        .help("use specified image for hard disk 0");
+        .help("use specified image or directory for hard disk 0");
     prog.add_argument("--hd1")
-        .help("use specified image for hard disk 1");
+        .help("use specified image or directory for hard disk 1");
+    prog.add_argument("--hd0-overlay")
+        .help("keep hard disk 0 image read-only and store changes in specified overlay file");
+    prog.add_argument("--hd1-overlay")
+        .help("keep hard disk 1 image read-only and store changes in specified overlay file");
+    prog.add_argument("--dir-write-back")
+        .help("write changes to existing files back to directories used as disks")
+        .default_value(false)
+        .implicit_value(true);
+    prog.add_argument("--hle-disk")
+        .help("perform BIOS disk reads and writes (INT 13h) directly on the images")
+        .default_value(false)
+        .implicit_value(true);
+    prog.add_argument("--hle-video")
+        .help("perform common BIOS text output functions (INT 10h) directly")
+        .default_value(false)
+        .implicit_value(true);
+    prog.add_argument("--mmap-images")
+        .help("memory-map raw disk images")
+        .default_value(false)
+        .implicit_value(true);
+    prog.add_argument("--disk-flush")
+        .help("when disk image changes are written: unsafe, close or write")
+        .default_value(std::string("write"));
+    prog.add_argument("--disk-cache")
+        .help("size of the disk image block cache, in MB (0 disables)")
+        .default_value(4u)
+        .scan<'u', unsigned int>();
+    prog.add_argument("--async-disk")
+        .help("perform disk image transfers on a separate thread")
+        .default_value(false)
+        .implicit_value(true);
     prog.add_argument("--vgabios")
         .help("use specified bios image as VGA bios");
+    prog.add_argument("--cmos")
+        .help("use specified file as battery-backed CMOS memory");
+    prog.add_argument("--save-state")
+        .help("save machine state to specified file on exit");
+    prog.add_argument("--restore-state")
+        .help("restore machine state from specified file on startup");
+    prog.add_argument("--rewind")
+        .help("keep a snapshot every specified number of milliseconds of guest time to allow rewinding (ctrl-backspace)")
+        .scan<'u', unsigned int>();
+    prog.add_argument("--rewind-memory")
+        .help("maximum memory used for rewind snapshots, in MB")
+        .default_value(64u)
+        .scan<'u', unsigned int>();
+    prog.add_argument("--record")
+        .help("record all inputs to specified file to allow replaying the session");
+    prog.add_argument("--replay")
+        .help("replay inputs recorded in specified file");
+    prog.add_argument("--input-script")
+        .help("type keys as described in specified script file");
+    prog.add_argument("--run-until")
+        .append()
+        .help("stop once instructions=count, time=ms (guest time), address=cs:ip, screen=regex or timeout=s (wall clock) is reached");
+    prog.add_argument("--profile")
+        .help("sample the guest CS:IP and write a hot-spot report to specified file on exit");
+    prog.add_argument("--profile-interval")
+        .help("number of instructions between profiler samples")
+        .default_value(1000u)
+        .scan<'u', unsigned int>();
+    prog.add_argument("--profile-timer")
+        .help("take profiler samples on a host timer rather than every number of instructions")
+        .default_value(false)
+        .implicit_value(true);
+    prog.add_argument("--profile-map")
+        .append()
+        .help("symbolize the profile using specified linker map file, as file[@load segment]");
+    prog.add_argument("--instruction-statistics")
+        .help("write instruction mix to specified file on exit and on SIGUSR1 (needs ENABLE_INSTRUCTION_STATISTICS)");
     prog.add_argument("-d", "--disassemble")
         .help("enable live disassembly of code prior to execution once specified address is executing");
     try {
@@ -118,9 +240,61 @@ int main(int argc, char** argv)
     spdlog::set_level(spdlog::level::warn);
     spdlog::cfg::load_env_levels();
 
+    if (prog.present("--record") && prog.present("--replay")) {
+        std::cerr << "Cannot record and replay at the same time\n";
+        return -1;
+    }
+    if ((prog.present("--record") || prog.present("--replay")) && prog.present("--rewind")) {
+        std::cerr << "Rewinding cannot be combined with recording or replaying\n";
+        return -1;
+    }
+    if (prog.present("--instruction-statistics") && !cpu::collectStatistics) {
+        std::cerr << "Instruction statistics are not available; build with -DENABLE_INSTRUCTION_STATISTICS=ON\n";
+        return -1;
+    }
+    if (prog.present("--replay") && prog.present("--input-script")) {
+        std::cerr << "Input scripts cannot be combined with replaying\n";
+        return -1;
+    }
+    if ((prog.present("--record") || prog.present("--replay")) && prog.get<bool>("--async-disk")) {
+        std::cerr << "Asynchronous disk transfers cannot be combined with recording or replaying\n";
+        return -1;
+    }
+
+    uint64_t instructionCount = 0;
+    std::unique_ptr<InputLog> inputLog;
+    if (auto record = prog.present("--record"); record) {
+        inputLog = std::make_unique<InputLog>(InputLog::Mode::Record, instructionCount);
+        if (!inputLog->Open(record->c_str())) {
+            std::cerr << "Unable to create input log '" << *record << "'\n";
+            return -1;
+        }
+    }
+    if (auto replay = prog.present("--replay"); replay) {
+        inputLog = std::make_unique<InputLog>(InputLog::Mode::Replay, instructionCount);
+        if (!inputLog->Open(replay->c_str())) {
+            std::cerr << "Unable to read input log '" << *replay << "'\n";
+            return -1;
+        }
+    }
+
+    // Recording and replaying require time to follow the executed instructions
+    auto hostTime = std::make_unique<TimeProvider>();
+    std::unique_ptr<TickInterface> tick;
+    std::unique_ptr<TimeInterface> loggedTime;
+    if (inputLog) {
+        tick = std::make_unique<InstructionTickProvider>(instructionCount);
+        loggedTime = std::make_unique<LoggedTimeProvider>(*inputLog, *hostTime);
+    } else {
+        tick = std::make_unique<TickProvider>();
+    }
+    TimeInterface& time = loggedTime ? *loggedTime : *hostTime;
+    // Measuring the guest always uses time derived from the executed
+    // instructions, so that results do not depend on the speed of the host
+    InstructionTickProvider guestTick(instructionCount);
+
     auto imageLibrary = std::make_unique<ImageLibrary>();
-    auto tick = std::make_unique<TickProvider>();
-    auto time = std::make_unique<TimeProvider>();
+    auto cmosFile = std::make_unique<MappedFile>();
     auto memory = std::make_unique<Memory>();
     auto io = std::make_unique<IO>();
     auto x86cpu = std::make_unique<CPUx86>(*memory, *io);
@@ -130,10 +304,19 @@ int main(int argc, char** argv)
     auto pit = std::make_unique<PIT>(*io, *tick);
     auto dma = std::make_unique<DMA>(*io, *memory);
     auto ppi = std::make_unique<PPI>(*io, *pit);
-    auto rtc = std::make_unique<RTC>(*io, *time);
+    auto rtc = std::make_unique<RTC>(*io, time);
     auto fdc = std::make_unique<FDC>(*io, *pic, *dma, imageLibrary->GetImageProvider());
     auto vga = std::make_unique<VGA>(*memory, *io, *hostio, *tick);
     auto keyboard = std::make_unique<Keyboard>(*io, *hostio);
+    auto hypercall = std::make_unique<Hypercall>(*io, *memory, x86cpu->GetState(), guestTick, std::cout);
+    std::unique_ptr<DiskServices> diskServices;
+    if (prog.get<bool>("--hle-disk")) {
+        diskServices = std::make_unique<DiskServices>(*memory, imageLibrary->GetImageProvider());
+    }
+    std::unique_ptr<VideoServices> videoServices;
+    if (prog.get<bool>("--hle-video")) {
+        videoServices = std::make_unique<VideoServices>(*memory, *io, *vga);
+    }
 
     memory->Reset();
     io->Reset();
@@ -155,13 +338,43 @@ int main(int argc, char** argv)
         load_rom(*memory, *vgabios, [](size_t) { return 0xc0000; });
     }
 
-    if (auto hd0 = prog.present("--hd0"); hd0 && !imageLibrary->SetImage(Image::Harddisk0, hd0->c_str())) {
-        std::cerr << "Unable to attach hard disk image '" << *hd0 << "'\n";
+    imageLibrary->UseCache(static_cast<size_t>(prog.get<unsigned int>("--disk-cache")) * 1024 * 1024);
+    if (const auto policy = prog.get<std::string>("--disk-flush"); policy == "unsafe") {
+        imageLibrary->SetSyncPolicy(ImageLibrary::SyncPolicy::Unsafe);
+    } else if (policy == "close") {
+        imageLibrary->SetSyncPolicy(ImageLibrary::SyncPolicy::OnClose);
+    } else if (policy == "write") {
+        imageLibrary->SetSyncPolicy(ImageLibrary::SyncPolicy::WriteThrough);
+    } else {
+        std::cerr << "Unknown flush policy '" << policy << "'\n";
         return -1;
     }
-    if (auto hd1 = prog.present("--hd1"); hd1 && !imageLibrary->SetImage(Image::Harddisk1, hd1->c_str())) {
-        std::cerr << "Unable to attach hard disk image '" << *hd1 << "'\n";
-        return -1;
+    if (prog.get<bool>("--mmap-images")) {
+        imageLibrary->UseMemoryMapping();
+    }
+    if (prog.get<bool>("--async-disk")) {
+        imageLibrary->UseAsyncIO();
+    }
+    if (prog.get<bool>("--dir-write-back")) {
+        imageLibrary->UseDirectoryWriteBack();
+    }
+
+    for (const auto& [ hd, image ] : { std::pair{ "hd0", Image::Harddisk0 }, std::pair{ "hd1", Image::Harddisk1 } }) {
+        const auto path = prog.present(std::string("--") + hd);
+        if (!path) continue;
+        const auto overlay = prog.present(std::string("--") + hd + "-overlay");
+        if (overlay ? !imageLibrary->SetOverlayImage(image, path->c_str(), overlay->c_str()) : !imageLibrary->SetImage(image, path->c_str())) {
+            std::cerr << "Unable to attach hard disk image '" << *path << "'\n";
+            return -1;
+        }
+    }
+
+    if (auto cmos = prog.present("--cmos"); cmos) {
+        if (!cmosFile->Open(cmos->c_str(), RTC::s_cmos_size)) {
+            std::cerr << "Unable to use CMOS file '" << *cmos << "'\n";
+            return -1;
+        }
+        rtc->SetCMOSStorage(cmosFile->GetData());
     }
 
     size_t fd0image_current_index = 0;
@@ -171,6 +384,34 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    Machine machine{ *x86cpu, *memory, *vga, *pic, *pit, *dma, *fdc, *ata, *rtc, *ppi, *keyboard, diskServices.get(), videoServices.get() };
+    if (auto state = prog.present("--restore-state"); state) {
+        Snapshot snapshot;
+        if (!snapshot.ReadFromFile(state->c_str())) {
+            std::cerr << "Unable to read state file '" << *state << "'\n";
+            return -1;
+        }
+        try {
+            snapshot.Restore(machine);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Unable to restore state file '" << *state << "': " << e.what() << "\n";
+            return -1;
+        }
+        spdlog::info("main: restored state from '{}'", *state);
+        if (diskServices && !diskServices->IsActive()) {
+            spdlog::warn("main: state does not include the BIOS disk handler, --hle-disk takes effect once the boot sector is reached");
+        }
+        if (videoServices && !videoServices->IsActive()) {
+            spdlog::warn("main: state does not include the BIOS video handler, --hle-video takes effect once the boot sector is reached");
+        }
+    }
+
+    std::unique_ptr<RewindBuffer> rewind;
+    if (auto interval = prog.present<unsigned int>("--rewind"); interval) {
+        const auto budget = static_cast<size_t>(prog.get<unsigned int>("--rewind-memory")) * 1024 * 1024;
+        rewind = std::make_unique<RewindBuffer>(machine, std::chrono::milliseconds(*interval), budget);
+    }
+
     trace_logger = spdlog::stderr_color_st("trace");
 
     std::optional<CPUx86::addr_t> disassemble_address;
@@ -178,11 +419,67 @@ int main(int argc, char** argv)
         disassemble_address = decode_address(*disasm);
     }
 
+    std::unique_ptr<RunUntil> runUntil;
+    if (const auto conditions = prog.get<std::vector<std::string>>("--run-until"); !conditions.empty()) {
+        runUntil = std::make_unique<RunUntil>(instructionCount, x86cpu->GetState(), guestTick, *vga);
+        for (const auto& condition : conditions) {
+            if (!add_run_until_condition(*runUntil, condition)) {
+                std::cerr << "Invalid run-until condition '" << condition << "'\n";
+                return -1;
+            }
+        }
+    }
+
+    std::unique_ptr<InputScript> inputScript;
+    if (auto script = prog.present("--input-script"); script) {
+        inputScript = std::make_unique<InputScript>(*memory, guestTick, *vga);
+        if (!inputScript->Load(script->c_str())) {
+            std::cerr << "Unable to load input script '" << *script << "'\n";
+            return -1;
+        }
+    }
+
+    std::unique_ptr<Profiler> profiler;
+    const auto profileInterval = prog.get<unsigned int>("--profile-interval");
+    const auto profileTimer = prog.get<bool>("--profile-timer");
+    if (prog.present("--profile")) {
+        profiler = std::make_unique<Profiler>(*memory);
+        for (const auto& map : prog.get<std::vector<std::string>>("--profile-map")) {
+            auto path = map;
+            uint16_t loadSegment = 0;
+            if (const auto n = map.rfind('@'); n != std::string::npos) {
+                path = map.substr(0, n);
+                if (const auto [ _, ec ] = std::from_chars(map.data() + n + 1, map.data() + map.size(), loadSegment, 16); ec != std::errc()) {
+                    std::cerr << "Invalid load segment in '" << map << "'\n";
+                    return -1;
+                }
+            }
+            if (!profiler->LoadMap(path.c_str(), loadSegment)) {
+                std::cerr << "Unable to read map file '" << path << "'\n";
+                return -1;
+            }
+        }
+        if (profileTimer) {
+            signal(SIGPROF, [](int) { profileSamplePending = 1; });
+            const auto us = std::chrono::duration_cast<std::chrono::microseconds>(profileTimerInterval).count();
+            const itimerval timer{ { 0, us }, { 0, us } };
+            setitimer(ITIMER_PROF, &timer, nullptr);
+        }
+    }
+
+    const auto statisticsFile = prog.present("--instruction-statistics");
+    if (statisticsFile) {
+        signal(SIGUSR1, [](int) { statisticsDumpPending = 1; });
+    }
+
+    signal(SIGUSR2, [](int) { diskFlushPending = 1; });
     signal(SIGINT, [](int) { running = false; });
 
     std::unique_ptr<Disassembler> disassembler;
     unsigned int emulatorCycle = 0;
+    unsigned int profileCycle = 0;
     while(running) {
+        std::optional<size_t> fd0image_next_index;
         if (const auto event = hostio->GetPendingEvent(); event) {
             switch(*event) {
                 case HostIO::EventType::Terminate:
@@ -190,22 +487,40 @@ int main(int argc, char** argv)
                     continue;
                 case HostIO::EventType::ChangeImageFloppy0:
                     if (fd0images.size() > 1) {
-                        fd0image_current_index = (fd0image_current_index + 1) % fd0images.size();
-                        const auto& fd0image = fd0images[fd0image_current_index];
-                        if (imageLibrary->SetImage(Image::Floppy0, fd0image.c_str())) {
-                            spdlog::info("main: fd0 now uses image '{}'", fd0image);
-                            fdc->NotifyImageChanged();
-                        } else {
-                            spdlog::error("main: unable to use image '{}' for fd0", fd0image);
-                        }
+                        fd0image_next_index = (fd0image_current_index + 1) % fd0images.size();
+                    }
+                    break;
+                case HostIO::EventType::Rewind:
+                    if (rewind && (rewind->Rewind(1) || rewind->Rewind(0))) {
+                        spdlog::info("main: rewound, {} snapshot(s) left", rewind->GetNumberOfPoints());
                     }
                     break;
             }
         }
 
+        if (inputLog) {
+            fd0image_next_index = inputLog->ImageChange(fd0image_next_index);
+        }
+        if (fd0image_next_index && *fd0image_next_index < fd0images.size()) {
+            fd0image_current_index = *fd0image_next_index;
+            const auto& fd0image = fd0images[fd0image_current_index];
+            if (imageLibrary->SetImage(Image::Floppy0, fd0image.c_str())) {
+                spdlog::info("main: fd0 now uses image '{}'", fd0image);
+                fdc->NotifyImageChanged();
+                if (diskServices) {
+                    diskServices->NotifyImageChanged();
+                }
+            } else {
+                spdlog::error("main: unable to use image '{}' for fd0", fd0image);
+            }
+        }
+
         if (cpu::FlagInterrupt(x86cpu->GetState().m_flags)) {
             if (const auto irq = pic->DequeuePendingIRQ(); irq) {
                 x86cpu->HandleInterrupt(*irq);
+                if (inputLog) {
+                    inputLog->InterruptDelivered(*irq);
+                }
             }
         }
 
@@ -220,26 +535,73 @@ int main(int argc, char** argv)
             trace_logger->info(s);
         }
 
-        x86cpu->RunInstruction();
+        if (profiler && (profileTimer ? profileSamplePending != 0 : ++profileCycle >= profileInterval)) {
+            profiler->Sample(x86cpu->GetState());
+            profileSamplePending = 0;
+            profileCycle = 0;
+        }
+
+        const bool serviced = (diskServices && diskServices->Handle(x86cpu->GetState())) ||
+                              (videoServices && videoServices->Handle(x86cpu->GetState()));
+        if (!serviced) {
+            x86cpu->RunInstruction();
+        }
+        ++instructionCount;
         if (disassembler) {
             LogState(x86cpu->GetState());
         }
+        if (hypercall->GetExitCode() || (runUntil && runUntil->Check())) {
+            running = false;
+        }
 
         if (vga->Update()) {
             hostio->Render();
+            if (runUntil && runUntil->CheckScreen()) {
+                running = false;
+            }
+            if (inputScript) {
+                inputScript->NotifyScreenChanged();
+            }
         }
 
         if (++emulatorCycle >= emulatorCyclesPriorToUpdate) {
             hostio->Update();
+            imageLibrary->Update(tick->GetTickCount());
             emulatorCycle = 0;
+            if (runUntil && runUntil->CheckPeriodic()) {
+                running = false;
+            }
+            if (inputScript) {
+                inputScript->Update();
+            }
+            if (statisticsDumpPending) {
+                statisticsDumpPending = 0;
+                write_statistics(*statisticsFile, x86cpu->GetStatistics());
+            }
+            if (diskFlushPending) {
+                diskFlushPending = 0;
+                if (!imageLibrary->Flush()) {
+                    spdlog::error("main: unable to flush disk images");
+                }
+            }
         }
 
         if (pit->Tick()) {
             pic->AssertIRQ(PIC::IRQ::PIT);
         }
 
+        if (rewind) {
+            rewind->Update(guestTick.GetTickCount());
+        }
+
         while (true) {
-            const auto scancode = hostio->GetAndClearPendingScanCode();
+            auto scancode = hostio->GetAndClearPendingScanCode();
+            if (!scancode && inputScript && !keyboard->IsQueueFilled()) {
+                scancode = inputScript->GetScancode();
+            }
+            if (inputLog) {
+                scancode = inputLog->Scancode(scancode);
+            }
             if (!scancode)
                 break;
             keyboard->EnqueueScancode(scancode);
@@ -248,5 +610,48 @@ int main(int argc, char** argv)
     }
 
     printf("stopped at cs:ip=%04x:%04x\n", x86cpu->GetState().m_cs, x86cpu->GetState().m_ip);
-    return 0;
+    if (runUntil) {
+        const auto& st = x86cpu->GetState();
+        const auto condition = runUntil->GetMetCondition();
+        printf("run-until: %s after %llu instructions, %.3f s guest time\n",
+            condition ? ToString(*condition) : "interrupted",
+            static_cast<unsigned long long>(instructionCount),
+            std::chrono::duration<double>(guestTick.GetTickCount()).count());
+        printf("ax=%04x bx=%04x cx=%04x dx=%04x si=%04x di=%04x bp=%04x flags=%04x\n",
+            st.m_ax, st.m_bx, st.m_cx, st.m_dx, st.m_si, st.m_di, st.m_bp, st.m_flags);
+        printf("cs:ip=%04x:%04x ds=%04x es=%04x ss:sp=%04x:%04x\n",
+            st.m_cs, st.m_ip, st.m_ds, st.m_es, st.m_ss, st.m_sp);
+        printf("%s", GetScreenText(*vga).c_str());
+    }
+
+    if (!imageLibrary->Flush()) {
+        std::cerr << "Unable to write all changes to the disk images\n";
+    }
+    const auto cacheStatistics = imageLibrary->GetCacheStatistics();
+    spdlog::info("main: disk cache {} hits, {} misses, {} blocks read ahead", cacheStatistics.hits, cacheStatistics.misses, cacheStatistics.readAheads);
+
+    if (statisticsFile && !write_statistics(*statisticsFile, x86cpu->GetStatistics())) {
+        std::cerr << "Unable to write instruction statistics '" << *statisticsFile << "'\n";
+    }
+
+    if (auto report = prog.present("--profile"); report) {
+        std::ofstream ofs(*report);
+        profiler->WriteReport(ofs, profileReportEntries);
+        if (!ofs) {
+            std::cerr << "Unable to write profile report '" << *report << "'\n";
+        }
+    }
+
+    if (auto state = prog.present("--save-state"); state) {
+        Snapshot snapshot;
+        snapshot.Save(machine);
+        if (!snapshot.WriteToFile(state->c_str())) {
+            std::cerr << "Unable to write state file '" << *state << "'\n";
+            return -1;
+        }
+    }
+    if (runUntil && runUntil->GetMetCondition() == RunUntil::Condition::Timeout) {
+        return 2;
+    }
+    return hypercall->GetExitCode().value_or(0);
 }
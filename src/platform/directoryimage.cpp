@@ -0,0 +1,711 @@
+#include "directoryimage.h"
+#include "../hw/diskgeometry.h"
+#include <algorithm>
+#include <array>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "spdlog/spdlog.h"
+
+namespace
+{
+    constexpr uint32_t SectorSize = 512;
+    constexpr uint32_t DirEntrySize = 32;
+    constexpr uint32_t ReservedSectors = 1;
+    constexpr uint32_t NumberOfFATs = 2;
+
+    namespace attribute
+    {
+        constexpr uint8_t ReadOnly = 0x01;
+        constexpr uint8_t Directory = 0x10;
+        constexpr uint8_t Archive = 0x20;
+    }
+
+    namespace harddisk
+    {
+        // Matches the ATA geometry of images over 32MB, so that the BIOS and
+        // the BPB agree on the CHS layout; hence the smallest image is just
+        // over that size
+        constexpr uint32_t Heads = 16;
+        constexpr uint32_t SectorsPerTrack = 63;
+        constexpr uint32_t MinCylinders = 67;
+        static_assert(MinCylinders * Heads * SectorsPerTrack * disk::SectorSize > disk::MaxType3ImageSize);
+        // Largest size FAT16 can address using 32KB clusters
+        constexpr uint32_t MaxCylinders = 4095;
+        constexpr uint32_t HiddenSectors = SectorsPerTrack;
+        constexpr uint32_t RootEntries = 512;
+        constexpr uint8_t Media = 0xf8;
+        // Below 65536 sectors, the partition type for FAT16 is 0x04
+        constexpr uint8_t PartitionTypeSmallFAT16 = 0x04;
+        constexpr uint8_t PartitionTypeFAT16 = 0x06;
+    }
+
+    namespace floppy
+    {
+        constexpr uint32_t RootEntries = 224;
+        constexpr uint8_t Media = 0xf0;
+    }
+
+    constexpr uint32_t MinFAT16Clusters = 4085;
+    constexpr uint32_t MaxFAT16Clusters = 65524;
+
+    struct Parameters
+    {
+        uint32_t totalSectors;
+        uint32_t sectorsPerCluster;
+        uint32_t rootEntries;
+        uint8_t media;
+        uint32_t sectorsPerTrack;
+        uint32_t heads;
+    };
+
+    constexpr std::array FloppyParameters{
+        Parameters{ 2880, 1, floppy::RootEntries, floppy::Media, 18, 2 }, // 1.44MB
+        Parameters{ 5760, 2, 240, floppy::Media, 36, 2 },                  // 2.88MB
+    };
+
+    struct Node
+    {
+        std::string path;
+        std::array<char, 11> name{};
+        bool directory = false;
+        uint8_t attributes = 0;
+        uint32_t size = 0;
+        uint16_t time = 0;
+        uint16_t date = 0;
+        size_t parent = 0;
+        size_t entry = 0; // within the parent directory, excluding '.' and '..'
+        std::vector<size_t> children;
+        uint32_t firstCluster = 0;
+        uint32_t numberOfClusters = 0;
+        int fd = -1;
+    };
+
+    // File data backing part of a cluster run
+    struct FileLocation
+    {
+        size_t node;
+        uint64_t offset; // in the host file
+        uint64_t length; // until the end of the run
+    };
+
+    void Put16(std::span<uint8_t> data, size_t offset, uint16_t value)
+    {
+        data[offset + 0] = value & 0xff;
+        data[offset + 1] = value >> 8;
+    }
+
+    void Put32(std::span<uint8_t> data, size_t offset, uint32_t value)
+    {
+        Put16(data, offset + 0, value & 0xffff);
+        Put16(data, offset + 2, value >> 16);
+    }
+
+    template<typename Text>
+    void PutText(std::span<uint8_t> data, size_t offset, const Text& text)
+    {
+        std::copy(std::begin(text), std::end(text), data.begin() + offset);
+    }
+
+    std::pair<uint16_t, uint16_t> ToDOSTime(time_t t)
+    {
+        tm local{};
+        localtime_r(&t, &local);
+        if (local.tm_year < 80)
+            return { 0, (1 << 5) | 1 }; // 1980-01-01 00:00:00
+        const uint16_t time = (local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2);
+        const uint16_t date = ((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday;
+        return { time, date };
+    }
+
+    bool IsShortNameChar(char ch)
+    {
+        if ((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'))
+            return true;
+        return std::string_view("!#$%&'()-@^_`{}~").find(ch) != std::string_view::npos;
+    }
+
+    // Converts a host file name to an unused 8.3 name; names which cannot be
+    // represented as-is get a numeric tail, like NAME~1.TXT
+    std::array<char, 11> MakeShortName(const std::string& name, const std::vector<std::array<char, 11>>& taken)
+    {
+        const auto dot = name.rfind('.');
+        auto base = name.substr(0, dot);
+        auto extension = dot != std::string::npos ? name.substr(dot + 1) : std::string();
+
+        bool lossy = base.size() > 8 || extension.size() > 3;
+        for (auto* part : { &base, &extension }) {
+            std::string converted;
+            for (char ch : *part) {
+                if (ch >= 'a' && ch <= 'z')
+                    ch = ch - 'a' + 'A';
+                if (ch == ' ') {
+                    lossy = true;
+                    continue;
+                }
+                if (!IsShortNameChar(ch)) {
+                    lossy = true;
+                    ch = '_';
+                }
+                converted.push_back(ch);
+            }
+            *part = converted;
+        }
+        if (base.empty())
+            base = "_";
+
+        auto make = [&](const std::string& b) {
+            std::array<char, 11> result;
+            result.fill(' ');
+            std::copy_n(b.begin(), std::min<size_t>(b.size(), 8), result.begin());
+            std::copy_n(extension.begin(), std::min<size_t>(extension.size(), 3), result.begin() + 8);
+            return result;
+        };
+        auto isTaken = [&](const std::array<char, 11>& candidate) {
+            return std::find(taken.begin(), taken.end(), candidate) != taken.end();
+        };
+
+        if (auto result = make(base); !lossy && !isTaken(result))
+            return result;
+        for (unsigned int n = 1; ; ++n) {
+            const auto tail = "~" + std::to_string(n);
+            if (auto result = make(base.substr(0, 8 - tail.size()) + tail); !isTaken(result))
+                return result;
+        }
+    }
+
+    // Returns the CHS address as stored in a partition table entry
+    std::array<uint8_t, 3> ToPartitionCHS(uint32_t lba)
+    {
+        const auto cylinder = lba / (harddisk::Heads * harddisk::SectorsPerTrack);
+        if (cylinder > 1023)
+            return { 0xfe, 0xff, 0xff };
+        const auto head = (lba / harddisk::SectorsPerTrack) % harddisk::Heads;
+        const auto sector = lba % harddisk::SectorsPerTrack + 1;
+        return {
+            static_cast<uint8_t>(head),
+            static_cast<uint8_t>(sector | ((cylinder >> 2) & 0xc0)),
+            static_cast<uint8_t>(cylinder & 0xff)
+        };
+    }
+}
+
+struct DirectoryImage::Impl
+{
+    ~Impl();
+
+    DirectoryImage::Type type = DirectoryImage::Type::Floppy;
+    bool writeBack = false;
+    std::vector<Node> nodes;
+    // Nodes owning clusters, in cluster order
+    std::vector<size_t> allocated;
+    std::map<uint64_t, std::array<uint8_t, SectorSize>> written;
+
+    Parameters parameters{};
+    uint32_t hiddenSectors = 0;
+    uint32_t sectorsPerFAT = 0;
+    uint32_t rootSectors = 0;
+    uint32_t dataStart = 0;
+    uint32_t numberOfClusters = 0;
+    bool fat16 = false;
+
+    void Scan(size_t node, uint32_t maxEntries);
+    void SetParameters(const Parameters& newParameters);
+    bool Allocate(bool requireSpace);
+
+    uint64_t GetLength() const;
+    uint32_t GetClusterBytes() const { return parameters.sectorsPerCluster * SectorSize; }
+    uint32_t GetEndOfChain() const { return fat16 ? 0xffff : 0xfff; }
+    uint64_t GetClusterSector(uint32_t cluster) const;
+    std::optional<size_t> FindNode(uint32_t cluster) const;
+    uint32_t GetFATEntry(uint32_t cluster) const;
+    uint64_t GetEntryOffset(const Node& node) const;
+
+    void GenerateBootSector(std::span<uint8_t> data) const;
+    void GeneratePartitionTable(std::span<uint8_t> data) const;
+    void GenerateFATSector(uint32_t sector, std::span<uint8_t> data) const;
+    void GenerateEntry(size_t directory, size_t entry, std::span<uint8_t> data) const;
+    void GenerateSector(uint64_t sector, std::span<uint8_t> data);
+
+    std::optional<FileLocation> LocateFileData(uint64_t sector) const;
+    int GetFile(Node& node);
+    bool ReadFile(Node& node, uint64_t offset, std::span<uint8_t> data);
+    bool IsUnchanged(const FileLocation& location);
+
+    size_t Read(uint64_t offset, std::span<uint8_t> data);
+    size_t Write(uint64_t offset, std::span<const uint8_t> data);
+};
+
+DirectoryImage::Impl::~Impl()
+{
+    for (auto& node : nodes) {
+        if (node.fd >= 0) close(node.fd);
+    }
+}
+
+void DirectoryImage::Impl::Scan(size_t index, uint32_t maxEntries)
+{
+    std::vector<std::filesystem::path> entries;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(nodes[index].path, ec)) {
+        entries.push_back(entry.path());
+    }
+    std::sort(entries.begin(), entries.end());
+
+    std::vector<std::array<char, 11>> taken;
+    for (const auto& entry : entries) {
+        const auto fileName = entry.filename().string();
+        struct stat st;
+        if (fileName.front() == '.' || lstat(entry.c_str(), &st) != 0)
+            continue;
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+            continue;
+        if (st.st_size > 0xffffffff) {
+            spdlog::warn("directoryimage: skipping '{}', too large", entry.string());
+            continue;
+        }
+        if (taken.size() == maxEntries) {
+            spdlog::warn("directoryimage: skipping '{}', directory is full", entry.string());
+            continue;
+        }
+
+        Node node;
+        node.path = entry.string();
+        node.name = MakeShortName(fileName, taken);
+        node.directory = S_ISDIR(st.st_mode);
+        node.attributes = node.directory ? attribute::Directory : attribute::Archive;
+        if (!node.directory && access(node.path.c_str(), W_OK) != 0)
+            node.attributes |= attribute::ReadOnly;
+        node.size = node.directory ? 0 : static_cast<uint32_t>(st.st_size);
+        std::tie(node.time, node.date) = ToDOSTime(st.st_mtime);
+        node.parent = index;
+        node.entry = taken.size();
+        taken.push_back(node.name);
+
+        nodes.push_back(std::move(node));
+        nodes[index].children.push_back(nodes.size() - 1);
+        if (nodes.back().directory)
+            Scan(nodes.size() - 1, 0xfffe);
+    }
+}
+
+void DirectoryImage::Impl::SetParameters(const Parameters& newParameters)
+{
+    parameters = newParameters;
+    rootSectors = parameters.rootEntries * DirEntrySize / SectorSize;
+
+    // Sized for the worst case, which may leave a few FAT sectors unused
+    const auto maxClusters = parameters.totalSectors / parameters.sectorsPerCluster;
+    fat16 = maxClusters >= MinFAT16Clusters;
+    const auto fatBytes = fat16 ? (maxClusters + 2) * 2 : ((maxClusters + 2) * 3 + 1) / 2;
+    sectorsPerFAT = (fatBytes + SectorSize - 1) / SectorSize;
+    dataStart = ReservedSectors + NumberOfFATs * sectorsPerFAT + rootSectors;
+    numberOfClusters = (parameters.totalSectors - dataStart) / parameters.sectorsPerCluster;
+    fat16 = numberOfClusters >= MinFAT16Clusters;
+}
+
+// Assigns contiguous cluster runs to all files and directories; if
+// requireSpace is set, at least half of the volume must remain free
+bool DirectoryImage::Impl::Allocate(bool requireSpace)
+{
+    allocated.clear();
+    const auto clusterBytes = GetClusterBytes();
+    uint32_t cluster = 2;
+    for (size_t n = 1; n < nodes.size(); ++n) {
+        auto& node = nodes[n];
+        const auto bytes = node.directory ? (node.children.size() + 2) * DirEntrySize : node.size;
+        node.numberOfClusters = (bytes + clusterBytes - 1) / clusterBytes;
+        node.firstCluster = node.numberOfClusters != 0 ? cluster : 0;
+        cluster += node.numberOfClusters;
+        if (node.numberOfClusters != 0)
+            allocated.push_back(n);
+    }
+    const auto used = cluster - 2;
+    return requireSpace ? used <= numberOfClusters / 2 : used <= numberOfClusters;
+}
+
+uint64_t DirectoryImage::Impl::GetLength() const
+{
+    return static_cast<uint64_t>(hiddenSectors + parameters.totalSectors) * SectorSize;
+}
+
+uint64_t DirectoryImage::Impl::GetClusterSector(uint32_t cluster) const
+{
+    return hiddenSectors + dataStart + static_cast<uint64_t>(cluster - 2) * parameters.sectorsPerCluster;
+}
+
+std::optional<size_t> DirectoryImage::Impl::FindNode(uint32_t cluster) const
+{
+    auto it = std::upper_bound(allocated.begin(), allocated.end(), cluster, [&](uint32_t c, size_t n) {
+        return c < nodes[n].firstCluster;
+    });
+    if (it == allocated.begin())
+        return {};
+    const auto& node = nodes[*--it];
+    if (cluster >= node.firstCluster + node.numberOfClusters)
+        return {};
+    return *it;
+}
+
+uint32_t DirectoryImage::Impl::GetFATEntry(uint32_t cluster) const
+{
+    if (cluster == 0)
+        return (fat16 ? 0xff00 : 0xf00) | parameters.media;
+    if (cluster == 1)
+        return GetEndOfChain();
+    const auto node = FindNode(cluster);
+    if (!node)
+        return 0;
+    const auto& n = nodes[*node];
+    return cluster + 1 < n.firstCluster + n.numberOfClusters ? cluster + 1 : GetEndOfChain();
+}
+
+// Returns the image offset of the directory entry describing the node
+uint64_t DirectoryImage::Impl::GetEntryOffset(const Node& node) const
+{
+    const auto& parent = nodes[node.parent];
+    if (node.parent == 0)
+        return (hiddenSectors + ReservedSectors + NumberOfFATs * sectorsPerFAT) * static_cast<uint64_t>(SectorSize) + node.entry * DirEntrySize;
+    const auto position = (node.entry + 2) * DirEntrySize;
+    return GetClusterSector(parent.firstCluster + position / GetClusterBytes()) * SectorSize + position % GetClusterBytes();
+}
+
+void DirectoryImage::Impl::GenerateBootSector(std::span<uint8_t> data) const
+{
+    const bool harddisk = type == DirectoryImage::Type::Harddisk;
+    PutText(data, 0, std::array<uint8_t, 3>{ 0xeb, 0x3c, 0x90 });
+    PutText(data, 3, std::string_view("X86BOX  "));
+    Put16(data, 11, SectorSize);
+    data[13] = parameters.sectorsPerCluster;
+    Put16(data, 14, ReservedSectors);
+    data[16] = NumberOfFATs;
+    Put16(data, 17, parameters.rootEntries);
+    Put16(data, 19, parameters.totalSectors < 0x10000 ? parameters.totalSectors : 0);
+    data[21] = parameters.media;
+    Put16(data, 22, sectorsPerFAT);
+    Put16(data, 24, parameters.sectorsPerTrack);
+    Put16(data, 26, parameters.heads);
+    Put32(data, 28, hiddenSectors);
+    Put32(data, 32, parameters.totalSectors < 0x10000 ? 0 : parameters.totalSectors);
+    data[36] = harddisk ? 0x80 : 0x00;
+    data[38] = 0x29; // extended boot signature
+    Put32(data, 39, 0x78386278);
+    PutText(data, 43, std::string_view("NO NAME    "));
+    PutText(data, 54, std::string_view(fat16 ? "FAT16   " : "FAT12   "));
+    // Not bootable: int 18h
+    PutText(data, 62, std::array<uint8_t, 2>{ 0xcd, 0x18 });
+    PutText(data, 510, std::array<uint8_t, 2>{ 0x55, 0xaa });
+}
+
+void DirectoryImage::Impl::GeneratePartitionTable(std::span<uint8_t> data) const
+{
+    PutText(data, 0, std::array<uint8_t, 2>{ 0xcd, 0x18 });
+    auto entry = data.subspan(0x1be, 16);
+    entry[0] = 0x80; // active
+    PutText(entry, 1, ToPartitionCHS(hiddenSectors));
+    entry[4] = parameters.totalSectors < 65536 ? harddisk::PartitionTypeSmallFAT16 : harddisk::PartitionTypeFAT16;
+    PutText(entry, 5, ToPartitionCHS(hiddenSectors + parameters.totalSectors - 1));
+    Put32(entry, 8, hiddenSectors);
+    Put32(entry, 12, parameters.totalSectors);
+    PutText(data, 510, std::array<uint8_t, 2>{ 0x55, 0xaa });
+}
+
+void DirectoryImage::Impl::GenerateFATSector(uint32_t sector, std::span<uint8_t> data) const
+{
+    const auto start = sector * SectorSize;
+    for (uint32_t n = 0; n < SectorSize; ++n) {
+        const auto position = start + n;
+        if (fat16) {
+            data[n] = GetFATEntry(position / 2) >> (8 * (position % 2));
+            continue;
+        }
+        // FAT12 entries take three nibbles each
+        auto nibble = [&](uint32_t index) {
+            return (GetFATEntry(index / 3) >> (4 * (index % 3))) & 0xf;
+        };
+        data[n] = nibble(position * 2) | (nibble(position * 2 + 1) << 4);
+    }
+}
+
+void DirectoryImage::Impl::GenerateEntry(size_t directory, size_t entry, std::span<uint8_t> data) const
+{
+    const auto& dir = nodes[directory];
+    auto put = [&](const std::array<char, 11>& name, uint8_t attributes, uint16_t time, uint16_t date, uint32_t cluster, uint32_t size) {
+        PutText(data, 0, name);
+        data[11] = attributes;
+        Put16(data, 22, time);
+        Put16(data, 24, date);
+        Put16(data, 26, cluster);
+        Put32(data, 28, size);
+    };
+
+    if (directory != 0) {
+        if (entry < 2) {
+            constexpr std::array<char, 11> Dot{ '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+            constexpr std::array<char, 11> DotDot{ '.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+            const auto& target = nodes[entry == 0 ? directory : dir.parent];
+            put(entry == 0 ? Dot : DotDot, attribute::Directory, dir.time, dir.date, target.firstCluster, 0);
+            return;
+        }
+        entry -= 2;
+    }
+    if (entry >= dir.children.size())
+        return;
+    const auto& node = nodes[dir.children[entry]];
+    put(node.name, node.attributes, node.time, node.date, node.firstCluster, node.size);
+}
+
+void DirectoryImage::Impl::GenerateSector(uint64_t sector, std::span<uint8_t> data)
+{
+    std::fill(data.begin(), data.end(), 0);
+    if (sector < hiddenSectors) {
+        if (sector == 0)
+            GeneratePartitionTable(data);
+        return;
+    }
+
+    const auto volumeSector = sector - hiddenSectors;
+    if (volumeSector < ReservedSectors) {
+        GenerateBootSector(data);
+        return;
+    }
+    if (volumeSector < ReservedSectors + NumberOfFATs * sectorsPerFAT) {
+        GenerateFATSector((volumeSector - ReservedSectors) % sectorsPerFAT, data);
+        return;
+    }
+
+    constexpr auto EntriesPerSector = SectorSize / DirEntrySize;
+    if (volumeSector < dataStart) {
+        const auto first = (volumeSector - ReservedSectors - NumberOfFATs * sectorsPerFAT) * EntriesPerSector;
+        for (size_t n = 0; n < EntriesPerSector; ++n)
+            GenerateEntry(0, first + n, data.subspan(n * DirEntrySize, DirEntrySize));
+        return;
+    }
+
+    const auto cluster = static_cast<uint32_t>(2 + (volumeSector - dataStart) / parameters.sectorsPerCluster);
+    const auto index = FindNode(cluster);
+    if (!index)
+        return;
+    auto& node = nodes[*index];
+    const auto position = static_cast<uint64_t>(sector - GetClusterSector(node.firstCluster)) * SectorSize;
+    if (!node.directory) {
+        ReadFile(node, position, data);
+        return;
+    }
+    for (size_t n = 0; n < EntriesPerSector; ++n)
+        GenerateEntry(*index, position / DirEntrySize + n, data.subspan(n * DirEntrySize, DirEntrySize));
+}
+
+std::optional<FileLocation> DirectoryImage::Impl::LocateFileData(uint64_t sector) const
+{
+    if (sector < hiddenSectors + dataStart)
+        return {};
+    const auto cluster = static_cast<uint32_t>(2 + (sector - hiddenSectors - dataStart) / parameters.sectorsPerCluster);
+    const auto index = FindNode(cluster);
+    if (!index || nodes[*index].directory)
+        return {};
+    const auto& node = nodes[*index];
+    const auto offset = (sector - GetClusterSector(node.firstCluster)) * SectorSize;
+    return FileLocation{ *index, offset, static_cast<uint64_t>(node.numberOfClusters) * GetClusterBytes() - offset };
+}
+
+// Host files are opened on first use
+int DirectoryImage::Impl::GetFile(Node& node)
+{
+    if (node.fd < 0) {
+        if (writeBack)
+            node.fd = open(node.path.c_str(), O_RDWR);
+        if (node.fd < 0)
+            node.fd = open(node.path.c_str(), O_RDONLY);
+    }
+    return node.fd;
+}
+
+// Reads from the host file; anything past its end reads as zeroes
+bool DirectoryImage::Impl::ReadFile(Node& node, uint64_t offset, std::span<uint8_t> data)
+{
+    size_t done = 0;
+    if (offset < node.size) {
+        const auto length = std::min<uint64_t>(data.size(), node.size - offset);
+        const auto fd = GetFile(node);
+        if (fd < 0)
+            return false;
+        const auto result = pread(fd, data.data(), length, offset);
+        if (result < 0)
+            return false;
+        done = result;
+    }
+    std::fill(data.begin() + done, data.end(), 0);
+    return true;
+}
+
+// Checks whether the guest still stores the file where it was originally
+// placed: its directory entry and the FAT entry of the cluster involved must
+// be unchanged
+bool DirectoryImage::Impl::IsUnchanged(const FileLocation& location)
+{
+    const auto& node = nodes[location.node];
+    std::array<uint8_t, DirEntrySize> current, original{};
+    Read(GetEntryOffset(node), current);
+    GenerateEntry(node.parent, node.entry + (node.parent != 0 ? 2 : 0), original);
+    if (current != original)
+        return false;
+
+    const auto cluster = static_cast<uint32_t>(node.firstCluster + location.offset / GetClusterBytes());
+    const auto fatOffset = static_cast<uint64_t>(hiddenSectors + ReservedSectors) * SectorSize;
+    std::array<uint8_t, 2> entry;
+    if (fat16) {
+        Read(fatOffset + cluster * 2, entry);
+        return static_cast<uint32_t>(entry[0] | (entry[1] << 8)) == GetFATEntry(cluster);
+    }
+    Read(fatOffset + cluster * 3 / 2, entry);
+    const auto value = entry[0] | (entry[1] << 8);
+    return static_cast<uint32_t>(cluster % 2 ? value >> 4 : value & 0xfff) == GetFATEntry(cluster);
+}
+
+size_t DirectoryImage::Impl::Read(uint64_t offset, std::span<uint8_t> data)
+{
+    const auto length = GetLength();
+    if (offset >= length)
+        return 0;
+    data = data.first(std::min<uint64_t>(data.size(), length - offset));
+
+    size_t done = 0;
+    while (done < data.size()) {
+        const auto position = offset + done;
+        const auto sector = position / SectorSize;
+        const auto sectorOffset = position % SectorSize;
+        auto chunk = data.subspan(done);
+
+        // File data goes straight into the destination, up to the end of the run
+        if (const auto location = LocateFileData(sector); location) {
+            chunk = chunk.first(std::min<uint64_t>(chunk.size(), location->length - sectorOffset));
+            if (!ReadFile(nodes[location->node], location->offset + sectorOffset, chunk))
+                break;
+        } else {
+            std::array<uint8_t, SectorSize> sectorData;
+            GenerateSector(sector, sectorData);
+            chunk = chunk.first(std::min<uint64_t>(chunk.size(), SectorSize - sectorOffset));
+            std::copy_n(sectorData.begin() + sectorOffset, chunk.size(), chunk.begin());
+        }
+        done += chunk.size();
+    }
+
+    for (auto it = written.lower_bound(offset / SectorSize); it != written.end() && it->first * SectorSize < offset + done; ++it) {
+        const auto start = std::max(offset, it->first * SectorSize);
+        const auto end = std::min(offset + done, (it->first + 1) * SectorSize);
+        std::copy(it->second.begin() + (start - it->first * SectorSize), it->second.begin() + (end - it->first * SectorSize), data.begin() + (start - offset));
+    }
+    return done;
+}
+
+size_t DirectoryImage::Impl::Write(uint64_t offset, std::span<const uint8_t> data)
+{
+    const auto length = GetLength();
+    if (offset >= length)
+        return 0;
+    data = data.first(std::min<uint64_t>(data.size(), length - offset));
+
+    size_t done = 0;
+    while (done < data.size()) {
+        const auto position = offset + done;
+        const auto sector = position / SectorSize;
+        const auto sectorOffset = position % SectorSize;
+        const auto chunk = data.subspan(done, std::min<uint64_t>(data.size() - done, SectorSize - sectorOffset));
+
+        auto it = written.find(sector);
+        if (writeBack) {
+            if (const auto location = LocateFileData(sector); location && IsUnchanged(*location)) {
+                auto& node = nodes[location->node];
+                const auto fileOffset = location->offset + sectorOffset;
+                const auto hostLength = fileOffset < node.size ? std::min<uint64_t>(chunk.size(), node.size - fileOffset) : 0;
+                // Data past the end of the file, or which cannot be written
+                // (e.g. the host file is read-only), is kept in memory
+                const auto stored = hostLength != 0 && pwrite(GetFile(node), chunk.data(), hostLength, fileOffset) == static_cast<ssize_t>(hostLength);
+                if (stored && hostLength == chunk.size() && it == written.end()) {
+                    done += chunk.size();
+                    continue;
+                }
+            }
+        }
+
+        if (it == written.end()) {
+            std::array<uint8_t, SectorSize> sectorData;
+            if (sectorOffset != 0 || chunk.size() != SectorSize)
+                Read(sector * SectorSize, sectorData);
+            it = written.emplace(sector, sectorData).first;
+        }
+        std::copy(chunk.begin(), chunk.end(), it->second.begin() + sectorOffset);
+        done += chunk.size();
+    }
+    return done;
+}
+
+DirectoryImage::DirectoryImage()
+    : impl(std::make_unique<Impl>())
+{
+}
+
+DirectoryImage::~DirectoryImage() = default;
+
+bool DirectoryImage::Open(const char* path, Type type, bool writeBack)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+
+    impl->type = type;
+    impl->writeBack = writeBack;
+    impl->nodes.resize(1);
+    impl->nodes[0].path = path;
+    impl->nodes[0].directory = true;
+    std::tie(impl->nodes[0].time, impl->nodes[0].date) = ToDOSTime(st.st_mtime);
+    impl->Scan(0, type == Type::Floppy ? floppy::RootEntries : harddisk::RootEntries);
+
+    if (type == Type::Floppy) {
+        for (const auto& parameters : FloppyParameters) {
+            impl->SetParameters(parameters);
+            if (impl->Allocate(false))
+                return true;
+        }
+    } else {
+        // Leave the guest at least as much free space as the files take up
+        impl->hiddenSectors = harddisk::HiddenSectors;
+        for (auto cylinders = harddisk::MinCylinders; ; cylinders = std::min(cylinders * 2, harddisk::MaxCylinders)) {
+            const auto totalSectors = cylinders * harddisk::Heads * harddisk::SectorsPerTrack - harddisk::HiddenSectors;
+            auto sectorsPerCluster = 1u;
+            while (totalSectors / sectorsPerCluster > MaxFAT16Clusters)
+                sectorsPerCluster *= 2;
+            impl->SetParameters({ totalSectors, sectorsPerCluster, harddisk::RootEntries, harddisk::Media, harddisk::SectorsPerTrack, harddisk::Heads });
+
+            const bool largest = cylinders == harddisk::MaxCylinders;
+            if (impl->Allocate(!largest))
+                return true;
+            if (largest)
+                break;
+        }
+    }
+    spdlog::error("directoryimage: contents of '{}' do not fit on a disk", path);
+    return false;
+}
+
+uint64_t DirectoryImage::GetLength() const
+{
+    return impl->GetLength();
+}
+
+size_t DirectoryImage::Read(uint64_t offset, std::span<uint8_t> data)
+{
+    return impl->Read(offset, data);
+}
+
+size_t DirectoryImage::Write(uint64_t offset, std::span<const uint8_t> data)
+{
+    return impl->Write(offset, data);
+}
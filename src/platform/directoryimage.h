@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Presents a host directory as a FAT volume. Only the directory layout is
+// gathered up front: boot sector, FAT and directory sectors are generated
+// when read and file data is read straight from the host files.
+//
+// Writes are kept in memory. With write-back, writes to the data of an
+// existing file go to the host file instead, as long as the guest has not
+// changed where that file is stored.
+class DirectoryImage final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    enum class Type
+    {
+        Floppy,   // FAT12, 1.44MB or 2.88MB, unpartitioned
+        Harddisk, // FAT16 in a single partition
+    };
+
+    DirectoryImage();
+    ~DirectoryImage();
+
+    bool Open(const char* path, Type type, bool writeBack);
+
+    uint64_t GetLength() const;
+    size_t Read(uint64_t offset, std::span<uint8_t> data);
+    size_t Write(uint64_t offset, std::span<const uint8_t> data);
+};
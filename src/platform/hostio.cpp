@@ -181,6 +181,10 @@ void HostIO::Update()
 					impl->pendingEvents.push_back(EventType::ChangeImageFloppy0);
 					break;
 				}
+				if (event.key.keysym.sym == SDLK_BACKSPACE && (event.key.keysym.mod & (KMOD_LCTRL | KMOD_RCTRL)) ) {
+					impl->pendingEvents.push_back(EventType::Rewind);
+					break;
+				}
 
                 const auto scancode = MapSDLKeycodeToScancodeSet1(event.key.keysym.sym);
                 if (scancode != 0) {
@@ -216,6 +220,11 @@ uint16_t HostIO::GetAndClearPendingScanCode()
     return scancode;
 }
 
+uint16_t HostIO::GetScancodeForKeyName(const char* name)
+{
+    return MapSDLKeycodeToScancodeSet1(SDL_GetKeyFromName(name));
+}
+
 std::optional<HostIO::EventType> HostIO::GetPendingEvent()
 {
     if (impl->pendingEvents.empty()) return {};
@@ -21,10 +21,15 @@ class HostIO final
 
     uint16_t GetAndClearPendingScanCode();
 
+    // Scancode (set 1) of the key with the given SDL name, such as "a", ";",
+    // "Return" or "F1", or 0 if there is no such key
+    static uint16_t GetScancodeForKeyName(const char* name);
+
     enum class EventType
     {
       Terminate,
       ChangeImageFloppy0,
+      Rewind,
     };
 
     std::optional<EventType> GetPendingEvent();
@@ -1,10 +1,39 @@
 #include "imagelibrary.h"
+#include "directoryimage.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "spdlog/spdlog.h"
 
 namespace
 {
-    struct ImageFile final
+    struct ImageBackend
+    {
+        virtual ~ImageBackend() = default;
+
+        virtual uint64_t GetLength() const = 0;
+        virtual size_t Read(uint64_t offset, std::span<uint8_t> data) = 0;
+        virtual size_t Write(uint64_t offset, std::span<const uint8_t> data) = 0;
+        // Returns false if not all data could be written
+        virtual bool Flush() { return true; }
+        virtual void Update(std::chrono::nanoseconds) { }
+    };
+
+    struct ImageFile final : ImageBackend
     {
         ~ImageFile();
 
@@ -12,13 +41,15 @@ namespace
         uint64_t length = 0;
 
         bool Attach(const int fd);
-        size_t Read(uint64_t offset, std::span<uint8_t> data);
-        size_t Write(uint64_t offset, std::span<const uint8_t> data);
+        uint64_t GetLength() const override { return length; }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override;
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override;
+        bool Flush() override { return fdatasync(fd) == 0; }
     };
 
     ImageFile::~ImageFile()
     {
-        close(fd);
+        if (fd >= 0) close(fd);
     }
 
     bool ImageFile::Attach(const int newFd)
@@ -40,33 +71,843 @@ namespace
         const auto result = pwrite(fd, data.data(), data.size(), offset);
         return std::max(static_cast<ssize_t>(0), result);
     }
+
+    using SyncPolicy = ImageLibrary::SyncPolicy;
+
+    struct MappedImage final : ImageBackend
+    {
+        ~MappedImage();
+
+        int fd = -1;
+        std::span<uint8_t> mapping;
+        SyncPolicy policy = SyncPolicy::Unsafe;
+
+        bool Attach(const int fd, bool writable, SyncPolicy policy);
+        uint64_t GetLength() const override { return mapping.size(); }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override;
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override;
+        bool Flush() override;
+    };
+
+    MappedImage::~MappedImage()
+    {
+        if (!mapping.empty()) {
+            if (policy != SyncPolicy::Unsafe)
+                Flush();
+            munmap(mapping.data(), mapping.size());
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    bool MappedImage::Attach(const int newFd, bool writable, SyncPolicy syncPolicy)
+    {
+        fd = newFd;
+        policy = syncPolicy;
+        const auto length = lseek(fd, 0, SEEK_END);
+        if (length <= 0)
+            return false;
+
+        const auto ptr = mmap(nullptr, length, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+            return false;
+        mapping = { static_cast<uint8_t*>(ptr), static_cast<size_t>(length) };
+
+        // Booting reads most of the image front to back, so start reading
+        // ahead right away
+        madvise(mapping.data(), mapping.size(), MADV_WILLNEED);
+        return true;
+    }
+
+    size_t MappedImage::Read(uint64_t offset, std::span<uint8_t> data)
+    {
+        if (offset >= mapping.size())
+            return 0;
+        const auto length = std::min<uint64_t>(data.size(), mapping.size() - offset);
+        std::copy_n(mapping.begin() + offset, length, data.begin());
+        return length;
+    }
+
+    size_t MappedImage::Write(uint64_t offset, std::span<const uint8_t> data)
+    {
+        if (offset >= mapping.size())
+            return 0;
+        const auto length = std::min<uint64_t>(data.size(), mapping.size() - offset);
+        std::copy_n(data.begin(), length, mapping.begin() + offset);
+
+        if (policy == SyncPolicy::WriteThrough) {
+            const auto pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+            const auto start = offset / pageSize * pageSize;
+            msync(mapping.data() + start, offset + length - start, MS_SYNC);
+        }
+        return length;
+    }
+
+    bool MappedImage::Flush()
+    {
+        return msync(mapping.data(), mapping.size(), MS_SYNC) == 0;
+    }
+
+    // Splits [offset, offset + size) into pieces which do not cross a block
+    // boundary or the end of the image; fn(position, done, length) returns
+    // false to stop. Returns the number of bytes handled.
+    template<typename Fn>
+    size_t ForEachBlockChunk(uint64_t offset, size_t size, uint64_t blockSize, uint64_t imageLength, Fn fn)
+    {
+        size_t done = 0;
+        while (done < size && offset + done < imageLength) {
+            const auto position = offset + done;
+            const auto length = std::min<uint64_t>({ size - done, blockSize - position % blockSize, imageLength - position });
+            if (!fn(position, done, length))
+                break;
+            done += length;
+        }
+        return done;
+    }
+
+    namespace overlay
+    {
+        constexpr std::array<char, 8> Magic{ 'x', '8', '6', 'b', 'o', 'x', 'O', 'V' };
+        constexpr uint32_t Version = 1;
+        constexpr uint32_t BlockSize = 4096;
+
+        // Stored at the start of the overlay file, followed by the block
+        // allocation bitmap and the (block-aligned) blocks themselves
+        struct Header
+        {
+            std::array<char, 8> magic;
+            uint32_t version;
+            uint32_t blockSize;
+            uint64_t length;
+        };
+    }
+
+    // Read-only base image; written blocks are stored in a separate overlay
+    // file so that any number of instances can share the same base
+    struct OverlayImage final : ImageBackend
+    {
+        ~OverlayImage();
+
+        std::unique_ptr<ImageBackend> base;
+        int fd = -1;
+        std::vector<uint8_t> bitmap;
+        uint64_t dataOffset = 0;
+
+        bool Open(std::unique_ptr<ImageBackend> baseImage, const char* path);
+        uint64_t GetLength() const override { return base->GetLength(); }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override;
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override;
+        bool Flush() override { return fdatasync(fd) == 0; }
+
+        bool IsAllocated(uint64_t block) const;
+        bool Allocate(uint64_t block, uint32_t blockOffset, std::span<const uint8_t> data);
+    };
+
+    OverlayImage::~OverlayImage()
+    {
+        if (fd >= 0) close(fd);
+    }
+
+    bool OverlayImage::Open(std::unique_ptr<ImageBackend> baseImage, const char* path)
+    {
+        base = std::move(baseImage);
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+
+        const auto length = base->GetLength();
+        const auto numberOfBlocks = (length + overlay::BlockSize - 1) / overlay::BlockSize;
+        bitmap.resize((numberOfBlocks + 7) / 8);
+        dataOffset = (sizeof(overlay::Header) + bitmap.size() + overlay::BlockSize - 1) / overlay::BlockSize * overlay::BlockSize;
+
+        overlay::Header header;
+        const auto result = pread(fd, &header, sizeof(header), 0);
+        if (result == 0) {
+            // New overlay: all blocks still come from the base image
+            header = { overlay::Magic, overlay::Version, overlay::BlockSize, length };
+            return pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                   pwrite(fd, bitmap.data(), bitmap.size(), sizeof(header)) == static_cast<ssize_t>(bitmap.size());
+        }
+
+        if (result != sizeof(header) || header.magic != overlay::Magic || header.version != overlay::Version ||
+            header.blockSize != overlay::BlockSize || header.length != length)
+            return false;
+        return pread(fd, bitmap.data(), bitmap.size(), sizeof(header)) == static_cast<ssize_t>(bitmap.size());
+    }
+
+    bool OverlayImage::IsAllocated(uint64_t block) const
+    {
+        return bitmap[block / 8] & (1 << (block % 8));
+    }
+
+    // Copies the block from the base image, applies data and marks the block
+    // as allocated; the bitmap is only updated once the block is written
+    bool OverlayImage::Allocate(uint64_t block, uint32_t blockOffset, std::span<const uint8_t> data)
+    {
+        std::array<uint8_t, overlay::BlockSize> blockData{};
+        if (data.size() != blockData.size()) {
+            // The last block of the base image may be partial
+            const auto position = block * overlay::BlockSize;
+            const auto baseData = std::span(blockData).first(std::min<uint64_t>(blockData.size(), GetLength() - position));
+            if (base->Read(position, baseData) != baseData.size())
+                return false;
+        }
+        std::copy(data.begin(), data.end(), blockData.begin() + blockOffset);
+        if (pwrite(fd, blockData.data(), blockData.size(), dataOffset + block * overlay::BlockSize) != static_cast<ssize_t>(blockData.size()))
+            return false;
+
+        auto& bits = bitmap[block / 8];
+        bits |= 1 << (block % 8);
+        return pwrite(fd, &bits, 1, sizeof(overlay::Header) + block / 8) == 1;
+    }
+
+    size_t OverlayImage::Read(uint64_t offset, std::span<uint8_t> data)
+    {
+        return ForEachBlockChunk(offset, data.size(), overlay::BlockSize, GetLength(), [&](uint64_t position, size_t done, size_t length) {
+            const auto chunk = data.subspan(done, length);
+            if (IsAllocated(position / overlay::BlockSize))
+                return pread(fd, chunk.data(), chunk.size(), dataOffset + position) == static_cast<ssize_t>(chunk.size());
+            return base->Read(position, chunk) == chunk.size();
+        });
+    }
+
+    size_t OverlayImage::Write(uint64_t offset, std::span<const uint8_t> data)
+    {
+        return ForEachBlockChunk(offset, data.size(), overlay::BlockSize, GetLength(), [&](uint64_t position, size_t done, size_t length) {
+            const auto chunk = data.subspan(done, length);
+            const auto block = position / overlay::BlockSize;
+            if (IsAllocated(block))
+                return pwrite(fd, chunk.data(), chunk.size(), dataOffset + position) == static_cast<ssize_t>(chunk.size());
+            return Allocate(block, position % overlay::BlockSize, chunk);
+        });
+    }
+
+    namespace sparse
+    {
+        constexpr std::array<char, 8> Magic{ 'x', '8', '6', 'b', 'o', 'x', 'S', 'P' };
+        constexpr uint32_t Version = 1;
+
+        // Stored at the start of the image, followed by the block table: one
+        // entry per block holding its 1-based position in the data area, or
+        // zero if the block was never written
+        struct Header
+        {
+            std::array<char, 8> magic;
+            uint32_t version;
+            uint32_t blockSize;
+            uint64_t length;
+            uint32_t numberOfBlocks;
+            uint32_t reserved;
+        };
+    }
+
+    // Native sparse format: blocks are appended to the file on their first
+    // write, unallocated blocks read as zeroes
+    struct SparseImage final : ImageBackend
+    {
+        ~SparseImage();
+
+        int fd = -1;
+        sparse::Header header{};
+        std::vector<uint32_t> blockTable;
+        uint32_t numberOfAllocatedBlocks = 0;
+        uint64_t dataOffset = 0;
+
+        bool Attach(const int fd);
+        uint64_t GetLength() const override { return header.length; }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override;
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override;
+        bool Flush() override { return fdatasync(fd) == 0; }
+
+        uint64_t GetBlockOffset(uint32_t entry) const;
+        bool Allocate(uint64_t block, uint32_t blockOffset, std::span<const uint8_t> data);
+    };
+
+    SparseImage::~SparseImage()
+    {
+        if (fd >= 0) close(fd);
+    }
+
+    bool SparseImage::Attach(const int newFd)
+    {
+        fd = newFd;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != sparse::Magic ||
+            header.version != sparse::Version || header.blockSize < 512 || (header.blockSize & (header.blockSize - 1)) != 0 ||
+            header.numberOfBlocks != (header.length + header.blockSize - 1) / header.blockSize)
+            return false;
+
+        blockTable.resize(header.numberOfBlocks);
+        const auto tableSize = static_cast<ssize_t>(blockTable.size() * sizeof(uint32_t));
+        if (pread(fd, blockTable.data(), tableSize, sizeof(header)) != tableSize)
+            return false;
+
+        dataOffset = (sizeof(header) + tableSize + header.blockSize - 1) / header.blockSize * header.blockSize;
+        numberOfAllocatedBlocks = blockTable.empty() ? 0 : *std::max_element(blockTable.begin(), blockTable.end());
+        return true;
+    }
+
+    uint64_t SparseImage::GetBlockOffset(uint32_t entry) const
+    {
+        return dataOffset + static_cast<uint64_t>(entry - 1) * header.blockSize;
+    }
+
+    // Appends the block to the file; the table entry is only written once the
+    // block data is in place
+    bool SparseImage::Allocate(uint64_t block, uint32_t blockOffset, std::span<const uint8_t> data)
+    {
+        const auto entry = numberOfAllocatedBlocks + 1;
+        std::vector<uint8_t> blockData(header.blockSize);
+        std::copy(data.begin(), data.end(), blockData.begin() + blockOffset);
+        if (pwrite(fd, blockData.data(), blockData.size(), GetBlockOffset(entry)) != static_cast<ssize_t>(blockData.size()))
+            return false;
+        if (pwrite(fd, &entry, sizeof(entry), sizeof(header) + block * sizeof(uint32_t)) != sizeof(entry))
+            return false;
+
+        blockTable[block] = entry;
+        numberOfAllocatedBlocks = entry;
+        return true;
+    }
+
+    size_t SparseImage::Read(uint64_t offset, std::span<uint8_t> data)
+    {
+        return ForEachBlockChunk(offset, data.size(), header.blockSize, GetLength(), [&](uint64_t position, size_t done, size_t length) {
+            const auto chunk = data.subspan(done, length);
+            const auto entry = blockTable[position / header.blockSize];
+            if (entry == 0) {
+                std::fill(chunk.begin(), chunk.end(), 0);
+                return true;
+            }
+            const auto fileOffset = GetBlockOffset(entry) + position % header.blockSize;
+            return pread(fd, chunk.data(), chunk.size(), fileOffset) == static_cast<ssize_t>(chunk.size());
+        });
+    }
+
+    size_t SparseImage::Write(uint64_t offset, std::span<const uint8_t> data)
+    {
+        return ForEachBlockChunk(offset, data.size(), header.blockSize, GetLength(), [&](uint64_t position, size_t done, size_t length) {
+            const auto chunk = data.subspan(done, length);
+            const auto block = position / header.blockSize;
+            const auto entry = blockTable[block];
+            if (entry == 0)
+                return Allocate(block, position % header.blockSize, chunk);
+            const auto fileOffset = GetBlockOffset(entry) + position % header.blockSize;
+            return pwrite(fd, chunk.data(), chunk.size(), fileOffset) == static_cast<ssize_t>(chunk.size());
+        });
+    }
+
+    namespace cache
+    {
+        constexpr uint64_t BlockSize = 65536;
+        constexpr uint64_t ReadAheadBlocks = 2;
+    }
+
+    // Keeps recently used blocks of another backend in memory; writes go
+    // straight through and update the cached copy
+    struct CachedImage final : ImageBackend
+    {
+        struct Block
+        {
+            uint64_t index;
+            std::vector<uint8_t> data;
+        };
+
+        std::unique_ptr<ImageBackend> image;
+        const size_t maxBlocks;
+        ImageLibrary::CacheStatistics& statistics;
+        // Most recently used block first
+        std::list<Block> blocks;
+        std::unordered_map<uint64_t, std::list<Block>::iterator> blockMap;
+        std::optional<uint64_t> lastBlock;
+
+        CachedImage(std::unique_ptr<ImageBackend> image, size_t size, ImageLibrary::CacheStatistics& statistics)
+            : image(std::move(image)), maxBlocks(std::max<size_t>(size / cache::BlockSize, 1)), statistics(statistics)
+        {
+        }
+
+        uint64_t GetLength() const override { return image->GetLength(); }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override;
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override;
+        bool Flush() override { return image->Flush(); }
+        void Update(std::chrono::nanoseconds now) override { image->Update(now); }
+
+        Block* Lookup(uint64_t index);
+        Block* Load(uint64_t index);
+        void ReadAhead(uint64_t index);
+    };
+
+    CachedImage::Block* CachedImage::Lookup(uint64_t index)
+    {
+        const auto it = blockMap.find(index);
+        if (it == blockMap.end())
+            return nullptr;
+        blocks.splice(blocks.begin(), blocks, it->second);
+        return &blocks.front();
+    }
+
+    CachedImage::Block* CachedImage::Load(uint64_t index)
+    {
+        std::vector<uint8_t> data(cache::BlockSize);
+        const auto length = image->Read(index * cache::BlockSize, data);
+        if (length == 0)
+            return nullptr;
+        data.resize(length);
+
+        if (blocks.size() >= maxBlocks) {
+            blockMap.erase(blocks.back().index);
+            blocks.pop_back();
+        }
+        blocks.push_front(Block{ index, std::move(data) });
+        blockMap[index] = blocks.begin();
+        return &blocks.front();
+    }
+
+    // Sequential access typically continues, so fetch the next blocks before
+    // they are asked for
+    void CachedImage::ReadAhead(uint64_t index)
+    {
+        // Never evict the block that is currently being accessed
+        const auto count = std::min<uint64_t>(cache::ReadAheadBlocks, maxBlocks - 1);
+        for (auto n = index + 1; n <= index + count && n * cache::BlockSize < GetLength(); ++n) {
+            if (blockMap.contains(n))
+                continue;
+            if (!Load(n))
+                break;
+            ++statistics.readAheads;
+        }
+    }
+
+    size_t CachedImage::Read(uint64_t offset, std::span<uint8_t> data)
+    {
+        std::optional<uint64_t> firstBlock, block;
+        const auto result = ForEachBlockChunk(offset, data.size(), cache::BlockSize, GetLength(), [&](uint64_t position, size_t done, size_t length) {
+            block = position / cache::BlockSize;
+            if (!firstBlock)
+                firstBlock = block;
+
+            auto b = Lookup(*block);
+            if (b) {
+                ++statistics.hits;
+            } else {
+                ++statistics.misses;
+                b = Load(*block);
+                if (!b)
+                    return false;
+            }
+
+            const auto blockOffset = position % cache::BlockSize;
+            if (blockOffset + length > b->data.size())
+                return false;
+            std::copy_n(b->data.begin() + blockOffset, length, data.begin() + done);
+            return true;
+        });
+
+        // Only read ahead when sequential access moves on to the next block
+        if (firstBlock && lastBlock && (*firstBlock == *lastBlock || *firstBlock == *lastBlock + 1) && *block > *lastBlock)
+            ReadAhead(*block);
+        if (block)
+            lastBlock = block;
+        return result;
+    }
+
+    size_t CachedImage::Write(uint64_t offset, std::span<const uint8_t> data)
+    {
+        const auto result = image->Write(offset, data);
+        ForEachBlockChunk(offset, result, cache::BlockSize, GetLength(), [&](uint64_t position, size_t done, size_t length) {
+            const auto it = blockMap.find(position / cache::BlockSize);
+            if (it == blockMap.end())
+                return true;
+
+            auto& b = *it->second;
+            const auto blockOffset = position % cache::BlockSize;
+            if (blockOffset + length <= b.data.size()) {
+                std::copy_n(data.begin() + done, length, b.data.begin() + blockOffset);
+            } else {
+                blocks.erase(it->second);
+                blockMap.erase(it);
+            }
+            return true;
+        });
+        return result;
+    }
+
+    namespace writeback
+    {
+        constexpr size_t MaxPendingBytes = 4 * 1024 * 1024;
+        constexpr std::chrono::seconds FlushInterval{ 1 };
+        constexpr std::chrono::milliseconds IdleInterval{ 100 };
+    }
+
+    // Buffers writes and merges them into extents, so that adjacent sectors
+    // are written using a single system call
+    struct WriteBackImage final : ImageBackend
+    {
+        std::unique_ptr<ImageBackend> image;
+        const SyncPolicy policy;
+        // Non-overlapping extents by offset
+        std::map<uint64_t, std::vector<uint8_t>> pending;
+        size_t pendingBytes = 0;
+        uint64_t numberOfWrites = 0;
+        uint64_t lastNumberOfWrites = 0;
+        std::optional<std::chrono::nanoseconds> pendingSince;
+        std::chrono::nanoseconds lastWrite{};
+        // After a failed write, do not retry before this time
+        std::chrono::nanoseconds retryAt{};
+
+        WriteBackImage(std::unique_ptr<ImageBackend> image, SyncPolicy policy) : image(std::move(image)), policy(policy) { }
+        ~WriteBackImage();
+
+        uint64_t GetLength() const override { return image->GetLength(); }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override;
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override;
+        bool Flush() override;
+        void Update(std::chrono::nanoseconds now) override;
+
+        bool WritePending();
+    };
+
+    WriteBackImage::~WriteBackImage()
+    {
+        WritePending();
+        if (policy == SyncPolicy::OnClose)
+            image->Flush();
+    }
+
+    size_t WriteBackImage::Read(uint64_t offset, std::span<uint8_t> data)
+    {
+        const auto result = image->Read(offset, data);
+
+        auto it = pending.upper_bound(offset);
+        if (it != pending.begin())
+            --it;
+        for (; it != pending.end() && it->first < offset + result; ++it) {
+            const auto start = std::max(offset, it->first);
+            const auto end = std::min(offset + result, it->first + it->second.size());
+            if (start < end)
+                std::copy(it->second.begin() + (start - it->first), it->second.begin() + (end - it->first), data.begin() + (start - offset));
+        }
+        return result;
+    }
+
+    size_t WriteBackImage::Write(uint64_t offset, std::span<const uint8_t> data)
+    {
+        if (offset >= GetLength())
+            return 0;
+        data = data.first(std::min<uint64_t>(data.size(), GetLength() - offset));
+        ++numberOfWrites;
+
+        // Find all extents overlapping or adjacent to the new data
+        auto first = pending.upper_bound(offset);
+        if (first != pending.begin() && std::prev(first)->first + std::prev(first)->second.size() >= offset)
+            --first;
+        auto start = offset, end = offset + data.size();
+        auto last = first;
+        for (; last != pending.end() && last->first <= end; ++last) {
+            start = std::min(start, last->first);
+            end = std::max(end, last->first + last->second.size());
+        }
+
+        // Grow the first extent in place if possible, as this is the common
+        // case for sequential writes
+        std::vector<uint8_t> extent;
+        auto it = first;
+        if (first != last && first->first == start) {
+            extent = std::move(first->second);
+            pendingBytes -= extent.size();
+            ++it;
+        }
+        extent.resize(end - start);
+        for (; it != last; ++it) {
+            std::copy(it->second.begin(), it->second.end(), extent.begin() + (it->first - start));
+            pendingBytes -= it->second.size();
+        }
+        std::copy(data.begin(), data.end(), extent.begin() + (offset - start));
+
+        pending.erase(first, last);
+        pendingBytes += extent.size();
+        pending.emplace(start, std::move(extent));
+
+        if (pendingBytes >= writeback::MaxPendingBytes)
+            WritePending();
+        return data.size();
+    }
+
+    // Extents which could not be (fully) written remain pending, so that the
+    // data is not lost and can be retried later
+    bool WriteBackImage::WritePending()
+    {
+        std::map<uint64_t, std::vector<uint8_t>> failed;
+        for (auto& [ offset, extent ] : pending) {
+            const auto written = image->Write(offset, extent);
+            if (written == extent.size())
+                continue;
+
+            spdlog::error("imagelibrary: unable to write {} bytes at offset {}", extent.size() - written, offset + written);
+            extent.erase(extent.begin(), extent.begin() + written);
+            failed.emplace(offset + written, std::move(extent));
+        }
+
+        pending = std::move(failed);
+        pendingBytes = 0;
+        for (const auto& [ _, extent ] : pending)
+            pendingBytes += extent.size();
+        if (pending.empty())
+            pendingSince.reset();
+        return pending.empty();
+    }
+
+    bool WriteBackImage::Flush()
+    {
+        const auto result = WritePending();
+        return (policy == SyncPolicy::Unsafe || image->Flush()) && result;
+    }
+
+    void WriteBackImage::Update(std::chrono::nanoseconds now)
+    {
+        if (numberOfWrites != lastNumberOfWrites) {
+            lastNumberOfWrites = numberOfWrites;
+            lastWrite = now;
+        }
+        if (pending.empty() || policy == SyncPolicy::Unsafe)
+            return;
+
+        if (!pendingSince)
+            pendingSince = now;
+        if (now < retryAt)
+            return;
+        if (now - *pendingSince >= writeback::FlushInterval || now - lastWrite >= writeback::IdleInterval) {
+            if (!WritePending())
+                retryAt = now + writeback::FlushInterval;
+        }
+    }
+
+    struct HostDirectory final : ImageBackend
+    {
+        DirectoryImage directory;
+
+        uint64_t GetLength() const override { return directory.GetLength(); }
+        size_t Read(uint64_t offset, std::span<uint8_t> data) override { return directory.Read(offset, data); }
+        size_t Write(uint64_t offset, std::span<const uint8_t> data) override { return directory.Write(offset, data); }
+    };
+
+    // Picks the backend based on the contents of the image; raw images are
+    // memory-mapped if a sync policy is given
+    std::unique_ptr<ImageBackend> OpenImage(const char* path, bool writable, std::optional<SyncPolicy> mapping)
+    {
+        int fd = open(path, writable ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            return {};
+
+        std::array<char, 8> magic{};
+        if (pread(fd, magic.data(), magic.size(), 0) == static_cast<ssize_t>(magic.size()) && magic == sparse::Magic) {
+            auto sparseImage = std::make_unique<SparseImage>();
+            if (!sparseImage->Attach(fd))
+                return {};
+            return sparseImage;
+        }
+
+        if (mapping) {
+            auto mappedImage = std::make_unique<MappedImage>();
+            if (!mappedImage->Attach(fd, writable, *mapping))
+                return {};
+            return mappedImage;
+        }
+
+        auto imageFile = std::make_unique<ImageFile>();
+        if (!imageFile->Attach(fd))
+            return {};
+        return imageFile;
+    }
+}
+
+namespace
+{
+    class AsyncImageRequest final : public ImageRequest
+    {
+        std::future<size_t> future;
+        std::optional<size_t> result;
+
+    public:
+        AsyncImageRequest(std::future<size_t> future) : future(std::move(future)) { }
+        ~AsyncImageRequest() { Wait(); }
+
+        std::optional<size_t> Poll() override
+        {
+            if (!result && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                result = future.get();
+            return result;
+        }
+
+        size_t Wait() override
+        {
+            if (!result)
+                result = future.get();
+            return *result;
+        }
+    };
 }
 
 struct ImageLibrary::Impl : ImageProvider
 {
-    std::array<ImageFile, static_cast<size_t>(Image::COUNT)> imageFiles;
+    std::array<std::unique_ptr<ImageBackend>, static_cast<size_t>(Image::COUNT)> imageFiles;
+    std::array<std::atomic<Bytes>, static_cast<size_t>(Image::COUNT)> imageSizes{};
+    SyncPolicy syncPolicy = SyncPolicy::WriteThrough;
+    bool useMapping = false;
+    bool directoryWriteBack = false;
+    size_t cacheSize = 0;
+    ImageLibrary::CacheStatistics cacheStatistics;
+
+    // The backends are not thread-safe: all access goes through this mutex.
+    // Asynchronous requests are handled in order by a single worker thread.
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::condition_variable queueEmpty;
+    std::deque<std::packaged_task<size_t()>> queue;
+    bool stopWorker = false;
+    std::thread worker;
+
+    ~Impl();
+
+    std::optional<SyncPolicy> GetMapping() const;
+    std::unique_ptr<ImageBackend> Open(const Image image, const char* path, bool writable);
+    std::unique_ptr<ImageBackend> AddLayers(std::unique_ptr<ImageBackend> imageFile);
+    void SetImage(const Image image, std::unique_ptr<ImageBackend> imageFile);
+    void Worker();
+    void Drain(std::unique_lock<std::mutex>& lock);
+    std::unique_ptr<ImageRequest> Enqueue(std::packaged_task<size_t()> task);
 
     Bytes GetSize(const Image image) override;
     size_t Read(const Image image, uint64_t offset, std::span<uint8_t> data) override;
     size_t Write(const Image image, uint64_t offset, std::span<const uint8_t> data) override;
+    std::unique_ptr<ImageRequest> ReadAsync(const Image image, uint64_t offset, std::span<uint8_t> data) override;
+    std::unique_ptr<ImageRequest> WriteAsync(const Image image, uint64_t offset, std::span<const uint8_t> data) override;
 };
 
+ImageLibrary::Impl::~Impl()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopWorker = true;
+    }
+    queueChanged.notify_all();
+    if (worker.joinable())
+        worker.join();
+}
+
+void ImageLibrary::Impl::Worker()
+{
+    std::unique_lock lock(mutex);
+    while (true) {
+        queueChanged.wait(lock, [&] { return stopWorker || !queue.empty(); });
+        if (queue.empty())
+            return;
+
+        queue.front()();
+        queue.pop_front();
+        if (queue.empty())
+            queueEmpty.notify_all();
+    }
+}
+
+// Waits until all asynchronous requests are handled, so that synchronous
+// access sees their effects
+void ImageLibrary::Impl::Drain(std::unique_lock<std::mutex>& lock)
+{
+    queueEmpty.wait(lock, [&] { return queue.empty(); });
+}
+
+std::unique_ptr<ImageRequest> ImageLibrary::Impl::Enqueue(std::packaged_task<size_t()> task)
+{
+    auto future = task.get_future();
+    {
+        std::lock_guard lock(mutex);
+        queue.push_back(std::move(task));
+    }
+    queueChanged.notify_one();
+    return std::make_unique<AsyncImageRequest>(std::move(future));
+}
+
 Bytes ImageLibrary::Impl::GetSize(const Image image)
 {
-    auto& imageFile = imageFiles[static_cast<size_t>(image)];
-    return imageFile.length;
+    return imageSizes[static_cast<size_t>(image)];
 }
 
 size_t ImageLibrary::Impl::Read(const Image image, uint64_t offset, std::span<uint8_t> data)
 {
+    std::unique_lock lock(mutex);
+    Drain(lock);
     auto& imageFile = imageFiles[static_cast<size_t>(image)];
-    return imageFile.Read(offset, data);
+    return imageFile ? imageFile->Read(offset, data) : 0;
 }
 
 size_t ImageLibrary::Impl::Write(const Image image, uint64_t offset, std::span<const uint8_t> data)
 {
+    std::unique_lock lock(mutex);
+    Drain(lock);
     auto& imageFile = imageFiles[static_cast<size_t>(image)];
-    return imageFile.Write(offset, data);
+    return imageFile ? imageFile->Write(offset, data) : 0;
+}
+
+std::unique_ptr<ImageRequest> ImageLibrary::Impl::ReadAsync(const Image image, uint64_t offset, std::span<uint8_t> data)
+{
+    if (!worker.joinable())
+        return ImageProvider::ReadAsync(image, offset, data);
+    return Enqueue(std::packaged_task<size_t()>([this, image, offset, data] {
+        auto& imageFile = imageFiles[static_cast<size_t>(image)];
+        return imageFile ? imageFile->Read(offset, data) : 0;
+    }));
+}
+
+std::unique_ptr<ImageRequest> ImageLibrary::Impl::WriteAsync(const Image image, uint64_t offset, std::span<const uint8_t> data)
+{
+    if (!worker.joinable())
+        return ImageProvider::WriteAsync(image, offset, data);
+    return Enqueue(std::packaged_task<size_t()>([this, image, offset, data] {
+        auto& imageFile = imageFiles[static_cast<size_t>(image)];
+        return imageFile ? imageFile->Write(offset, data) : 0;
+    }));
+}
+
+void ImageLibrary::Impl::SetImage(const Image image, std::unique_ptr<ImageBackend> imageFile)
+{
+    imageFile = AddLayers(std::move(imageFile));
+    const auto length = imageFile->GetLength();
+
+    std::unique_lock lock(mutex);
+    Drain(lock);
+    imageFiles[static_cast<size_t>(image)] = std::move(imageFile);
+    imageSizes[static_cast<size_t>(image)] = length;
+}
+
+std::optional<SyncPolicy> ImageLibrary::Impl::GetMapping() const
+{
+    if (!useMapping)
+        return {};
+    return syncPolicy;
+}
+
+// Directories are presented as a FAT volume suitable for the drive
+std::unique_ptr<ImageBackend> ImageLibrary::Impl::Open(const Image image, const char* path, bool writable)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return OpenImage(path, writable, GetMapping());
+
+    auto hostDirectory = std::make_unique<HostDirectory>();
+    const auto type = image == Image::Floppy0 ? DirectoryImage::Type::Floppy : DirectoryImage::Type::Harddisk;
+    if (!hostDirectory->directory.Open(path, type, writable && directoryWriteBack))
+        return {};
+    return hostDirectory;
+}
+
+std::unique_ptr<ImageBackend> ImageLibrary::Impl::AddLayers(std::unique_ptr<ImageBackend> imageFile)
+{
+    // Memory-mapped images are effectively cached by the operating system
+    if (dynamic_cast<MappedImage*>(imageFile.get()))
+        return imageFile;
+    if (syncPolicy != SyncPolicy::WriteThrough)
+        imageFile = std::make_unique<WriteBackImage>(std::move(imageFile), syncPolicy);
+    if (cacheSize != 0)
+        imageFile = std::make_unique<CachedImage>(std::move(imageFile), cacheSize, cacheStatistics);
+    return imageFile;
 }
 
 ImageLibrary::ImageLibrary()
@@ -76,6 +917,62 @@ ImageLibrary::ImageLibrary()
 
 ImageLibrary::~ImageLibrary() = default;
 
+void ImageLibrary::SetSyncPolicy(SyncPolicy policy)
+{
+    impl->syncPolicy = policy;
+}
+
+void ImageLibrary::UseMemoryMapping()
+{
+    impl->useMapping = true;
+}
+
+void ImageLibrary::UseDirectoryWriteBack()
+{
+    impl->directoryWriteBack = true;
+}
+
+void ImageLibrary::UseCache(size_t size)
+{
+    impl->cacheSize = size;
+}
+
+void ImageLibrary::UseAsyncIO()
+{
+    if (!impl->worker.joinable())
+        impl->worker = std::thread([this] { impl->Worker(); });
+}
+
+ImageLibrary::CacheStatistics ImageLibrary::GetCacheStatistics() const
+{
+    std::lock_guard lock(impl->mutex);
+    return impl->cacheStatistics;
+}
+
+void ImageLibrary::Update(std::chrono::nanoseconds now)
+{
+    // Never hold up emulation while the worker is busy
+    std::unique_lock lock(impl->mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !impl->queue.empty())
+        return;
+
+    for (auto& imageFile : impl->imageFiles) {
+        if (imageFile) imageFile->Update(now);
+    }
+}
+
+bool ImageLibrary::Flush()
+{
+    std::unique_lock lock(impl->mutex);
+    impl->Drain(lock);
+    bool result = true;
+    for (auto& imageFile : impl->imageFiles) {
+        if (imageFile && !imageFile->Flush())
+            result = false;
+    }
+    return result;
+}
+
 ImageProvider& ImageLibrary::GetImageProvider()
 {
     return *impl;
@@ -83,10 +980,31 @@ ImageProvider& ImageLibrary::GetImageProvider()
 
 bool ImageLibrary::SetImage(const Image image, const char* path)
 {
-    int fd = open(path, O_RDWR);
-    if (fd < 0)
+    auto imageFile = impl->Open(image, path, true);
+    if (!imageFile)
+        return false;
+    impl->SetImage(image, std::move(imageFile));
+    return true;
+}
+
+bool ImageLibrary::SetOverlayImage(const Image image, const char* basePath, const char* overlayPath)
+{
+    // The FAT layout of a directory is rebuilt on every start, so blocks
+    // stored by an earlier run would no longer match once the directory
+    // changes
+    struct stat st;
+    if (stat(basePath, &st) == 0 && S_ISDIR(st.st_mode)) {
+        spdlog::error("imagelibrary: '{}' is a directory, which cannot be used with an overlay", basePath);
+        return false;
+    }
+
+    auto baseImage = impl->Open(image, basePath, false);
+    if (!baseImage)
         return false;
 
-    auto& imageFile = impl->imageFiles[static_cast<size_t>(image)];
-    return imageFile.Attach(fd);
+    auto overlayImage = std::make_unique<OverlayImage>();
+    if (!overlayImage->Open(std::move(baseImage), overlayPath))
+        return false;
+    impl->SetImage(image, std::move(overlayImage));
+    return true;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include "../interface/imageprovider.h"
 
@@ -11,10 +12,52 @@ class ImageLibrary
     std::unique_ptr<Impl> impl;
 
 public:
+    // When writes reach the image file
+    enum class SyncPolicy
+    {
+        Unsafe,       // buffered, written once the buffer is full or on close
+        OnClose,      // buffered, written periodically and synced on close
+        WriteThrough, // immediately
+    };
+
+    struct CacheStatistics
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t readAheads = 0;
+    };
+
     ImageLibrary();
     ~ImageLibrary();
 
+    // These apply to images attached afterwards
+    void SetSyncPolicy(SyncPolicy policy);
+    // Raw images are memory-mapped, which avoids a system call per sector
+    void UseMemoryMapping();
+    // Images attached after this call are accessed through a block cache of
+    // at most the given size; zero disables caching
+    void UseCache(size_t size);
+    // Directories attached as images write changes to existing files back
+    // to the host files; otherwise all changes are kept in memory
+    void UseDirectoryWriteBack();
+    // Handle asynchronous requests on a worker thread; otherwise they are
+    // completed immediately
+    void UseAsyncIO();
+    CacheStatistics GetCacheStatistics() const;
+
+    // Writes buffered data when it has been pending for too long, or when
+    // the disks have become idle
+    void Update(std::chrono::nanoseconds now);
+    // Writes all buffered data and syncs the images (unless the policy is
+    // Unsafe); returns false if anything could not be written
+    bool Flush();
+
+    // If path is a directory, it is presented as a FAT formatted disk
     bool SetImage(const Image image, const char* path);
+    // Uses basePath read-only; written blocks are stored in overlayPath,
+    // which is created if it does not exist yet. basePath must be an image,
+    // not a directory
+    bool SetOverlayImage(const Image image, const char* basePath, const char* overlayPath);
 
     ImageProvider& GetImageProvider();
 };
@@ -0,0 +1,251 @@
+#include "inputlog.h"
+
+#include <array>
+#include <fstream>
+#include "spdlog/spdlog.h"
+
+namespace
+{
+    constexpr std::array<char, 8> magic{ 'x', '8', '6', 'b', 'o', 'x', 'I', 'L' };
+    constexpr uint8_t version = 1;
+
+    // Assumes an average 8088 instruction takes about 2us
+    constexpr std::chrono::nanoseconds instructionTime{ 2000 };
+
+    enum class EventType : uint8_t
+    {
+        Scancode = 1,
+        ImageChange = 2,
+        Interrupt = 3,
+        LocalTime = 4,
+    };
+
+    struct Event
+    {
+        EventType type;
+        uint64_t instruction;
+        std::array<uint32_t, 7> args{};
+    };
+
+    size_t GetNumberOfArguments(EventType type)
+    {
+        switch(type) {
+            case EventType::Scancode:
+            case EventType::ImageChange:
+            case EventType::Interrupt:
+                return 1;
+            case EventType::LocalTime:
+                return 7;
+        }
+        return 0;
+    }
+
+    bool IsValidType(uint8_t type)
+    {
+        return type >= static_cast<uint8_t>(EventType::Scancode) && type <= static_cast<uint8_t>(EventType::LocalTime);
+    }
+
+    // Values are stored as LEB128 to keep the log small: most instruction
+    // deltas and arguments fit in one or two bytes
+    void WriteVarint(std::ostream& os, uint64_t v)
+    {
+        while (v >= 0x80) {
+            os.put(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        os.put(static_cast<char>(v));
+    }
+
+    std::optional<uint64_t> ReadVarint(std::istream& is)
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const auto ch = is.get();
+            if (ch == std::istream::traits_type::eof())
+                return {};
+            v |= static_cast<uint64_t>(ch & 0x7f) << shift;
+            if ((ch & 0x80) == 0)
+                return v;
+        }
+        return {};
+    }
+}
+
+struct InputLog::Impl
+{
+    const Mode mode;
+    const uint64_t& instructionCount;
+    std::ofstream out;
+    std::ifstream in;
+    uint64_t lastInstruction = 0;
+    std::optional<Event> next;
+    bool diverged = false;
+
+    Impl(Mode mode, const uint64_t& instructionCount) : mode(mode), instructionCount(instructionCount) { }
+
+    void Write(EventType type, std::initializer_list<uint32_t> args);
+    std::optional<Event> Read();
+    std::optional<Event> Take(EventType type);
+    void Diverged(const char* reason);
+};
+
+void InputLog::Impl::Write(EventType type, std::initializer_list<uint32_t> args)
+{
+    out.put(static_cast<char>(type));
+    WriteVarint(out, instructionCount - lastInstruction);
+    for (const auto arg : args)
+        WriteVarint(out, arg);
+    lastInstruction = instructionCount;
+}
+
+std::optional<Event> InputLog::Impl::Read()
+{
+    const auto type = in.get();
+    if (type == std::istream::traits_type::eof())
+        return {};
+    if (!IsValidType(type)) {
+        spdlog::error("inputlog: corrupt event type {}, stopping replay", type);
+        return {};
+    }
+
+    Event event{ .type = static_cast<EventType>(type), .instruction = 0 };
+    const auto delta = ReadVarint(in);
+    if (!delta)
+        return {};
+    event.instruction = lastInstruction + *delta;
+    for (size_t n = 0; n < GetNumberOfArguments(event.type); ++n) {
+        const auto v = ReadVarint(in);
+        if (!v)
+            return {};
+        event.args[n] = *v;
+    }
+    lastInstruction = event.instruction;
+    return event;
+}
+
+std::optional<Event> InputLog::Impl::Take(EventType type)
+{
+    while (next && next->instruction < instructionCount) {
+        Diverged("recorded input was not consumed");
+        next = Read();
+    }
+    if (!next || next->instruction != instructionCount || next->type != type)
+        return {};
+
+    auto event = next;
+    next = Read();
+    if (!next)
+        spdlog::info("inputlog: end of recording reached at instruction {}", instructionCount);
+    return event;
+}
+
+void InputLog::Impl::Diverged(const char* reason)
+{
+    // Nothing can diverge anymore once the end of the recording is reached
+    if (diverged || !next)
+        return;
+    spdlog::error("inputlog: replay diverged at instruction {}: {}", instructionCount, reason);
+    diverged = true;
+}
+
+InputLog::InputLog(Mode mode, const uint64_t& instructionCount)
+    : impl(std::make_unique<Impl>(mode, instructionCount))
+{
+}
+
+InputLog::~InputLog() = default;
+
+bool InputLog::Open(const char* path)
+{
+    if (impl->mode == Mode::Record) {
+        impl->out.open(path, std::ofstream::binary | std::ofstream::trunc);
+        impl->out.write(magic.data(), magic.size());
+        impl->out.put(static_cast<char>(version));
+        return impl->out.good();
+    }
+
+    impl->in.open(path, std::ifstream::binary);
+    std::array<char, 8> m;
+    impl->in.read(m.data(), m.size());
+    if (!impl->in || m != magic || impl->in.get() != version)
+        return false;
+    impl->next = impl->Read();
+    return true;
+}
+
+InputLog::Mode InputLog::GetMode() const
+{
+    return impl->mode;
+}
+
+uint16_t InputLog::Scancode(uint16_t scancode)
+{
+    if (impl->mode == Mode::Record) {
+        if (scancode)
+            impl->Write(EventType::Scancode, { scancode });
+        return scancode;
+    }
+    const auto event = impl->Take(EventType::Scancode);
+    return event ? event->args[0] : 0;
+}
+
+std::optional<size_t> InputLog::ImageChange(std::optional<size_t> index)
+{
+    if (impl->mode == Mode::Record) {
+        if (index)
+            impl->Write(EventType::ImageChange, { static_cast<uint32_t>(*index) });
+        return index;
+    }
+    if (const auto event = impl->Take(EventType::ImageChange); event)
+        return event->args[0];
+    return {};
+}
+
+LocalTime InputLog::GetLocalTime(TimeInterface& time)
+{
+    if (impl->mode == Mode::Record) {
+        const auto t = time.GetLocalTime();
+        impl->Write(EventType::LocalTime, {
+            static_cast<uint32_t>(t.seconds), static_cast<uint32_t>(t.minutes), static_cast<uint32_t>(t.hours),
+            static_cast<uint32_t>(t.week_day), static_cast<uint32_t>(t.day), static_cast<uint32_t>(t.month),
+            static_cast<uint32_t>(t.year) });
+        return t;
+    }
+
+    const auto event = impl->Take(EventType::LocalTime);
+    if (!event) {
+        impl->Diverged("unexpected time read");
+        return time.GetLocalTime();
+    }
+    const auto& a = event->args;
+    return {
+        .seconds = static_cast<int>(a[0]),
+        .minutes = static_cast<int>(a[1]),
+        .hours = static_cast<int>(a[2]),
+        .week_day = static_cast<int>(a[3]),
+        .day = static_cast<int>(a[4]),
+        .month = static_cast<int>(a[5]),
+        .year = static_cast<int>(a[6])
+    };
+}
+
+void InputLog::InterruptDelivered(int irq)
+{
+    if (impl->mode == Mode::Record) {
+        impl->Write(EventType::Interrupt, { static_cast<uint32_t>(irq) });
+        return;
+    }
+    const auto event = impl->Take(EventType::Interrupt);
+    if (!event || static_cast<int>(event->args[0]) != irq)
+        impl->Diverged("unexpected interrupt");
+}
+
+std::chrono::nanoseconds InstructionTickProvider::GetTickCount()
+{
+    return instructionCount * instructionTime;
+}
+
+LocalTime LoggedTimeProvider::GetLocalTime()
+{
+    return log.GetLocalTime(time);
+}
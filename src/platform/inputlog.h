@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include "../interface/tickinterface.h"
+#include "../interface/timeinterface.h"
+
+// Records every non-deterministic input of the machine, tagged with the
+// instruction count at which it was delivered, or replays such a recording
+class InputLog final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    enum class Mode
+    {
+        Record,
+        Replay,
+    };
+
+    InputLog(Mode mode, const uint64_t& instructionCount);
+    ~InputLog();
+
+    bool Open(const char* path);
+    Mode GetMode() const;
+
+    // Each of these records the host value when recording, or ignores it and
+    // returns the recorded value when replaying
+    uint16_t Scancode(uint16_t scancode);
+    std::optional<size_t> ImageChange(std::optional<size_t> index);
+    LocalTime GetLocalTime(TimeInterface& time);
+
+    // Interrupts follow from the other inputs; these are only recorded to
+    // detect a replay diverging from the original run
+    void InterruptDelivered(int irq);
+};
+
+// Time derived from the number of executed instructions, so that timer
+// interrupts and retrace timing do not depend on host speed
+struct InstructionTickProvider : TickInterface
+{
+    const uint64_t& instructionCount;
+
+    InstructionTickProvider(const uint64_t& instructionCount) : instructionCount(instructionCount) { }
+    std::chrono::nanoseconds GetTickCount() override;
+};
+
+struct LoggedTimeProvider : TimeInterface
+{
+    InputLog& log;
+    TimeInterface& time;
+
+    LoggedTimeProvider(InputLog& log, TimeInterface& time) : log(log), time(time) { }
+    LocalTime GetLocalTime() override;
+};
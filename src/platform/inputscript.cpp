@@ -0,0 +1,283 @@
+#include "inputscript.h"
+#include "hostio.h"
+#include "rununtil.h"
+#include "../interface/memoryinterface.h"
+#include "../interface/textdisplayinterface.h"
+#include "../interface/tickinterface.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+namespace
+{
+    namespace bda
+    {
+        constexpr inline memory::Address KeyboardBufferHead = 0x41a;
+        constexpr inline memory::Address KeyboardBufferTail = 0x41c;
+        constexpr inline memory::Address KeyboardBufferStart = 0x480;
+        constexpr inline memory::Address KeyboardBufferEnd = 0x482;
+
+        // Used if the BIOS does not provide the location of the buffer
+        constexpr inline uint16_t DefaultKeyboardBufferStart = 0x1e;
+        constexpr inline uint16_t DefaultKeyboardBufferEnd = 0x3e;
+    }
+
+    // Keystrokes kept free in the BIOS buffer, to avoid it overflowing
+    constexpr inline uint16_t ReservedKeystrokes = 2;
+    constexpr inline uint16_t BreakCode = 0x80;
+
+    constexpr inline std::string_view ShiftedCharacters = "~!@#$%^&*()_+{}|:\"<>?";
+    constexpr inline std::string_view UnshiftedCharacters = "`1234567890-=[]\\;',./";
+
+    struct Step
+    {
+        enum class Type
+        {
+            Wait,
+            WaitScreen,
+            Keys,
+        };
+
+        Type type;
+        std::chrono::nanoseconds duration{};
+        std::optional<std::regex> pattern;
+        std::vector<uint16_t> scancodes;
+    };
+
+    uint16_t GetScancodeForKey(std::string name)
+    {
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char ch) { return std::tolower(ch); });
+        if (name == "ctrl") name = "left ctrl";
+        else if (name == "alt") name = "left alt";
+        else if (name == "shift") name = "left shift";
+        else if (name == "enter") name = "return";
+        else if (name == "esc") name = "escape";
+        else if (name == "del") name = "delete";
+        return HostIO::GetScancodeForKeyName(name.c_str());
+    }
+
+    // Presses the keys in order and releases them in reverse order
+    void AddKeyCombination(std::vector<uint16_t>& scancodes, const std::vector<uint16_t>& keys)
+    {
+        for (const auto key : keys)
+            scancodes.push_back(key);
+        for (auto it = keys.rbegin(); it != keys.rend(); ++it)
+            scancodes.push_back(*it | BreakCode);
+    }
+
+    bool AddCharacter(std::vector<uint16_t>& scancodes, char ch)
+    {
+        bool shift = false;
+        if (std::isupper(static_cast<unsigned char>(ch))) {
+            ch = std::tolower(static_cast<unsigned char>(ch));
+            shift = true;
+        } else if (const auto n = ShiftedCharacters.find(ch); n != std::string_view::npos) {
+            ch = UnshiftedCharacters[n];
+            shift = true;
+        }
+
+        uint16_t key{};
+        switch(ch) {
+            case '\n': key = GetScancodeForKey("return"); break;
+            case '\t': key = GetScancodeForKey("tab"); break;
+            case ' ': key = GetScancodeForKey("space"); break;
+            default: key = GetScancodeForKey(std::string(1, ch)); break;
+        }
+        if (key == 0)
+            return false;
+
+        if (shift)
+            AddKeyCombination(scancodes, { GetScancodeForKey("shift"), key });
+        else
+            AddKeyCombination(scancodes, { key });
+        return true;
+    }
+
+    std::optional<Step> ParseStep(const std::string& command, const std::string& argument)
+    {
+        Step step{};
+        if (command == "wait") {
+            unsigned int ms{};
+            const auto [ ptr, ec ] = std::from_chars(argument.data(), argument.data() + argument.size(), ms);
+            if (ec != std::errc() || ptr != argument.data() + argument.size()) return {};
+            step.type = Step::Type::Wait;
+            step.duration = std::chrono::milliseconds(ms);
+        } else if (command == "wait-screen") {
+            step.type = Step::Type::WaitScreen;
+            try {
+                step.pattern = std::regex(argument);
+            } catch (const std::regex_error&) {
+                return {};
+            }
+        } else if (command == "type") {
+            step.type = Step::Type::Keys;
+            for (size_t n = 0; n < argument.size(); ++n) {
+                auto ch = argument[n];
+                if (ch == '\\' && n + 1 < argument.size()) {
+                    switch(argument[++n]) {
+                        case 'n': ch = '\n'; break;
+                        case 't': ch = '\t'; break;
+                        case '\\': ch = '\\'; break;
+                        default: return {};
+                    }
+                }
+                if (!AddCharacter(step.scancodes, ch)) return {};
+            }
+        } else if (command == "key") {
+            step.type = Step::Type::Keys;
+            std::vector<uint16_t> keys;
+            for (size_t start = 0; start <= argument.size(); ) {
+                auto end = argument.find('+', start + 1);
+                if (end == std::string::npos) end = argument.size();
+                const auto key = GetScancodeForKey(argument.substr(start, end - start));
+                if (key == 0) return {};
+                keys.push_back(key);
+                start = end + 1;
+            }
+            AddKeyCombination(step.scancodes, keys);
+        } else {
+            return {};
+        }
+        return step;
+    }
+}
+
+struct InputScript::Impl
+{
+    MemoryInterface& memory;
+    TickInterface& tick;
+    TextDisplayInterface& display;
+
+    std::vector<Step> steps;
+    size_t currentStep = 0;
+    bool stepStarted = false;
+    std::chrono::nanoseconds stepStart{};
+    size_t scancodeIndex = 0;
+    bool screenChanged = false;
+
+    Impl(MemoryInterface& memory, TickInterface& tick, TextDisplayInterface& display)
+        : memory(memory), tick(tick), display(display)
+    {
+    }
+
+    bool HasCompleted(const Step& step);
+    bool BiosBufferHasRoom();
+};
+
+bool InputScript::Impl::HasCompleted(const Step& step)
+{
+    switch(step.type) {
+        case Step::Type::Wait:
+            return tick.GetTickCount() - stepStart >= step.duration;
+        case Step::Type::WaitScreen: {
+            if (!screenChanged) return false;
+            screenChanged = false;
+            return std::regex_search(GetScreenText(display), *step.pattern);
+        }
+        case Step::Type::Keys:
+            return scancodeIndex == step.scancodes.size();
+    }
+    return true;
+}
+
+bool InputScript::Impl::BiosBufferHasRoom()
+{
+    auto start = memory.ReadWord(bda::KeyboardBufferStart);
+    auto end = memory.ReadWord(bda::KeyboardBufferEnd);
+    if (start == 0 || end <= start) {
+        start = bda::DefaultKeyboardBufferStart;
+        end = bda::DefaultKeyboardBufferEnd;
+    }
+    const uint16_t size = end - start;
+    const auto head = memory.ReadWord(bda::KeyboardBufferHead);
+    const auto tail = memory.ReadWord(bda::KeyboardBufferTail);
+    const uint16_t used = (tail + size - head) % size;
+    // Each keystroke takes a word and one is always left unused
+    return used / 2 + 1 + ReservedKeystrokes < size / 2;
+}
+
+InputScript::InputScript(MemoryInterface& memory, TickInterface& tick, TextDisplayInterface& display)
+    : impl(std::make_unique<Impl>(memory, tick, display))
+{
+}
+
+InputScript::~InputScript() = default;
+
+bool InputScript::Load(const char* path)
+{
+    std::ifstream ifs(path);
+    if (!ifs) return false;
+
+    std::vector<Step> steps;
+    std::string line;
+    for (int lineNumber = 1; std::getline(ifs, line); ++lineNumber) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line.front() == '#') continue;
+
+        const auto n = line.find(' ');
+        const auto command = line.substr(0, n);
+        const auto argument = n != std::string::npos ? line.substr(n + 1) : std::string{};
+        auto step = ParseStep(command, argument);
+        if (!step) {
+            spdlog::error("inputscript: cannot parse line {}: '{}'", lineNumber, line);
+            return false;
+        }
+        steps.push_back(std::move(*step));
+    }
+
+    impl->steps = std::move(steps);
+    impl->currentStep = 0;
+    impl->stepStarted = false;
+    return true;
+}
+
+void InputScript::Update()
+{
+    while (impl->currentStep < impl->steps.size()) {
+        const auto& step = impl->steps[impl->currentStep];
+        if (!impl->stepStarted) {
+            impl->stepStarted = true;
+            impl->stepStart = impl->tick.GetTickCount();
+            impl->scancodeIndex = 0;
+            // The screen may already match
+            impl->screenChanged = true;
+        }
+        if (!impl->HasCompleted(step))
+            return;
+        ++impl->currentStep;
+        impl->stepStarted = false;
+    }
+}
+
+void InputScript::NotifyScreenChanged()
+{
+    impl->screenChanged = true;
+}
+
+uint16_t InputScript::GetScancode()
+{
+    if (!impl->stepStarted || impl->currentStep >= impl->steps.size())
+        return 0;
+    const auto& step = impl->steps[impl->currentStep];
+    if (step.type != Step::Type::Keys || impl->scancodeIndex == step.scancodes.size())
+        return 0;
+
+    const auto scancode = step.scancodes[impl->scancodeIndex];
+    if ((scancode & BreakCode) == 0 && !impl->BiosBufferHasRoom())
+        return 0;
+    ++impl->scancodeIndex;
+    return scancode;
+}
+
+bool InputScript::IsFinished() const
+{
+    return impl->currentStep >= impl->steps.size();
+}
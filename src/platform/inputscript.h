@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+struct MemoryInterface;
+struct TickInterface;
+struct TextDisplayInterface;
+
+// Types keys from a script, for unattended runs. Each line of the script is
+// one of:
+//
+//   wait <ms>            wait the given amount of guest time
+//   wait-screen <regex>  wait until the text on the screen matches
+//   type <text>          type text; \n is Enter, \t is Tab and \\ a backslash
+//   key <name>[+<name>]  press and release a key combination, i.e. ctrl+c
+//
+// Empty lines and lines starting with # are ignored. Keys are only handed
+// out once the guest is able to take them, so typing proceeds as fast as
+// the guest processes its input.
+class InputScript final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    // tick provides the guest time used by wait steps
+    InputScript(MemoryInterface& memory, TickInterface& tick, TextDisplayInterface& display);
+    ~InputScript();
+
+    bool Load(const char* path);
+
+    // Advances to the next step once the current one has completed
+    void Update();
+    void NotifyScreenChanged();
+
+    // Returns the next scancode to deliver, or 0 if there is none yet. Should
+    // only be called once the keyboard controller has delivered all
+    // previous scancodes.
+    uint16_t GetScancode();
+
+    bool IsFinished() const;
+};
@@ -0,0 +1,51 @@
+#include "mappedfile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const char* path, size_t length)
+{
+    Close();
+
+    const int newFd = open(path, O_RDWR | O_CREAT, 0644);
+    if (newFd < 0)
+        return false;
+
+    struct stat sb;
+    if (fstat(newFd, &sb) < 0 || (static_cast<size_t>(sb.st_size) < length && ftruncate(newFd, length) < 0)) {
+        close(newFd);
+        return false;
+    }
+
+    auto ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, newFd, 0);
+    if (ptr == MAP_FAILED) {
+        close(newFd);
+        return false;
+    }
+
+    fd = newFd;
+    data = { static_cast<uint8_t*>(ptr), length };
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (fd < 0) return;
+    Sync();
+    munmap(data.data(), data.size());
+    close(fd);
+    fd = -1;
+    data = {};
+}
+
+void MappedFile::Sync()
+{
+    if (fd < 0) return;
+    msync(data.data(), data.size(), MS_SYNC);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+class MappedFile final
+{
+    int fd = -1;
+    std::span<uint8_t> data;
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    // Maps the first 'length' bytes of 'path' (created/extended if needed)
+    bool Open(const char* path, size_t length);
+    void Close();
+    void Sync();
+
+    std::span<uint8_t> GetData() const { return data; }
+};
@@ -0,0 +1,157 @@
+#include "profiler.h"
+#include "../cpu/cpux86.h"
+#include "../cpu/disassembler.h"
+#include "../interface/memoryinterface.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "spdlog/fmt/fmt.h"
+
+namespace
+{
+    // Symbols further away are not considered to contain the address
+    constexpr inline uint32_t MaximumSymbolDistance = 0x10000;
+
+    struct AddressSamples
+    {
+        uint64_t count{};
+        // The first CS:IP seen for the linear address
+        uint16_t cs{}, ip{};
+    };
+
+    struct Symbol
+    {
+        uint32_t address;
+        std::string name;
+    };
+}
+
+struct Profiler::Impl
+{
+    MemoryInterface& memory;
+    std::unordered_map<uint32_t, AddressSamples> samples;
+    uint64_t numberOfSamples = 0;
+    // Sorted by address
+    std::vector<Symbol> symbols;
+
+    Impl(MemoryInterface& memory) : memory(memory) { }
+
+    std::string Symbolize(uint32_t address) const;
+};
+
+std::string Profiler::Impl::Symbolize(uint32_t address) const
+{
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address,
+        [](uint32_t address, const Symbol& symbol) { return address < symbol.address; });
+    if (it == symbols.begin())
+        return {};
+    --it;
+    if (address - it->address >= MaximumSymbolDistance)
+        return {};
+    if (address == it->address)
+        return it->name;
+    return fmt::format("{}+{:x}", it->name, address - it->address);
+}
+
+Profiler::Profiler(MemoryInterface& memory)
+    : impl(std::make_unique<Impl>(memory))
+{
+    // Room for the distinct addresses of a typical program, so that the
+    // table rarely needs to grow while sampling
+    impl->samples.reserve(4096);
+}
+
+Profiler::~Profiler() = default;
+
+bool Profiler::LoadMap(const char* path, uint16_t loadSegment)
+{
+    std::ifstream ifs(path);
+    if (!ifs) return false;
+
+    // Matches lines such as ' 0000:1234       _main' or '0000:1234+  _main'
+    const std::regex publicLine(R"(^\s*([0-9A-Fa-f]{4}):([0-9A-Fa-f]{4})[+*]?\s+(?:(?:Abs|Imp)\s+)?([^\s]+))");
+    std::map<uint32_t, std::string> found;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::smatch m;
+        if (!std::regex_search(line, m, publicLine))
+            continue;
+        const auto segment = static_cast<uint16_t>(std::stoul(m[1], nullptr, 16) + loadSegment);
+        const auto offset = static_cast<uint16_t>(std::stoul(m[2], nullptr, 16));
+        // Publics are usually listed both by name and by value
+        found.emplace(CPUx86::MakeAddr(segment, offset), m[3]);
+    }
+    if (found.empty()) {
+        spdlog::warn("profiler: no symbols found in '{}'", path);
+    }
+
+    for (auto& [ address, name ] : found)
+        impl->symbols.push_back({ address, std::move(name) });
+    std::stable_sort(impl->symbols.begin(), impl->symbols.end(),
+        [](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+    return true;
+}
+
+void Profiler::Sample(const cpu::State& state)
+{
+    auto& sample = impl->samples[CPUx86::MakeAddr(state.m_cs, state.m_ip)];
+    if (sample.count++ == 0) {
+        sample.cs = state.m_cs;
+        sample.ip = state.m_ip;
+    }
+    ++impl->numberOfSamples;
+}
+
+uint64_t Profiler::GetNumberOfSamples() const
+{
+    return impl->numberOfSamples;
+}
+
+void Profiler::WriteReport(std::ostream& os, size_t maxEntries)
+{
+    std::vector<std::pair<uint32_t, AddressSamples>> sorted(impl->samples.begin(), impl->samples.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.count != b.second.count ? a.second.count > b.second.count : a.first < b.first;
+    });
+
+    const auto total = std::max<uint64_t>(impl->numberOfSamples, 1);
+    os << fmt::format("{} samples, {} distinct addresses\n", impl->numberOfSamples, sorted.size());
+
+    if (!impl->symbols.empty()) {
+        std::unordered_map<std::string, uint64_t> perSymbol;
+        for (const auto& [ address, sample ] : sorted) {
+            auto symbol = impl->Symbolize(address);
+            if (const auto n = symbol.find('+'); n != std::string::npos)
+                symbol.resize(n);
+            perSymbol[symbol.empty() ? "<unknown>" : symbol] += sample.count;
+        }
+        std::vector<std::pair<std::string, uint64_t>> symbols(perSymbol.begin(), perSymbol.end());
+        std::sort(symbols.begin(), symbols.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+        os << "\nBy symbol:\n";
+        for (size_t n = 0; n < symbols.size() && n < maxEntries; ++n) {
+            const auto& [ name, count ] = symbols[n];
+            os << fmt::format("{:6.2f}% {:10} {}\n", 100.0 * count / total, count, name);
+        }
+    }
+
+    os << "\nBy address:\n";
+    Disassembler disassembler;
+    for (size_t n = 0; n < sorted.size() && n < maxEntries; ++n) {
+        const auto& [ address, sample ] = sorted[n];
+        cpu::State state{};
+        state.m_cs = sample.cs;
+        state.m_ip = sample.ip;
+        os << fmt::format("{:6.2f}% {:10} {:05x} {:24} {}\n", 100.0 * sample.count / total, sample.count,
+            address, impl->Symbolize(address), disassembler.Disassemble(impl->memory, state));
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+
+struct MemoryInterface;
+namespace cpu { class State; }
+
+// Sampling profiler for guest code. Each sample counts the CS:IP that is
+// about to be executed; the report lists the hottest addresses, optionally
+// along with the nearest symbol from linker MAP files.
+class Profiler final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    Profiler(MemoryInterface& memory);
+    ~Profiler();
+
+    // Reads the public symbols from a MAP file, as written by most DOS
+    // linkers; segments are relative to the given load segment
+    bool LoadMap(const char* path, uint16_t loadSegment);
+
+    void Sample(const cpu::State& state);
+    uint64_t GetNumberOfSamples() const;
+
+    void WriteReport(std::ostream& os, size_t maxEntries);
+};
@@ -0,0 +1,165 @@
+#include "rewind.h"
+#include "snapshot.h"
+#include "../bus/memory.h"
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <vector>
+
+namespace
+{
+    struct Point
+    {
+        Snapshot devices;
+        // Contents of the pages written since the previous point
+        std::vector<uint16_t> pages;
+        std::vector<uint8_t> pageData;
+
+        size_t GetSize() const
+        {
+            return devices.GetSize() + pages.size() * sizeof(uint16_t) + pageData.size();
+        }
+    };
+}
+
+struct RewindBuffer::Impl
+{
+    Machine& machine;
+    const std::chrono::nanoseconds interval;
+    const size_t memoryBudget;
+
+    // Memory contents at the oldest point
+    std::vector<uint8_t> base;
+    std::deque<Point> points;
+    size_t pointsSize = 0;
+    std::optional<std::chrono::nanoseconds> lastCapture;
+
+    Impl(Machine& machine, std::chrono::nanoseconds interval, size_t memoryBudget)
+        : machine(machine), interval(interval), memoryBudget(memoryBudget)
+    {
+    }
+
+    void Capture();
+    void Evict();
+    bool Rewind(size_t steps);
+};
+
+void RewindBuffer::Impl::Capture()
+{
+    auto& memory = machine.memory;
+    const auto dirtyPages = memory.CollectDirtyPages();
+
+    Point point;
+    point.devices.SaveDevices(machine);
+    if (points.empty()) {
+        base.resize(Memory::s_page_count * Memory::s_page_size);
+        for (size_t page = 0; page < Memory::s_page_count; ++page) {
+            std::ranges::copy(memory.GetPage(page), base.begin() + page * Memory::s_page_size);
+        }
+    } else {
+        point.pages = dirtyPages;
+        point.pageData.reserve(dirtyPages.size() * Memory::s_page_size);
+        for (const auto page : dirtyPages) {
+            const auto data = memory.GetPage(page);
+            point.pageData.insert(point.pageData.end(), data.begin(), data.end());
+        }
+    }
+
+    pointsSize += point.GetSize();
+    points.push_back(std::move(point));
+    Evict();
+}
+
+void RewindBuffer::Impl::Evict()
+{
+    while (points.size() > 1 && base.size() + pointsSize > memoryBudget) {
+        pointsSize -= points.front().GetSize();
+        points.pop_front();
+
+        // Fold the pages of the new oldest point into the base image
+        auto& oldest = points.front();
+        pointsSize -= oldest.GetSize();
+        for (size_t n = 0; n < oldest.pages.size(); ++n) {
+            const auto data = oldest.pageData.begin() + n * Memory::s_page_size;
+            std::copy(data, data + Memory::s_page_size, base.begin() + oldest.pages[n] * Memory::s_page_size);
+        }
+        oldest.pages.clear();
+        oldest.pageData.clear();
+        oldest.pageData.shrink_to_fit();
+        pointsSize += oldest.GetSize();
+    }
+}
+
+bool RewindBuffer::Impl::Rewind(size_t steps)
+{
+    if (steps >= points.size())
+        return false;
+
+    const auto target = points.size() - 1 - steps;
+    auto& memory = machine.memory;
+    for (size_t page = 0; page < Memory::s_page_count; ++page) {
+        const auto data = base.begin() + page * Memory::s_page_size;
+        std::copy(data, data + Memory::s_page_size, memory.GetPage(page).begin());
+    }
+    for (size_t n = 1; n <= target; ++n) {
+        const auto& point = points[n];
+        for (size_t i = 0; i < point.pages.size(); ++i) {
+            const auto data = point.pageData.begin() + i * Memory::s_page_size;
+            std::copy(data, data + Memory::s_page_size, memory.GetPage(point.pages[i]).begin());
+        }
+    }
+    points[target].devices.RestoreDevices(machine);
+
+    while (points.size() > target + 1) {
+        pointsSize -= points.back().GetSize();
+        points.pop_back();
+    }
+
+    // Memory now matches the target point, which is the newest point again
+    memory.CollectDirtyPages();
+    lastCapture.reset();
+    return true;
+}
+
+RewindBuffer::RewindBuffer(Machine& machine, std::chrono::milliseconds interval, size_t memoryBudget)
+    : impl(std::make_unique<Impl>(machine, interval, memoryBudget))
+{
+}
+
+RewindBuffer::~RewindBuffer() = default;
+
+void RewindBuffer::Update(std::chrono::nanoseconds now)
+{
+    if (!impl->lastCapture) {
+        impl->lastCapture = now;
+        if (impl->points.empty())
+            impl->Capture();
+        return;
+    }
+    if (now - *impl->lastCapture < impl->interval)
+        return;
+
+    impl->lastCapture = now;
+    impl->Capture();
+}
+
+void RewindBuffer::Capture()
+{
+    impl->Capture();
+}
+
+size_t RewindBuffer::GetNumberOfPoints() const
+{
+    return impl->points.size();
+}
+
+size_t RewindBuffer::GetMemoryUsage() const
+{
+    return impl->base.size() + impl->pointsSize;
+}
+
+bool RewindBuffer::Rewind(size_t steps)
+{
+    return impl->Rewind(steps);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+struct Machine;
+
+// Ring buffer of periodic machine snapshots. Each point only stores the
+// memory pages written since the previous point, plus the device state.
+class RewindBuffer final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    RewindBuffer(Machine& machine, std::chrono::milliseconds interval, size_t memoryBudget);
+    ~RewindBuffer();
+
+    // Adds a new point once the interval has passed since the previous one
+    void Update(std::chrono::nanoseconds now);
+    void Capture();
+
+    size_t GetNumberOfPoints() const;
+    size_t GetMemoryUsage() const;
+
+    // Returns the machine to the point 'steps' before the most recent one;
+    // all points after it are discarded
+    bool Rewind(size_t steps = 0);
+};
@@ -0,0 +1,139 @@
+#include "rununtil.h"
+#include "../cpu/cpux86.h"
+#include "../cpu/state.h"
+#include "../interface/textdisplayinterface.h"
+#include "../interface/tickinterface.h"
+
+#include <regex>
+
+namespace
+{
+    constexpr inline size_t TextColumns = 80;
+    constexpr inline size_t TextRows = 25;
+}
+
+struct RunUntil::Impl
+{
+    const uint64_t& instructionCount;
+    const cpu::State& state;
+    TickInterface& tick;
+    TextDisplayInterface& display;
+    const std::chrono::steady_clock::time_point start;
+
+    std::optional<uint64_t> instructionLimit;
+    std::optional<std::chrono::nanoseconds> guestTime;
+    std::optional<uint32_t> address;
+    std::optional<std::regex> screenPattern;
+    std::optional<std::chrono::milliseconds> timeout;
+
+    std::optional<Condition> metCondition;
+
+    Impl(const uint64_t& instructionCount, const cpu::State& state, TickInterface& tick, TextDisplayInterface& display)
+        : instructionCount(instructionCount), state(state), tick(tick), display(display)
+        , start(std::chrono::steady_clock::now())
+    {
+    }
+
+    bool Met(Condition condition)
+    {
+        metCondition = condition;
+        return true;
+    }
+};
+
+RunUntil::RunUntil(const uint64_t& instructionCount, const cpu::State& state, TickInterface& tick, TextDisplayInterface& display)
+    : impl(std::make_unique<Impl>(instructionCount, state, tick, display))
+{
+}
+
+RunUntil::~RunUntil() = default;
+
+void RunUntil::SetInstructionCount(uint64_t count)
+{
+    impl->instructionLimit = count;
+}
+
+void RunUntil::SetGuestTime(std::chrono::nanoseconds time)
+{
+    impl->guestTime = time;
+}
+
+void RunUntil::SetAddress(uint32_t address)
+{
+    impl->address = address;
+}
+
+bool RunUntil::SetScreenPattern(const std::string& pattern)
+{
+    try {
+        impl->screenPattern = std::regex(pattern);
+    } catch (const std::regex_error&) {
+        return false;
+    }
+    return true;
+}
+
+void RunUntil::SetTimeout(std::chrono::milliseconds timeout)
+{
+    impl->timeout = timeout;
+}
+
+bool RunUntil::Check()
+{
+    if (impl->instructionLimit && impl->instructionCount >= *impl->instructionLimit)
+        return impl->Met(Condition::Instructions);
+    if (impl->address && CPUx86::MakeAddr(impl->state.m_cs, impl->state.m_ip) == *impl->address)
+        return impl->Met(Condition::Address);
+    return false;
+}
+
+bool RunUntil::CheckPeriodic()
+{
+    if (impl->guestTime && impl->tick.GetTickCount() >= *impl->guestTime)
+        return impl->Met(Condition::GuestTime);
+    if (impl->timeout && std::chrono::steady_clock::now() - impl->start >= *impl->timeout)
+        return impl->Met(Condition::Timeout);
+    return false;
+}
+
+bool RunUntil::CheckScreen()
+{
+    if (impl->screenPattern && std::regex_search(GetScreenText(impl->display), *impl->screenPattern))
+        return impl->Met(Condition::Screen);
+    return false;
+}
+
+std::optional<RunUntil::Condition> RunUntil::GetMetCondition() const
+{
+    return impl->metCondition;
+}
+
+const char* ToString(RunUntil::Condition condition)
+{
+    switch(condition) {
+        case RunUntil::Condition::Instructions: return "instructions";
+        case RunUntil::Condition::GuestTime: return "time";
+        case RunUntil::Condition::Address: return "address";
+        case RunUntil::Condition::Screen: return "screen";
+        case RunUntil::Condition::Timeout: return "timeout";
+    }
+    return "?";
+}
+
+std::string GetScreenText(TextDisplayInterface& display)
+{
+    const auto memory = display.GetTextMemory();
+    std::string text;
+    text.reserve(TextRows * (TextColumns + 1));
+    for (size_t y = 0; y < TextRows; ++y) {
+        std::string line;
+        for (size_t x = 0; x < TextColumns; ++x) {
+            const char ch = static_cast<char>(memory[(y * TextColumns + x) * 2]);
+            line += (ch >= 0x20 && ch < 0x7f) ? ch : ' ';
+        }
+        line.erase(line.find_last_not_of(' ') + 1);
+        text += line;
+        text += '\n';
+    }
+    return text;
+}
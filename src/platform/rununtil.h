@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+struct TickInterface;
+struct TextDisplayInterface;
+namespace cpu { class State; }
+
+// Conditions which end an unattended run, i.e. when boot testing an image.
+// The run ends as soon as any of the configured conditions is met.
+class RunUntil final
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    enum class Condition
+    {
+        Instructions,
+        GuestTime,
+        Address,
+        Screen,
+        Timeout,
+    };
+
+    // tick provides the guest time, which should not depend on the host
+    RunUntil(const uint64_t& instructionCount, const cpu::State& state, TickInterface& tick, TextDisplayInterface& display);
+    ~RunUntil();
+
+    void SetInstructionCount(uint64_t count);
+    void SetGuestTime(std::chrono::nanoseconds time);
+    void SetAddress(uint32_t address);
+    bool SetScreenPattern(const std::string& pattern);
+    // Wall-clock time, counted from construction
+    void SetTimeout(std::chrono::milliseconds timeout);
+
+    // Instruction count and CS:IP; cheap enough to call after every instruction
+    bool Check();
+    // Guest and wall-clock time
+    bool CheckPeriodic();
+    // Text on the screen; only needs to be called once the screen has changed
+    bool CheckScreen();
+
+    std::optional<Condition> GetMetCondition() const;
+};
+
+const char* ToString(RunUntil::Condition condition);
+
+// Returns the 80x25 text mode screen contents, one line per row
+std::string GetScreenText(TextDisplayInterface& display);
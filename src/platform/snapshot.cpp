@@ -0,0 +1,207 @@
+#include "snapshot.h"
+#include "../interface/stateinterface.h"
+#include "../cpu/cpux86.h"
+#include "../hw/vga.h"
+#include "../hw/pic.h"
+#include "../hw/pit.h"
+#include "../hw/dma.h"
+#include "../hw/fdc.h"
+#include "../hw/ata.h"
+#include "../hw/rtc.h"
+#include "../hw/ppi.h"
+#include "../hw/keyboard.h"
+#include "../bios/diskservices.h"
+#include "../bios/handlertrap.h"
+#include "../bios/videoservices.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    constexpr std::array<char, 8> magic{ 'x', '8', '6', 'b', 'o', 'x', 'S', 'S' };
+    // Increment whenever the state of any component changes
+    constexpr uint32_t version = 5;
+
+    using Tag = std::array<char, 4>;
+
+    struct BufferWriter : StateWriter
+    {
+        std::vector<uint8_t>& buffer;
+
+        BufferWriter(std::vector<uint8_t>& buffer) : buffer(buffer) { }
+
+        void WriteBytes(std::span<const uint8_t> data) override
+        {
+            buffer.insert(buffer.end(), data.begin(), data.end());
+        }
+    };
+
+    struct BufferReader : StateReader
+    {
+        std::span<const uint8_t> buffer;
+        size_t offset = 0;
+
+        BufferReader(std::span<const uint8_t> buffer) : buffer(buffer) { }
+
+        void ReadBytes(std::span<uint8_t> data) override
+        {
+            if (offset + data.size() > buffer.size())
+                throw std::runtime_error("snapshot: unexpected end of data");
+            std::memcpy(data.data(), buffer.data() + offset, data.size());
+            offset += data.size();
+        }
+
+        void Expect(const Tag& tag)
+        {
+            Tag t;
+            Read(t);
+            if (t != tag)
+                throw std::runtime_error(std::string("snapshot: expected section '") + std::string(tag.data(), tag.size()) + "'");
+        }
+    };
+
+    // The HLE services are optional: a placeholder is stored in place of a
+    // missing service, so that snapshots work with and without them
+    struct Services
+    {
+        Machine& machine;
+
+        template<typename Service>
+        static void Save(const Service* service, StateWriter& writer)
+        {
+            if (service)
+                service->SaveState(writer);
+            else
+                HandlerTrap{ 0 }.SaveState(writer);
+        }
+
+        template<typename Service>
+        static void Load(Service* service, StateReader& reader)
+        {
+            HandlerTrap placeholder{ 0 };
+            if (service)
+                service->LoadState(reader);
+            else
+                placeholder.LoadState(reader);
+        }
+
+        void SaveState(StateWriter& writer) const
+        {
+            Save(machine.diskServices, writer);
+            Save(machine.videoServices, writer);
+        }
+
+        void LoadState(StateReader& reader)
+        {
+            Load(machine.diskServices, reader);
+            Load(machine.videoServices, reader);
+        }
+    };
+
+    template<typename Fn>
+    void VisitSections(Machine& machine, bool withMemory, Fn fn)
+    {
+        fn(Tag{ 'C', 'P', 'U', ' ' }, machine.cpu);
+        if (withMemory)
+            fn(Tag{ 'R', 'A', 'M', ' ' }, machine.memory);
+        fn(Tag{ 'V', 'G', 'A', ' ' }, machine.vga);
+        fn(Tag{ 'P', 'I', 'C', ' ' }, machine.pic);
+        fn(Tag{ 'P', 'I', 'T', ' ' }, machine.pit);
+        fn(Tag{ 'D', 'M', 'A', ' ' }, machine.dma);
+        fn(Tag{ 'F', 'D', 'C', ' ' }, machine.fdc);
+        fn(Tag{ 'A', 'T', 'A', ' ' }, machine.ata);
+        fn(Tag{ 'R', 'T', 'C', ' ' }, machine.rtc);
+        fn(Tag{ 'P', 'P', 'I', ' ' }, machine.ppi);
+        fn(Tag{ 'K', 'B', 'D', ' ' }, machine.keyboard);
+        Services services{ machine };
+        fn(Tag{ 'H', 'L', 'E', ' ' }, services);
+    }
+
+    void SaveMachine(std::vector<uint8_t>& data, Machine& machine, bool withMemory)
+    {
+        data.clear();
+        BufferWriter writer(data);
+        writer.Write(magic);
+        writer.Write(version);
+        VisitSections(machine, withMemory, [&](const Tag& tag, auto& component) {
+            writer.Write(tag);
+            component.SaveState(writer);
+        });
+    }
+
+    void RestoreMachine(std::span<const uint8_t> data, Machine& machine, bool withMemory)
+    {
+        BufferReader reader(data);
+
+        std::array<char, 8> m;
+        reader.Read(m);
+        if (m != magic)
+            throw std::runtime_error("snapshot: not a snapshot");
+        uint32_t v;
+        reader.Read(v);
+        if (v != version)
+            throw std::runtime_error("snapshot: unsupported version " + std::to_string(v));
+
+        VisitSections(machine, withMemory, [&](const Tag& tag, auto& component) {
+            reader.Expect(tag);
+            component.LoadState(reader);
+        });
+    }
+}
+
+void Snapshot::Save(Machine& machine)
+{
+    SaveMachine(data, machine, true);
+}
+
+void Snapshot::Restore(Machine& machine) const
+{
+    RestoreMachine(data, machine, true);
+}
+
+void Snapshot::SaveDevices(Machine& machine)
+{
+    SaveMachine(data, machine, false);
+}
+
+void Snapshot::RestoreDevices(Machine& machine) const
+{
+    RestoreMachine(data, machine, false);
+}
+
+bool Snapshot::WriteToFile(const char* path) const
+{
+    std::ofstream ofs(path, std::ofstream::binary);
+    ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return ofs.good();
+}
+
+bool Snapshot::ReadFromFile(const char* path)
+{
+    std::ifstream ifs(path, std::ifstream::binary);
+    if (!ifs) return false;
+
+    ifs.seekg(0, std::ifstream::end);
+    const auto length = ifs.tellg();
+    ifs.seekg(0);
+
+    data.resize(length);
+    ifs.read(reinterpret_cast<char*>(data.data()), length);
+    return ifs.good() && ifs.gcount() == length;
+}
+
+void Checkpoint::Take(Machine& machine)
+{
+    devices.SaveDevices(machine);
+    memory = machine.memory.CreateCheckpoint();
+}
+
+void Checkpoint::Fork(Machine& machine) const
+{
+    devices.RestoreDevices(machine);
+    machine.memory.RestoreCheckpoint(*memory);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "../bus/memory.h"
+
+class CPUx86;
+class VGA;
+class PIC;
+class PIT;
+class DMA;
+class FDC;
+class ATA;
+class RTC;
+class PPI;
+class Keyboard;
+class DiskServices;
+class VideoServices;
+
+// Everything that is part of a snapshot
+struct Machine
+{
+    CPUx86& cpu;
+    Memory& memory;
+    VGA& vga;
+    PIC& pic;
+    PIT& pit;
+    DMA& dma;
+    FDC& fdc;
+    ATA& ata;
+    RTC& rtc;
+    PPI& ppi;
+    Keyboard& keyboard;
+    // Optional; the BIOS handlers they have trapped are part of the state
+    DiskServices* diskServices = nullptr;
+    VideoServices* videoServices = nullptr;
+};
+
+class Snapshot final
+{
+    std::vector<uint8_t> data;
+
+public:
+    void Save(Machine& machine);
+    // Throws std::runtime_error if the snapshot is malformed
+    void Restore(Machine& machine) const;
+
+    // As Save() and Restore(), but leaves out the memory contents
+    void SaveDevices(Machine& machine);
+    void RestoreDevices(Machine& machine) const;
+
+    size_t GetSize() const { return data.size(); }
+
+    bool WriteToFile(const char* path) const;
+    bool ReadFromFile(const char* path);
+};
+
+// In-process machine checkpoint: any number of machines can be forked from
+// it, which shares guest RAM copy-on-write instead of copying it
+class Checkpoint final
+{
+    Snapshot devices;
+    std::shared_ptr<const Memory::Checkpoint> memory;
+
+public:
+    void Take(Machine& machine);
+    void Fork(Machine& machine) const;
+};
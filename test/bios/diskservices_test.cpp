@@ -0,0 +1,201 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "interface/imageprovider.h"
+#include "bios/diskservices.h"
+#include "bus/memory.h"
+#include "cpu/state.h"
+
+using ::testing::Return;
+using ::testing::_;
+
+namespace
+{
+    constexpr inline uint16_t HandlerSegment = 0xf000;
+    constexpr inline uint16_t HandlerOffset = 0x1234;
+    constexpr inline uint16_t CallerSegment = 0x0070;
+    constexpr inline uint16_t CallerOffset = 0x0100;
+    constexpr inline uint16_t CallerFlags = 0xf203; // IF, CF
+    constexpr inline uint16_t StackSegment = 0x0030;
+    constexpr inline uint16_t StackPointer = 0x00fa;
+
+    constexpr inline Bytes FloppySize = 1474560;
+    constexpr inline Bytes HarddiskSize = 615 * 6 * 17 * 512;
+
+    struct MockImageProvider : ImageProvider
+    {
+        MOCK_METHOD(Bytes, GetSize, (const Image image), (override));
+        MOCK_METHOD(size_t, Read, (const Image image, uint64_t offset, std::span<uint8_t> data), (override));
+        MOCK_METHOD(size_t, Write, (const Image image, uint64_t offset, std::span<const uint8_t> data), (override));
+    };
+
+    struct DiskServicesTest : ::testing::Test
+    {
+        Memory memory;
+        MockImageProvider imageProvider;
+        DiskServices diskServices{ memory, imageProvider };
+        cpu::State state{};
+
+        DiskServicesTest()
+        {
+            ON_CALL(imageProvider, GetSize(Image::Floppy0)).WillByDefault(Return(FloppySize));
+            ON_CALL(imageProvider, GetSize(Image::Harddisk0)).WillByDefault(Return(HarddiskSize));
+            memory.WriteWord(0x13 * 4 + 0, HandlerOffset);
+            memory.WriteWord(0x13 * 4 + 2, HandlerSegment);
+            memory.WriteByte(0x475, 1); // number of hard disks
+        }
+
+        void Boot()
+        {
+            state.m_cs = 0;
+            state.m_ip = 0x7c00;
+            EXPECT_FALSE(diskServices.Handle(state));
+        }
+
+        // As if the INT 13h instruction has just been executed
+        void Call(uint16_t ax, uint16_t cx, uint16_t dx, uint16_t es, uint16_t bx)
+        {
+            state.m_ax = ax; state.m_cx = cx; state.m_dx = dx;
+            state.m_es = es; state.m_bx = bx;
+            state.m_ss = StackSegment;
+            state.m_sp = StackPointer;
+            const auto stack = (StackSegment << 4) + StackPointer;
+            memory.WriteWord(stack + 0, CallerOffset);
+            memory.WriteWord(stack + 2, CallerSegment);
+            memory.WriteWord(stack + 4, CallerFlags);
+            state.m_cs = HandlerSegment;
+            state.m_ip = HandlerOffset;
+            state.m_flags = 0xf002;
+        }
+
+        void VerifyReturned(uint16_t ax)
+        {
+            EXPECT_EQ(ax, state.m_ax);
+            EXPECT_EQ(CallerSegment, state.m_cs);
+            EXPECT_EQ(CallerOffset, state.m_ip);
+            EXPECT_EQ(CallerFlags & ~cpu::flag::CF, state.m_flags);
+            EXPECT_EQ(StackPointer + 6, state.m_sp);
+        }
+
+        void VerifyNotHandled()
+        {
+            EXPECT_EQ(HandlerSegment, state.m_cs);
+            EXPECT_EQ(HandlerOffset, state.m_ip);
+            EXPECT_EQ(StackPointer, state.m_sp);
+        }
+    };
+}
+
+TEST_F(DiskServicesTest, NothingIsTrappedBeforeBoot)
+{
+    EXPECT_CALL(imageProvider, Read(_, _, _)).Times(0);
+    Call(0x0201, 0x0001, 0x0080, 0x1000, 0x0000);
+    EXPECT_FALSE(diskServices.Handle(state));
+    VerifyNotHandled();
+}
+
+TEST_F(DiskServicesTest, HandlersInRAMAreNotTrapped)
+{
+    memory.WriteWord(0x13 * 4 + 0, 0x0100);
+    memory.WriteWord(0x13 * 4 + 2, 0x0070);
+    Boot();
+
+    EXPECT_CALL(imageProvider, Read(_, _, _)).Times(0);
+    Call(0x0201, 0x0001, 0x0080, 0x1000, 0x0000);
+    state.m_cs = 0x0070;
+    state.m_ip = 0x0100;
+    EXPECT_FALSE(diskServices.Handle(state));
+}
+
+TEST_F(DiskServicesTest, ReadHarddiskSectorsIntoMemory)
+{
+    Boot();
+
+    // cylinder 2, head 3, sector 4
+    constexpr uint64_t lba = (2 * 6 + 3) * 17 + 3;
+    EXPECT_CALL(imageProvider, Read(Image::Harddisk0, lba * 512, _))
+        .WillOnce([](auto, auto, std::span<uint8_t> data) {
+            EXPECT_EQ(2 * 512, data.size());
+            for (size_t n = 0; n < data.size(); ++n)
+                data[n] = n & 0xff;
+            return data.size();
+        });
+    memory.WriteByte(0x474, 0xaa);
+
+    Call(0x0202, 0x0204, 0x0380, 0x1000, 0x0010);
+    EXPECT_TRUE(diskServices.Handle(state));
+    VerifyReturned(0x0002);
+    EXPECT_EQ(0, memory.ReadByte(0x474));
+    for (size_t n = 0; n < 2 * 512; ++n)
+        EXPECT_EQ(n & 0xff, memory.ReadByte(0x10010 + n));
+}
+
+TEST_F(DiskServicesTest, WriteFloppySectorsFromMemory)
+{
+    Boot();
+    for (size_t n = 0; n < 3 * 512; ++n)
+        memory.WriteByte(0x20000 + n, 0x5a);
+
+    // cylinder 1, head 1, sector 16
+    constexpr uint64_t lba = (1 * 2 + 1) * 18 + 15;
+    EXPECT_CALL(imageProvider, Write(Image::Floppy0, lba * 512, _))
+        .WillOnce([](auto, auto, std::span<const uint8_t> data) {
+            EXPECT_EQ(3 * 512, data.size());
+            EXPECT_EQ(0x5a, data.back());
+            return data.size();
+        });
+
+    Call(0x0303, 0x0110, 0x0100, 0x2000, 0x0000);
+    EXPECT_TRUE(diskServices.Handle(state));
+    VerifyReturned(0x0003);
+}
+
+TEST_F(DiskServicesTest, VerifyDoesNotTransfer)
+{
+    Boot();
+    EXPECT_CALL(imageProvider, Read(_, _, _)).Times(0);
+    Call(0x0401, 0x0001, 0x0080, 0x0000, 0x0000);
+    EXPECT_TRUE(diskServices.Handle(state));
+    VerifyReturned(0x0001);
+}
+
+TEST_F(DiskServicesTest, RequestsTheBiosWouldFailAreLeftToIt)
+{
+    Boot();
+    EXPECT_CALL(imageProvider, Read(_, _, _)).Times(0);
+
+    // get drive parameters
+    Call(0x0800, 0x0000, 0x0080, 0x0000, 0x0000);
+    EXPECT_FALSE(diskServices.Handle(state));
+    VerifyNotHandled();
+
+    // sector beyond the end of the track
+    Call(0x0202, 0x0012, 0x0000, 0x1000, 0x0000);
+    EXPECT_FALSE(diskServices.Handle(state));
+    VerifyNotHandled();
+
+    // floppy DMA crossing a 64KB boundary
+    Call(0x0202, 0x0001, 0x0000, 0x1000, 0xfe00);
+    EXPECT_FALSE(diskServices.Handle(state));
+    VerifyNotHandled();
+
+    // hard disk not known to the BIOS
+    Call(0x0201, 0x0001, 0x0081, 0x1000, 0x0000);
+    EXPECT_FALSE(diskServices.Handle(state));
+    VerifyNotHandled();
+}
+
+TEST_F(DiskServicesTest, DiskChangeIsLeftToTheBios)
+{
+    Boot();
+    diskServices.NotifyImageChanged();
+
+    Call(0x0201, 0x0001, 0x0000, 0x1000, 0x0000);
+    EXPECT_FALSE(diskServices.Handle(state));
+    VerifyNotHandled();
+
+    EXPECT_CALL(imageProvider, Read(Image::Floppy0, 0, _))
+        .WillOnce([](auto, auto, std::span<uint8_t> data) { return data.size(); });
+    Call(0x0201, 0x0001, 0x0000, 0x1000, 0x0000);
+    EXPECT_TRUE(diskServices.Handle(state));
+    VerifyReturned(0x0001);
+}
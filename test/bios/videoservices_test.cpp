@@ -0,0 +1,192 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "interface/iointerface.h"
+#include "interface/textdisplayinterface.h"
+#include "bios/videoservices.h"
+#include "bus/memory.h"
+#include "cpu/state.h"
+#include <array>
+#include <vector>
+
+using ::testing::Sequence;
+using ::testing::_;
+
+namespace
+{
+    constexpr inline uint16_t HandlerSegment = 0xc000;
+    constexpr inline uint16_t HandlerOffset = 0x0100;
+    constexpr inline uint16_t CallerSegment = 0x0070;
+    constexpr inline uint16_t CallerOffset = 0x0100;
+    constexpr inline uint16_t CallerFlags = 0xf203;
+    constexpr inline uint16_t StackSegment = 0x0030;
+    constexpr inline uint16_t StackPointer = 0x00fa;
+
+    struct IOMock : IOInterface
+    {
+        MOCK_METHOD(void, AddPeripheral, (io_port base, uint16_t length, IOPeripheral& peripheral), (override));
+        MOCK_METHOD(void, Out8, (io_port port, uint8_t val), (override));
+        MOCK_METHOD(void, Out16, (io_port port, uint16_t val), (override));
+        MOCK_METHOD(uint8_t, In8, (io_port port), (override));
+        MOCK_METHOD(uint16_t, In16, (io_port port), (override));
+    };
+
+    struct TextDisplay : TextDisplayInterface
+    {
+        std::array<uint8_t, 4096> text{};
+        std::vector<std::pair<size_t, size_t>> invalidated;
+
+        std::span<uint8_t> GetTextMemory() override { return text; }
+        void InvalidateText(size_t offset, size_t length) override { invalidated.emplace_back(offset, length); }
+
+        uint8_t Char(unsigned int column, unsigned int row) const { return text[(row * 80 + column) * 2 + 0]; }
+        uint8_t Attr(unsigned int column, unsigned int row) const { return text[(row * 80 + column) * 2 + 1]; }
+    };
+
+    struct VideoServicesTest : ::testing::Test
+    {
+        Memory memory;
+        testing::NiceMock<IOMock> io;
+        TextDisplay display;
+        VideoServices videoServices{ memory, io, display };
+        cpu::State state{};
+
+        VideoServicesTest()
+        {
+            memory.WriteWord(0x10 * 4 + 0, HandlerOffset);
+            memory.WriteWord(0x10 * 4 + 2, HandlerSegment);
+            memory.WriteByte(0x449, 3); // 80x25 color
+            memory.WriteWord(0x44a, 80);
+            memory.WriteWord(0x463, 0x3d4);
+
+            state.m_cs = 0;
+            state.m_ip = 0x7c00;
+            EXPECT_FALSE(videoServices.Handle(state));
+
+            for (size_t n = 0; n < display.text.size(); n += 2) {
+                display.text[n + 0] = 'a' + (n / 160) % 26;
+                display.text[n + 1] = 0x07;
+            }
+        }
+
+        void SetCursor(uint8_t column, uint8_t row)
+        {
+            memory.WriteByte(0x450, column);
+            memory.WriteByte(0x451, row);
+        }
+
+        bool Call(uint16_t ax, uint16_t bx, uint16_t cx, uint16_t dx)
+        {
+            state.m_ax = ax; state.m_bx = bx; state.m_cx = cx; state.m_dx = dx;
+            state.m_ss = StackSegment;
+            state.m_sp = StackPointer;
+            const auto stack = (StackSegment << 4) + StackPointer;
+            memory.WriteWord(stack + 0, CallerOffset);
+            memory.WriteWord(stack + 2, CallerSegment);
+            memory.WriteWord(stack + 4, CallerFlags);
+            state.m_cs = HandlerSegment;
+            state.m_ip = HandlerOffset;
+            if (!videoServices.Handle(state))
+                return false;
+
+            EXPECT_EQ(ax, state.m_ax);
+            EXPECT_EQ(CallerSegment, state.m_cs);
+            EXPECT_EQ(CallerOffset, state.m_ip);
+            EXPECT_EQ(CallerFlags, state.m_flags);
+            EXPECT_EQ(StackPointer + 6, state.m_sp);
+            return true;
+        }
+    };
+}
+
+TEST_F(VideoServicesTest, SetCursorPositionUpdatesBDAAndCRTC)
+{
+    Sequence s;
+    const uint16_t location = 12 * 80 + 34;
+    EXPECT_CALL(io, Out8(0x3d4, 0x0e)).InSequence(s);
+    EXPECT_CALL(io, Out8(0x3d5, location >> 8)).InSequence(s);
+    EXPECT_CALL(io, Out8(0x3d4, 0x0f)).InSequence(s);
+    EXPECT_CALL(io, Out8(0x3d5, location & 0xff)).InSequence(s);
+
+    EXPECT_TRUE(Call(0x0200, 0x0000, 0x0000, 0x0c22));
+    EXPECT_EQ(34, memory.ReadByte(0x450));
+    EXPECT_EQ(12, memory.ReadByte(0x451));
+}
+
+TEST_F(VideoServicesTest, TeletypeWritesAtCursor)
+{
+    SetCursor(10, 5);
+    EXPECT_TRUE(Call(0x0e41, 0x0000, 0x0000, 0x0000));
+    EXPECT_EQ('A', display.Char(10, 5));
+    EXPECT_EQ(0x07, display.Attr(10, 5));
+    EXPECT_EQ(11, memory.ReadByte(0x450));
+    EXPECT_EQ(5, memory.ReadByte(0x451));
+    EXPECT_FALSE(display.invalidated.empty());
+
+    EXPECT_TRUE(Call(0x0e0d, 0x0000, 0x0000, 0x0000));
+    EXPECT_EQ(0, memory.ReadByte(0x450));
+    EXPECT_TRUE(Call(0x0e0a, 0x0000, 0x0000, 0x0000));
+    EXPECT_EQ(6, memory.ReadByte(0x451));
+    EXPECT_TRUE(Call(0x0e08, 0x0000, 0x0000, 0x0000));
+    EXPECT_EQ(0, memory.ReadByte(0x450));
+}
+
+TEST_F(VideoServicesTest, TeletypeScrollsAtBottom)
+{
+    display.text[(24 * 80 + 79) * 2 + 1] = 0x1e;
+    SetCursor(79, 24);
+    EXPECT_TRUE(Call(0x0e5a, 0x0000, 0x0000, 0x0000));
+
+    // The last row moved up, the new one uses the attribute found at the cursor
+    EXPECT_EQ('b', display.Char(0, 0));
+    EXPECT_EQ('Z', display.Char(79, 23));
+    EXPECT_EQ(' ', display.Char(0, 24));
+    EXPECT_EQ(0x07, display.Attr(0, 24));
+    EXPECT_EQ(0, memory.ReadByte(0x450));
+    EXPECT_EQ(24, memory.ReadByte(0x451));
+}
+
+TEST_F(VideoServicesTest, ScrollWindow)
+{
+    // rows 2-5, columns 10-19
+    EXPECT_TRUE(Call(0x0602, 0x4f00, 0x020a, 0x0513));
+    EXPECT_EQ('e', display.Char(10, 2));
+    EXPECT_EQ('f', display.Char(19, 3));
+    EXPECT_EQ(' ', display.Char(10, 4));
+    EXPECT_EQ(0x4f, display.Attr(19, 5));
+    EXPECT_EQ('c', display.Char(9, 2));
+    EXPECT_EQ('c', display.Char(20, 2));
+
+    EXPECT_TRUE(Call(0x0701, 0x1f00, 0x020a, 0x0513));
+    EXPECT_EQ(' ', display.Char(10, 2));
+    EXPECT_EQ(0x1f, display.Attr(10, 2));
+    EXPECT_EQ('e', display.Char(10, 3));
+
+    // AL = 0 clears the window
+    EXPECT_TRUE(Call(0x0600, 0x0700, 0x0000, 0x184f));
+    EXPECT_EQ(' ', display.Char(79, 24));
+}
+
+TEST_F(VideoServicesTest, WriteCharacterAndAttributeRepeats)
+{
+    SetCursor(78, 3);
+    EXPECT_TRUE(Call(0x0958, 0x0071, 0x0004, 0x0000));
+    EXPECT_EQ('X', display.Char(78, 3));
+    EXPECT_EQ('X', display.Char(1, 4));
+    EXPECT_EQ(0x71, display.Attr(1, 4));
+    EXPECT_EQ('e', display.Char(2, 4));
+    // The cursor does not move
+    EXPECT_EQ(78, memory.ReadByte(0x450));
+}
+
+TEST_F(VideoServicesTest, OtherRequestsAreLeftToTheBios)
+{
+    // bell
+    EXPECT_FALSE(Call(0x0e07, 0x0000, 0x0000, 0x0000));
+    // other page
+    EXPECT_FALSE(Call(0x0e41, 0x0100, 0x0000, 0x0000));
+    // set video mode
+    EXPECT_FALSE(Call(0x0003, 0x0000, 0x0000, 0x0000));
+    // graphics mode
+    memory.WriteByte(0x449, 0x13);
+    EXPECT_FALSE(Call(0x0e41, 0x0000, 0x0000, 0x0000));
+}
@@ -92,4 +92,23 @@ TEST_F(IOTest, PeripheralIoRangeIsCorrect)
     io.Out16(testPeriphalBase + testPeriphalSize, 0xffff);
 }
 
-// TODO: Reconsider 16-bit I/O access (does that even exist on x86 hardware?)
\ No newline at end of file
+// TODO: Reconsider 16-bit I/O access (does that even exist on x86 hardware?)
+TEST_F(IOTest, BlockTransfersDefaultToSingleAccesses)
+{
+    MockPeripheral peripheral;
+    io.AddPeripheral(testPeriphalBase, testPeriphalSize, peripheral);
+
+    EXPECT_CALL(peripheral, In16(testPeriphalBase))
+        .Times(2)
+        .WillOnce(Return(0x1234))
+        .WillOnce(Return(0x5678));
+    EXPECT_CALL(peripheral, Out8(testPeriphalBase, 0x99))
+        .Times(3);
+
+    std::array<uint8_t, 4> data;
+    io.InBlock16(testPeriphalBase, data);
+    EXPECT_EQ((std::array<uint8_t, 4>{ 0x34, 0x12, 0x78, 0x56 }), data);
+
+    const std::array<uint8_t, 3> out{ 0x99, 0x99, 0x99 };
+    io.OutBlock8(testPeriphalBase, out);
+}
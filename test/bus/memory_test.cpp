@@ -1,6 +1,7 @@
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 #include "bus/memory.h"
+#include "interface/stateinterface.h"
 #include <random>
 
 using ::testing::Return;
@@ -20,6 +21,31 @@ namespace
         MOCK_METHOD(void, WriteWord, (memory::Address addr, uint16_t data), (override));
     };
 
+    struct VectorStateWriter : StateWriter
+    {
+        std::vector<uint8_t> data;
+
+        void WriteBytes(std::span<const uint8_t> bytes) override
+        {
+            data.insert(data.end(), bytes.begin(), bytes.end());
+        }
+    };
+
+    struct VectorStateReader : StateReader
+    {
+        const std::vector<uint8_t>& data;
+        size_t offset = 0;
+
+        VectorStateReader(const std::vector<uint8_t>& data) : data(data) { }
+
+        void ReadBytes(std::span<uint8_t> bytes) override
+        {
+            ASSERT_LE(offset + bytes.size(), data.size());
+            std::copy(data.begin() + offset, data.begin() + offset + bytes.size(), bytes.begin());
+            offset += bytes.size();
+        }
+    };
+
     struct MemoryTest : ::testing::Test
     {
         Memory memory;
@@ -184,4 +210,90 @@ TEST_F(MemoryTest, DISABLED_PeriphalMemoryPartialBoundaryAccess)
         .Times(0);
 
     EXPECT_EQ(0, memory.ReadWord(testPeriphalBase - 1));
-}
\ No newline at end of file
+}
+
+TEST_F(MemoryTest, StateCanBeSavedAndRestored)
+{
+    memory.WriteWord(0x1234, 0xbeef);
+    memory.WriteByte(memorySize - 1, 0x42);
+
+    VectorStateWriter writer;
+    memory.SaveState(writer);
+    EXPECT_EQ(memorySize, writer.data.size());
+
+    Memory memory2;
+    VectorStateReader reader(writer.data);
+    memory2.LoadState(reader);
+    EXPECT_EQ(0xbeef, memory2.ReadWord(0x1234));
+    EXPECT_EQ(0x42, memory2.ReadByte(memorySize - 1));
+}
+
+TEST_F(MemoryTest, CheckpointCanBeRestored)
+{
+    memory.WriteWord(0x1234, 0xbeef);
+    const auto checkpoint = memory.CreateCheckpoint();
+    EXPECT_EQ(0xbeef, memory.ReadWord(0x1234));
+
+    memory.WriteWord(0x1234, 0xf00d);
+    memory.WriteByte(0x5678, 0x42);
+    memory.RestoreCheckpoint(*checkpoint);
+    EXPECT_EQ(0xbeef, memory.ReadWord(0x1234));
+    EXPECT_EQ(0, memory.ReadByte(0x5678));
+
+    memory.Reset();
+    EXPECT_EQ(0, memory.ReadWord(0x1234));
+}
+
+TEST_F(MemoryTest, ForksDoNotShareWrites)
+{
+    memory.WriteByte(0x1000, 0x11);
+    const auto checkpoint = memory.CreateCheckpoint();
+
+    Memory fork1, fork2;
+    fork1.RestoreCheckpoint(*checkpoint);
+    fork2.RestoreCheckpoint(*checkpoint);
+    fork1.WriteByte(0x1000, 0x22);
+    fork2.WriteByte(0x1000, 0x33);
+    memory.WriteByte(0x1000, 0x44);
+
+    EXPECT_EQ(0x22, fork1.ReadByte(0x1000));
+    EXPECT_EQ(0x33, fork2.ReadByte(0x1000));
+    EXPECT_EQ(0x44, memory.ReadByte(0x1000));
+
+    Memory fork3;
+    fork3.RestoreCheckpoint(*checkpoint);
+    EXPECT_EQ(0x11, fork3.ReadByte(0x1000));
+}
+
+TEST_F(MemoryTest, WrittenPagesAreReportedAsDirty)
+{
+    memory.CollectDirtyPages();
+    EXPECT_TRUE(memory.CollectDirtyPages().empty());
+
+    memory.WriteByte(0x3000, 1);
+    memory.WriteWord(0x5fff, 2);
+    memory.GetPointer(0x9000, 1);
+    const auto expected = std::vector<uint16_t>{ 0x3, 0x5, 0x6, 0x9 };
+    EXPECT_EQ(expected, memory.CollectDirtyPages());
+    EXPECT_TRUE(memory.CollectDirtyPages().empty());
+
+    memory.Reset();
+    EXPECT_EQ(Memory::s_page_count, memory.CollectDirtyPages().size());
+}
+
+TEST_F(MemoryTest, AddressesWrapAroundAt1MB)
+{
+    // FFFF:0020
+    memory.WriteByte(0x10'0010, 0x42);
+    EXPECT_EQ(0x42, memory.ReadByte(0x10));
+    EXPECT_EQ(0x42, memory.ReadByte(0x10'0010));
+
+    memory.CollectDirtyPages();
+    memory.WriteWord(memorySize - 1, 0xbeef);
+    EXPECT_EQ(0xef, memory.ReadByte(memorySize - 1));
+    EXPECT_EQ(0xbe, memory.ReadByte(0));
+    EXPECT_EQ(0xbeef, memory.ReadWord(memorySize - 1));
+
+    const auto expected = std::vector<uint16_t>{ 0x00, 0xff };
+    EXPECT_EQ(expected, memory.CollectDirtyPages());
+}
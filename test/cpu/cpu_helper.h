@@ -21,6 +21,10 @@ namespace cpu_helper
         MOCK_METHOD(void, Out16, (io_port port, uint16_t val), (override));
         MOCK_METHOD(uint8_t, In8, (io_port port), (override));
         MOCK_METHOD(uint16_t, In16, (io_port port), (override));
+        MOCK_METHOD(void, InBlock8, (io_port port, std::span<uint8_t> data), (override));
+        MOCK_METHOD(void, InBlock16, (io_port port, std::span<uint8_t> data), (override));
+        MOCK_METHOD(void, OutBlock8, (io_port port, std::span<const uint8_t> data), (override));
+        MOCK_METHOD(void, OutBlock16, (io_port port, std::span<const uint8_t> data), (override));
     };
 
     class MemoryMock : public MemoryInterface
@@ -91,6 +95,7 @@ namespace cpu_helper
         auto& AX(const uint16_t value) { State().m_ax = value; return *this; }
         auto& CX(const uint16_t value) { State().m_cx = value; return *this; }
         auto& DI(const uint16_t value) { State().m_di = value; return *this; }
+        auto& DX(const uint16_t value) { State().m_dx = value; return *this; }
         auto& SI(const uint16_t value) { State().m_si = value; return *this; }
 
         auto& ES(const uint16_t value) { State().m_es = value; return *this; }
@@ -99,6 +104,7 @@ namespace cpu_helper
         auto& VerifyAX(const uint16_t value) { EXPECT_EQ(State().m_ax, value); return *this; }
         auto& VerifySI(const uint16_t value) { EXPECT_EQ(State().m_si, value); return *this; }
         auto& VerifyDI(const uint16_t value) { EXPECT_EQ(State().m_di, value); return *this; }
+        auto& VerifyCX(const uint16_t value) { EXPECT_EQ(State().m_cx, value); return *this; }
         auto& VerifyZF(const bool zf) { EXPECT_EQ(cpu::FlagZero(State().m_flags), zf); return *this; }
 
         auto& ExpectReadByte(memory::Address addr) {
@@ -0,0 +1,72 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "cpu_helper.h"
+#include "cpu/statistics.h"
+
+#include <sstream>
+
+namespace
+{
+    struct Statistics : cpu_helper::Test
+    {
+        const cpu::Statistics& Get() { return cpu.GetStatistics(); }
+    };
+}
+
+TEST_F(Statistics, AreCompiledIn)
+{
+    EXPECT_TRUE(cpu::collectStatistics);
+}
+
+TEST_F(Statistics, CountOpcodesPrefixesAndOperands)
+{
+    th
+        .ES(0x1000)
+        .Execute({{
+            0x01, 0xd8,         // add ax,bx
+            0x26, 0x8b, 0x07,   // mov ax,es:[bx]
+            0x8b, 0x47, 0x12,   // mov ax,[bx+0x12]
+            0x40,               // inc ax
+        }});
+
+    EXPECT_EQ(1, Get().opcodes[0x01]);
+    EXPECT_EQ(2, Get().opcodes[0x8b]);
+    EXPECT_EQ(1, Get().opcodes[0x40]);
+    EXPECT_EQ(0, Get().opcodes[0x26]);
+    EXPECT_EQ(1, Get().prefixes[0x26]);
+
+    EXPECT_EQ(1, Get().modRm[3 * 8 + 0]);
+    EXPECT_EQ(1, Get().modRm[0 * 8 + 7]);
+    EXPECT_EQ(1, Get().modRm[1 * 8 + 7]);
+}
+
+TEST_F(Statistics, CountRepIterations)
+{
+    th
+        .ES(0x1000)
+        .DI(0x0100)
+        .CX(5)
+        .Execute({{
+            0xf3, 0xaa          // rep stosb
+        }})
+        .VerifyCX(0);
+
+    EXPECT_EQ(1, Get().prefixes[0xf3]);
+    EXPECT_EQ(1, Get().repInstructions[3]); // 4-7
+    EXPECT_EQ(5, Get().repIterations);
+}
+
+TEST_F(Statistics, Dump)
+{
+    th.Execute({{
+        0x01, 0xd8,             // add ax,bx
+        0xf3, 0xaa              // rep stosb
+    }});
+
+    std::ostringstream os;
+    cpu::DumpStatistics(os, Get());
+    EXPECT_THAT(os.str(), ::testing::HasSubstr("2 instructions"));
+    EXPECT_THAT(os.str(), ::testing::HasSubstr("repz"));
+    EXPECT_THAT(os.str(), ::testing::HasSubstr("1 register (100.00%)"));
+    EXPECT_THAT(os.str(), ::testing::HasSubstr("REP: 1 instructions, 0 iterations"));
+}
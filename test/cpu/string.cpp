@@ -2,6 +2,8 @@
 #include "gmock/gmock.h"
 #include "cpu_helper.h"
 
+using ::testing::Return;
+
 namespace
 {
     struct String : cpu_helper::Test
@@ -242,4 +244,92 @@ TEST_F(String, SCASB_Mismatches)
                 .VerifyZF(false);
         } }
     }});
-}
\ No newline at end of file
+}
+TEST_F(String, REP_INSB_UsesBlockTransfer)
+{
+    std::array<uint8_t, 4> buffer{};
+    EXPECT_CALL(memory, GetPointer(0x12340, 4))
+        .WillOnce(Return(buffer.data()));
+    EXPECT_CALL(io, InBlock8(0x300, ::testing::_))
+        .WillOnce([](io_port, std::span<uint8_t> data) {
+            EXPECT_EQ(4, data.size());
+            std::fill(data.begin(), data.end(), 0x5a);
+        });
+
+    th
+        .ES(0x1234)
+        .DI(0x0)
+        .CX(4)
+        .DX(0x300)
+        .Execute({{
+            0xf3, 0x6c          // rep insb
+        }})
+        .VerifyDI(0x0004)
+        .VerifyCX(0);
+    EXPECT_EQ(0x5a, buffer[3]);
+}
+
+TEST_F(String, REP_INSW_FallsBackToSingleTransfers)
+{
+    // No pointer to memory is available, as is the case for peripherals
+    EXPECT_CALL(io, In16(0x300))
+        .Times(2)
+        .WillOnce(Return(0x1234))
+        .WillOnce(Return(0x5678));
+
+    th
+        .ExpectWriteWord(0x12340, 0x1234)
+        .ExpectWriteWord(0x12342, 0x5678)
+        .ES(0x1234)
+        .DI(0x0)
+        .CX(2)
+        .DX(0x300)
+        .Execute({{
+            0xf3, 0x6d          // rep insw
+        }})
+        .VerifyDI(0x0004)
+        .VerifyCX(0);
+}
+
+TEST_F(String, OUTSB)
+{
+    EXPECT_CALL(io, Out8(0x300, 0x42));
+
+    RunTests([](auto& th) {
+        th
+            .ExpectReadByte(cpu_helper::initialIp)
+            .ExpectReadByte(0x1234a, 0x42)
+            .DS(0x1234)
+            .SI(0xa)
+            .DX(0x300);
+    }, {{
+        0x6e                // outsb
+    }}, {{
+        { [](auto& th) { }, [](auto& th) {
+            th.VerifySI(0x000b);
+        } },
+    }});
+}
+
+TEST_F(String, REP_OUTSW_UsesBlockTransfer)
+{
+    std::array<uint8_t, 6> buffer{ 1, 2, 3, 4, 5, 6 };
+    EXPECT_CALL(memory, GetPointer(0x20010, 6))
+        .WillOnce(Return(buffer.data()));
+    EXPECT_CALL(io, OutBlock16(0x300, ::testing::_))
+        .WillOnce([](io_port, std::span<const uint8_t> data) {
+            EXPECT_EQ(6, data.size());
+            EXPECT_EQ(6, data[5]);
+        });
+
+    th
+        .DS(0x2000)
+        .SI(0x10)
+        .CX(3)
+        .DX(0x300)
+        .Execute({{
+            0xf3, 0x6f          // rep outsw
+        }})
+        .VerifySI(0x0016)
+        .VerifyCX(0);
+}
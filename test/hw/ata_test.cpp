@@ -5,6 +5,7 @@
 #include "interface/imageprovider.h"
 #include "hw/ata.h"
 #include "bus/io.h"
+#include "state_helper.h"
 
 using ::testing::Return;
 using ::testing::Sequence;
@@ -42,6 +43,29 @@ namespace
         MOCK_METHOD(size_t, Write, (const Image image, uint64_t offset, std::span<const uint8_t> data), (override));
     };
 
+    // Completes once the test says so
+    struct PendingImageRequest : ImageRequest
+    {
+        const bool& completed;
+        const size_t result;
+
+        PendingImageRequest(const bool& completed, size_t result) : completed(completed), result(result) { }
+
+        std::optional<size_t> Poll() override
+        {
+            if (!completed) return {};
+            return result;
+        }
+
+        size_t Wait() override { return result; }
+    };
+
+    struct MockAsyncImageProvider : MockImageProvider
+    {
+        MOCK_METHOD(std::unique_ptr<ImageRequest>, ReadAsync, (const Image image, uint64_t offset, std::span<uint8_t> data), (override));
+        MOCK_METHOD(std::unique_ptr<ImageRequest>, WriteAsync, (const Image image, uint64_t offset, std::span<const uint8_t> data), (override));
+    };
+
     struct ATATest : ::testing::Test
     {
         IO io;
@@ -157,6 +181,74 @@ TEST_F(ATATest, Identify)
     EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
 }
 
+TEST_F(ATATest, IdentifyReportsCylindersOfSmallImage)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(10 * 1024 * 1024));
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::DevControl, 0xec); // identify
+
+    // Only the complete cylinders of 6 heads and 17 sectors
+    const auto data = ReadSector(io);
+    EXPECT_EQ(200, DecodeAsU16(&data[2])); // cylinders
+    EXPECT_EQ(6, DecodeAsU16(&data[6])); // heads
+    EXPECT_EQ(17, DecodeAsU16(&data[12])); // sectors per track
+}
+
+TEST_F(ATATest, IdentifyReportsGeometryAndCapacityOfLargeImage)
+{
+    constexpr Bytes imageSize = 512 * 1024 * 1024;
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(imageSize));
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::DevControl, 0xec); // identify
+
+    const auto data = ReadSector(io);
+    EXPECT_EQ(1040, DecodeAsU16(&data[2])); // cylinders
+    EXPECT_EQ(16, DecodeAsU16(&data[6])); // heads
+    EXPECT_EQ(63, DecodeAsU16(&data[12])); // sectors per track
+    EXPECT_NE(0, DecodeAsU16(&data[98]) & (1 << 9)); // LBA supported
+    const auto sectors = DecodeAsU16(&data[120]) | (DecodeAsU16(&data[122]) << 16);
+    EXPECT_EQ(imageSize / 512, sectors); // total addressable sectors
+}
+
+TEST_F(ATATest, ReadSectorsUsesLBAAddressing)
+{
+    constexpr uint32_t lba = 0x1234567;
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(16ull * 1024 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, Read(Image::Harddisk0, lba * 512ull, _))
+        .Times(1)
+        .WillOnce(Return(512));
+
+    io.Out8(io::DriveHead, 0xe0 | (lba >> 24));
+    io.Out8(io::SectorCount, 1);
+    io.Out8(io::CylinderHigh, (lba >> 16) & 0xff);
+    io.Out8(io::CylinderLow, (lba >> 8) & 0xff);
+    io.Out8(io::SectorNumber, lba & 0xff);
+    io.Out8(io::DevControl, 0x20); // read sectors
+    EXPECT_EQ(0b1001000, io.In8(io::AltStatus)); // READY, DATA REQ
+}
+
+TEST_F(ATATest, ReadSectorsBeyondEndOfDiskFails)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(1024 * 1024));
+    EXPECT_CALL(imageProvider, Read(_, _, _))
+        .Times(0);
+
+    io.Out8(io::DriveHead, 0xe0);
+    io.Out8(io::SectorCount, 2);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0x07);
+    io.Out8(io::SectorNumber, 0xff);
+    io.Out8(io::DevControl, 0x20); // read sectors
+    EXPECT_EQ(0b1000001, io.In8(io::AltStatus)); // READY, ERROR
+    EXPECT_EQ(0b10000, io.In8(io::Error_Read)); // ID NOT FOUND
+}
+
 TEST_F(ATATest, ReadSectorsReadsOneSector)
 {
     EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
@@ -257,4 +349,228 @@ TEST_F(ATATest, WriteSectorsWritesMultipleSectors)
         WriteSector(io, data);
     }
     EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
-}
\ No newline at end of file
+}
+
+TEST_F(ATATest, TransferContinuesAfterRestoringState)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, Read(Image::Harddisk0, 0, _))
+        .WillOnce([](auto, auto, std::span<uint8_t> data) {
+            for (size_t n = 0; n < data.size(); ++n)
+                data[n] = n & 0xff;
+            return data.size();
+        });
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 1);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0x20); // read sectors
+    EXPECT_EQ(0x00, io.In8(io::Data));
+    EXPECT_EQ(0x01, io.In8(io::Data));
+
+    state_helper::Writer writer;
+    ata.SaveState(writer);
+    ata.Reset();
+
+    state_helper::Reader reader(writer.data);
+    ata.LoadState(reader);
+    EXPECT_TRUE(reader.AtEnd());
+    EXPECT_EQ(0b1001000, io.In8(io::AltStatus)); // READY, DATA REQ
+    EXPECT_EQ(0x02, io.In8(io::Data));
+}
+
+TEST(ATAAsyncTest, DeviceIsBusyUntilReadCompletes)
+{
+    IO io;
+    MockAsyncImageProvider imageProvider;
+    ATA ata(io, imageProvider);
+
+    bool completed = false;
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, ReadAsync(Image::Harddisk0, 0, _))
+        .WillOnce([&](auto, auto, std::span<uint8_t> data) {
+            std::fill(data.begin(), data.end(), 0x42);
+            return std::make_unique<PendingImageRequest>(completed, data.size());
+        });
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 1);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0x20); // read sectors
+    EXPECT_EQ(0b10000000, io.In8(io::AltStatus)); // BUSY
+    EXPECT_EQ(0b10000000, io.In8(io::AltStatus)); // BUSY
+
+    completed = true;
+    EXPECT_EQ(0b1001000, io.In8(io::AltStatus)); // READY, DATA REQ
+    EXPECT_EQ(0x42, io.In8(io::Data));
+}
+
+TEST(ATAAsyncTest, DeviceIsBusyUntilWriteCompletes)
+{
+    IO io;
+    MockAsyncImageProvider imageProvider;
+    ATA ata(io, imageProvider);
+
+    bool completed = false;
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, WriteAsync(Image::Harddisk0, 0, _))
+        .WillOnce([&](auto, auto, std::span<const uint8_t> data) {
+            return std::make_unique<PendingImageRequest>(completed, data.size());
+        });
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 1);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0x30); // write sectors
+
+    SectorData data{};
+    WriteSector(io, data);
+    EXPECT_EQ(0b10000000, io.In8(io::AltStatus)); // BUSY
+
+    completed = true;
+    EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
+}
+
+TEST_F(ATATest, ReadMultipleTransfersBlocks)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+
+    Sequence s;
+    for(int n = 0; n < 2; ++n) {
+        EXPECT_CALL(imageProvider, Read(Image::Harddisk0, n * 4 * 512, _))
+            .Times(1)
+            .InSequence(s)
+            .WillOnce([](auto, auto, std::span<uint8_t> data) {
+                EXPECT_EQ(4 * 512, data.size());
+                return data.size();
+            });
+    }
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 4);
+    io.Out8(io::DevControl, 0xc6); // set multiple mode
+    EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
+
+    io.Out8(io::SectorCount, 8);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0xc4); // read multiple
+    for(int n = 0; n < 2; ++n) {
+        EXPECT_EQ(0b1001000, io.In8(io::AltStatus)); // READY, DATA REQ
+        for(int sector = 0; sector < 4; ++sector)
+            ReadSector(io);
+    }
+    EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
+}
+
+TEST_F(ATATest, WriteMultipleTransfersPartialLastBlock)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+
+    Sequence s;
+    EXPECT_CALL(imageProvider, Write(Image::Harddisk0, 0, _))
+        .Times(1)
+        .InSequence(s)
+        .WillOnce([](auto, auto, std::span<const uint8_t> data) {
+            EXPECT_EQ(2 * 512, data.size());
+            return data.size();
+        });
+    EXPECT_CALL(imageProvider, Write(Image::Harddisk0, 2 * 512, _))
+        .Times(1)
+        .InSequence(s)
+        .WillOnce([](auto, auto, std::span<const uint8_t> data) {
+            EXPECT_EQ(512, data.size());
+            return data.size();
+        });
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 2);
+    io.Out8(io::DevControl, 0xc6); // set multiple mode
+
+    io.Out8(io::SectorCount, 3);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0xc5); // write multiple
+    for(int n = 0; n < 3; ++n) {
+        EXPECT_EQ(0b1001000, io.In8(io::AltStatus)); // READY, DATA REQ
+        SectorData data{};
+        WriteSector(io, data);
+    }
+    EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
+}
+
+TEST_F(ATATest, ReadMultipleWithoutMultipleModeIsAborted)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, Read(_, _, _))
+        .Times(0);
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 1);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0xc4); // read multiple
+    EXPECT_EQ(0b1000001, io.In8(io::AltStatus)); // READY, ERROR
+    EXPECT_EQ(0b1000, io.In8(io::Error_Read)); // ABORTED
+}
+
+TEST_F(ATATest, BlockReadCrossesSectors)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, Read(Image::Harddisk0, _, _))
+        .Times(2)
+        .WillRepeatedly([](auto, uint64_t offset, std::span<uint8_t> data) {
+            std::fill(data.begin(), data.end(), offset / 512 + 1);
+            return data.size();
+        });
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 2);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0x20); // read sectors
+
+    std::array<uint8_t, 1024> data;
+    io.InBlock16(io::Data, data);
+    EXPECT_EQ(1, data[511]);
+    EXPECT_EQ(2, data[512]);
+    EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
+}
+
+TEST_F(ATATest, BlockWriteWritesSector)
+{
+    EXPECT_CALL(imageProvider, GetSize(Image::Harddisk0))
+        .WillRepeatedly(Return(31 * 1024 * 1024));
+    EXPECT_CALL(imageProvider, Write(Image::Harddisk0, 0, _))
+        .WillOnce([](auto, auto, std::span<const uint8_t> data) {
+            EXPECT_EQ(0x33, data[100]);
+            return data.size();
+        });
+
+    io.Out8(io::DriveHead, 0xa0);
+    io.Out8(io::SectorCount, 1);
+    io.Out8(io::CylinderHigh, 0);
+    io.Out8(io::CylinderLow, 0);
+    io.Out8(io::SectorNumber, 1);
+    io.Out8(io::DevControl, 0x30); // write sectors
+
+    SectorData data;
+    data.fill(0x33);
+    io.OutBlock8(io::Data, data);
+    EXPECT_EQ(0b1000000, io.In8(io::AltStatus)); // READY
+}
@@ -79,4 +79,181 @@ TEST_F(DMATest, PeripheralToMemoryTransfersTheCorrectData)
     EXPECT_EQ(dummy_data.size(), length);
 }
 
-// TODO We need to more tests to verify the status bits etc
\ No newline at end of file
+// TODO We need to more tests to verify the status bits etc
+TEST_F(DMATest, MemoryToPeripheralTransfersTheCorrectData)
+{
+    for(size_t n = 0; n < dummy_data.size(); ++n) {
+        EXPECT_CALL(memory, ReadByte(dmaAddress + n))
+            .WillOnce(::testing::Return(dummy_data[n]));
+    }
+
+    SetupDMATransfer(io);
+    io.Out8(0x0b, 0x4a); // mode: single, addr increment, read
+    auto xfer = dma.InitiateTransfer(2);
+
+    std::array<uint8_t, dmaCount> data{};
+    EXPECT_EQ(0, xfer->WriteFromPeripheral(0, data)); // wrong direction
+    EXPECT_EQ(data.size(), xfer->ReadToPeripheral(0, data));
+    EXPECT_EQ(dummy_data, data);
+}
+
+TEST_F(DMATest, MemoryIsProvidedForDirectAccess)
+{
+    std::array<uint8_t, dmaCount> ram{};
+    EXPECT_CALL(memory, GetPointer(dmaAddress + 4, 8))
+        .WillOnce(::testing::Return(&ram[4]));
+
+    SetupDMATransfer(io);
+    auto xfer = dma.InitiateTransfer(2);
+    const auto span = xfer->GetMemory(4, 8, true);
+    EXPECT_EQ(&ram[4], span.data());
+    EXPECT_EQ(8, span.size());
+
+    // Beyond the programmed count
+    EXPECT_TRUE(xfer->GetMemory(8, 9, true).empty());
+}
+
+TEST_F(DMATest, MemoryIsOnlyProvidedInTheProgrammedDirection)
+{
+    std::array<uint8_t, dmaCount> ram{};
+    EXPECT_CALL(memory, GetPointer(dmaAddress, dmaCount))
+        .WillOnce(::testing::Return(&ram[0]));
+
+    SetupDMATransfer(io);
+    io.Out8(0x0b, 0x4a); // mode: single, addr increment, read
+    auto xfer = dma.InitiateTransfer(2);
+    EXPECT_TRUE(xfer->GetMemory(0, dmaCount, true).empty());
+    EXPECT_EQ(&ram[0], xfer->GetMemory(0, dmaCount, false).data());
+}
+
+TEST_F(DMATest, MemoryIsNotProvidedForVerifyTransfer)
+{
+    EXPECT_CALL(memory, GetPointer(::testing::_, ::testing::_))
+        .Times(0);
+
+    SetupDMATransfer(io);
+    io.Out8(0x0b, 0x42); // mode: single, addr increment, verify
+    auto xfer = dma.InitiateTransfer(2);
+    EXPECT_TRUE(xfer->GetMemory(0, dmaCount, true).empty());
+    EXPECT_TRUE(xfer->GetMemory(0, dmaCount, false).empty());
+}
+
+TEST_F(DMATest, MemoryIsNotProvidedWhenChannelIsMasked)
+{
+    EXPECT_CALL(memory, GetPointer(::testing::_, ::testing::_))
+        .Times(0);
+
+    SetupDMATransfer(io);
+    io.Out8(0x0a, 0x06); // mask channel 2
+    auto xfer = dma.InitiateTransfer(2);
+    EXPECT_TRUE(xfer->GetMemory(0, dmaCount, true).empty());
+}
+
+TEST_F(DMATest, AllChannelsCanBeProgrammedAndReadBack)
+{
+    for(int ch = 0; ch < 4; ++ch) {
+        const uint16_t address = 0x1234 + ch;
+        const uint16_t count = 0x0567 + ch;
+        io.Out8(0x0c, 0xff); // reset master flip-flop
+        io.Out8(ch * 2, address & 0xff);
+        io.Out8(ch * 2, address >> 8);
+        io.Out8(ch * 2 + 1, count & 0xff);
+        io.Out8(ch * 2 + 1, count >> 8);
+
+        io.Out8(0x0c, 0xff); // reset master flip-flop
+        EXPECT_EQ(address & 0xff, io.In8(ch * 2));
+        EXPECT_EQ(address >> 8, io.In8(ch * 2));
+        EXPECT_EQ(count & 0xff, io.In8(ch * 2 + 1));
+        EXPECT_EQ(count >> 8, io.In8(ch * 2 + 1));
+    }
+}
+
+TEST_F(DMATest, DecrementModeTransfersDownwards)
+{
+    using ::testing::Sequence;
+
+    Sequence s;
+    for(size_t n = 0; n < 4; ++n) {
+        EXPECT_CALL(memory, WriteByte(dmaAddress - n, dummy_data[n]))
+            .InSequence(s);
+    }
+
+    SetupDMATransfer(io);
+    io.Out8(0x0b, 0x66); // mode: single, addr decrement, write
+    auto xfer = dma.InitiateTransfer(2);
+    EXPECT_EQ(4, xfer->WriteFromPeripheral(0, std::span{ dummy_data }.first(4)));
+}
+
+TEST_F(DMATest, StreamingStopsAtTerminalCount)
+{
+    using ::testing::_;
+    EXPECT_CALL(memory, WriteByte(_, _))
+        .Times(dmaCount);
+
+    SetupDMATransfer(io);
+    auto xfer = dma.InitiateTransfer(2);
+
+    std::array<uint8_t, 10> data{};
+    EXPECT_EQ(10, xfer->Push(data));
+    EXPECT_FALSE(xfer->ReachedTerminalCount());
+    EXPECT_EQ(0, io.In8(0x08) & 0b100); // status: no TC yet
+
+    EXPECT_EQ(dmaCount - 10, xfer->Push(data));
+    EXPECT_TRUE(xfer->ReachedTerminalCount());
+    EXPECT_EQ(0b100, io.In8(0x08) & 0b100); // status: TC on channel 2
+
+    // The channel is masked once the transfer has completed
+    EXPECT_EQ(0, xfer->Push(data));
+}
+
+TEST_F(DMATest, AutoInitRestartsTransfer)
+{
+    using ::testing::Sequence;
+
+    Sequence s;
+    for(size_t n = 0; n < dmaCount + 4; ++n) {
+        EXPECT_CALL(memory, ReadByte(dmaAddress + (n % dmaCount)))
+            .InSequence(s)
+            .WillOnce(::testing::Return(dummy_data[n % dmaCount]));
+    }
+
+    SetupDMATransfer(io);
+    io.Out8(0x0b, 0x5a); // mode: single, auto-init, addr increment, read
+    auto xfer = dma.InitiateTransfer(2);
+
+    std::array<uint8_t, dmaCount + 4> data{};
+    EXPECT_EQ(data.size(), xfer->Pull(data));
+    EXPECT_TRUE(xfer->ReachedTerminalCount());
+    EXPECT_EQ(dummy_data[3], data[dmaCount + 3]);
+
+    io.Out8(0x0c, 0xff); // reset master flip-flop
+    EXPECT_EQ((dmaAddress + 4) & 0xff, io.In8(0x04)); // current address
+    EXPECT_EQ(((dmaAddress + 4) >> 8) & 0xff, io.In8(0x04));
+}
+
+TEST_F(DMATest, AddressWrapsWithinPage)
+{
+    using ::testing::Sequence;
+
+    io.Out8(0x0a, 0x06); // mask channel 2
+    io.Out8(0x0b, 0x46); // mode: single, addr increment, write
+    io.Out8(0x0c, 0xff); // reset master flip-flop
+    io.Out8(0x04, 0xfe);
+    io.Out8(0x04, 0xff);
+    io.Out8(0x05, 3);
+    io.Out8(0x05, 0);
+    io.Out8(0x81, 0x02);
+    io.Out8(0x0a, 0x02); // unmask channel 2
+
+    Sequence s;
+    for (const memory::Address address : { 0x2fffe, 0x2ffff, 0x20000, 0x20001 }) {
+        EXPECT_CALL(memory, WriteByte(address, ::testing::_))
+            .InSequence(s);
+    }
+    EXPECT_CALL(memory, GetPointer(::testing::_, ::testing::_))
+        .Times(0);
+
+    auto xfer = dma.InitiateTransfer(2);
+    EXPECT_TRUE(xfer->GetMemory(0, 4, true).empty());
+    EXPECT_EQ(4, xfer->Push(std::span{ dummy_data }.first(4)));
+}
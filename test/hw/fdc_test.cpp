@@ -28,6 +28,11 @@ namespace
     struct MockDMATransfer : DMATransfer
     {
         MOCK_METHOD(size_t, WriteFromPeripheral, (uint16_t offset, std::span<const uint8_t> data), (override));
+        MOCK_METHOD(size_t, ReadToPeripheral, (uint16_t offset, std::span<uint8_t> data), (override));
+        MOCK_METHOD(std::span<uint8_t>, GetMemory, (uint16_t offset, size_t length, bool toMemory), (override));
+        MOCK_METHOD(size_t, Push, (std::span<const uint8_t> data), (override));
+        MOCK_METHOD(size_t, Pull, (std::span<uint8_t> data), (override));
+        MOCK_METHOD(bool, ReachedTerminalCount, (), (override));
         MOCK_METHOD(size_t, GetTotalLength, (), (override));
         MOCK_METHOD(void, Complete, (), (override));
     };
@@ -268,4 +273,245 @@ TEST_F(FDCTest, ReadDataTransfersData)
     EXPECT_EQ(0, n); // sector size (512)
 
     // TODO: We need to verify that the correct data was transferred!
-}
\ No newline at end of file
+}
+TEST_F(FDCTest, ReadDataTransfersDirectlyToMemory)
+{
+    using ::testing::Return;
+    using ::testing::_;
+    auto transfer = std::make_unique<MockDMATransfer>();
+    std::array<uint8_t, 1024> memory{};
+
+    EXPECT_CALL(*transfer, GetTotalLength())
+        .Times(1)
+        .WillOnce(Return(memory.size()));
+    EXPECT_CALL(*transfer, GetMemory(0, memory.size(), true))
+        .WillOnce(Return(std::span<uint8_t>{ memory }));
+    EXPECT_CALL(*transfer, WriteFromPeripheral(_, _))
+        .Times(0);
+    EXPECT_CALL(*transfer, Complete())
+        .Times(1);
+
+    EXPECT_CALL(dma, InitiateTransfer(2))
+        .Times(1)
+        .WillOnce(Return(std::move(transfer)));
+
+    EXPECT_CALL(pic, AssertIRQ(PICInterface::IRQ::FDC))
+        .Times(1);
+
+    EXPECT_CALL(imageProvider, Read(Image::Floppy0, 0, _))
+        .WillOnce([](auto, auto, std::span<uint8_t> data) {
+            std::fill(data.begin(), data.end(), 0xf6);
+            return data.size();
+        });
+
+    const auto [ st0, st1, st2, c, h, r, n ] = IssueReadData(io);
+    EXPECT_EQ(0b1100'0000, st0); // ic1/ic0
+    EXPECT_EQ(0, st1);
+    EXPECT_EQ(0xf6, memory[1023]);
+}
+
+TEST_F(FDCTest, MultiTrackReadContinuesOnSecondHead)
+{
+    using ::testing::Return;
+    using ::testing::_;
+    auto transfer = std::make_unique<MockDMATransfer>();
+
+    EXPECT_CALL(*transfer, GetTotalLength())
+        .WillOnce(Return(3 * 512));
+    EXPECT_CALL(*transfer, WriteFromPeripheral(0, _))
+        .WillOnce(Return(3 * 512));
+    EXPECT_CALL(*transfer, Complete());
+    EXPECT_CALL(dma, InitiateTransfer(2))
+        .WillOnce(Return(std::move(transfer)));
+    EXPECT_CALL(pic, AssertIRQ(PICInterface::IRQ::FDC));
+
+    // 720KB: 9 sectors per track; sector 9 of head 0 and 1-2 of head 1 are
+    // adjacent in the image
+    EXPECT_CALL(imageProvider, GetSize(Image::Floppy0))
+        .WillRepeatedly(Return(737280));
+    EXPECT_CALL(imageProvider, Read(Image::Floppy0, ((1 * 2 + 0) * 9 + 8) * 512, _))
+        .WillOnce([](auto, auto, std::span<uint8_t> data) {
+            EXPECT_EQ(3 * 512, data.size());
+            return data.size();
+        });
+
+    io.Out8(0x3f5, 0xc6); // command: read data, MT, MFM
+    io.Out8(0x3f5, 0x00); // hds/ds1/ds0
+    io.Out8(0x3f5, 0x01); // c
+    io.Out8(0x3f5, 0x00); // h
+    io.Out8(0x3f5, 0x09); // r (sector)
+    io.Out8(0x3f5, 0x02); // n
+    io.Out8(0x3f5, 0x09); // eot
+    io.Out8(0x3f5, 0x2a); // gpl
+    io.Out8(0x3f5, 0xff); // dtl
+    const auto [ st0, st1, st2, c, h, r, n ] = RetrieveExtendedStatus(io);
+    EXPECT_EQ(0b1100'0000, st0); // ic1/ic0
+    EXPECT_EQ(0, st1);
+}
+
+TEST_F(FDCTest, MultiTrackReadWithShortTrackContinuesOnSecondHead)
+{
+    using ::testing::Return;
+    using ::testing::_;
+    auto transfer = std::make_unique<MockDMATransfer>();
+    std::array<uint8_t, 4 * 512> memory{};
+
+    EXPECT_CALL(*transfer, GetTotalLength())
+        .WillOnce(Return(memory.size()));
+    EXPECT_CALL(*transfer, GetMemory(0, memory.size(), true))
+        .WillOnce(Return(std::span<uint8_t>{ memory }));
+    EXPECT_CALL(*transfer, Complete());
+    EXPECT_CALL(dma, InitiateTransfer(2))
+        .WillOnce(Return(std::move(transfer)));
+    EXPECT_CALL(pic, AssertIRQ(PICInterface::IRQ::FDC));
+
+    // Every byte holds the index of its sector in the 720KB image
+    EXPECT_CALL(imageProvider, GetSize(Image::Floppy0))
+        .WillRepeatedly(Return(737280));
+    EXPECT_CALL(imageProvider, Read(Image::Floppy0, _, _))
+        .Times(2)
+        .WillRepeatedly([](auto, uint64_t offset, std::span<uint8_t> data) {
+            for (size_t n = 0; n < data.size(); ++n)
+                data[n] = static_cast<uint8_t>((offset + n) / 512);
+            return data.size();
+        });
+
+    io.Out8(0x3f5, 0xc6); // command: read data, MT, MFM
+    io.Out8(0x3f5, 0x00); // hds/ds1/ds0
+    io.Out8(0x3f5, 0x01); // c
+    io.Out8(0x3f5, 0x00); // h
+    io.Out8(0x3f5, 0x07); // r (sector)
+    io.Out8(0x3f5, 0x02); // n
+    io.Out8(0x3f5, 0x08); // eot
+    io.Out8(0x3f5, 0x2a); // gpl
+    io.Out8(0x3f5, 0xff); // dtl
+    const auto [ st0, st1, st2, c, h, r, n ] = RetrieveExtendedStatus(io);
+    EXPECT_EQ(0, st1);
+
+    // Sectors 7-8 of head 0, then 1-2 of head 1; not 9 of head 0
+    constexpr std::array<uint8_t, 4> sectors{ (1 * 2 + 0) * 9 + 6, (1 * 2 + 0) * 9 + 7, (1 * 2 + 1) * 9 + 0, (1 * 2 + 1) * 9 + 1 };
+    for (size_t sector = 0; sector < sectors.size(); ++sector) {
+        EXPECT_EQ(sectors[sector], memory[sector * 512]);
+        EXPECT_EQ(sectors[sector], memory[sector * 512 + 511]);
+    }
+}
+
+TEST_F(FDCTest, MultiTrackReadOutsideTrackReportsNoData)
+{
+    using ::testing::Return;
+    using ::testing::_;
+
+    EXPECT_CALL(imageProvider, GetSize(Image::Floppy0))
+        .WillRepeatedly(Return(737280));
+    EXPECT_CALL(imageProvider, Read(_, _, _))
+        .Times(0);
+    EXPECT_CALL(pic, AssertIRQ(PICInterface::IRQ::FDC))
+        .Times(2);
+
+    // Sector 0 does not exist, and sector 10 is past the end of the track;
+    // neither may continue on head 1
+    for (const uint8_t sector : { 0x00, 0x0a }) {
+        auto transfer = std::make_unique<MockDMATransfer>();
+        EXPECT_CALL(*transfer, GetTotalLength())
+            .WillOnce(Return(512));
+        EXPECT_CALL(*transfer, WriteFromPeripheral(_, _))
+            .Times(0);
+        EXPECT_CALL(*transfer, Complete());
+        EXPECT_CALL(dma, InitiateTransfer(2))
+            .WillOnce(Return(std::move(transfer)));
+
+        io.Out8(0x3f5, 0xc6); // command: read data, MT, MFM
+        io.Out8(0x3f5, 0x00); // hds/ds1/ds0
+        io.Out8(0x3f5, 0x01); // c
+        io.Out8(0x3f5, 0x00); // h
+        io.Out8(0x3f5, sector); // r (sector)
+        io.Out8(0x3f5, 0x02); // n
+        io.Out8(0x3f5, 0x09); // eot
+        io.Out8(0x3f5, 0x2a); // gpl
+        io.Out8(0x3f5, 0xff); // dtl
+        const auto [ st0, st1, st2, c, h, r, n ] = RetrieveExtendedStatus(io);
+        EXPECT_EQ(0b0100'0000, st0); // ic0
+        EXPECT_EQ(0b100, st1); // ND
+    }
+}
+
+TEST_F(FDCTest, WriteDataWritesAllSectorsAtOnce)
+{
+    using ::testing::Return;
+    using ::testing::_;
+    auto transfer = std::make_unique<MockDMATransfer>();
+
+    EXPECT_CALL(*transfer, GetTotalLength())
+        .WillOnce(Return(2 * 512));
+    EXPECT_CALL(*transfer, ReadToPeripheral(0, _))
+        .WillOnce([](auto, std::span<uint8_t> data) {
+            std::fill(data.begin(), data.end(), 0x5a);
+            return data.size();
+        });
+    EXPECT_CALL(*transfer, Complete());
+    EXPECT_CALL(dma, InitiateTransfer(2))
+        .WillOnce(Return(std::move(transfer)));
+    EXPECT_CALL(pic, AssertIRQ(PICInterface::IRQ::FDC));
+
+    EXPECT_CALL(imageProvider, Write(Image::Floppy0, 2 * 512, _))
+        .WillOnce([](auto, auto, std::span<const uint8_t> data) {
+            EXPECT_EQ(2 * 512, data.size());
+            EXPECT_EQ(0x5a, data[1023]);
+            return data.size();
+        });
+
+    io.Out8(0x3f5, 0x45); // command: write data, MFM
+    io.Out8(0x3f5, 0x00); // hds/ds1/ds0
+    io.Out8(0x3f5, 0x00); // c
+    io.Out8(0x3f5, 0x00); // h
+    io.Out8(0x3f5, 0x03); // r (sector)
+    io.Out8(0x3f5, 0x02); // n
+    io.Out8(0x3f5, 0x12); // eot
+    io.Out8(0x3f5, 0x1b); // gpl
+    io.Out8(0x3f5, 0xff); // dtl
+    const auto [ st0, st1, st2, c, h, r, n ] = RetrieveExtendedStatus(io);
+    EXPECT_EQ(0b1100'0000, st0); // ic1/ic0
+    EXPECT_EQ(0, st1);
+}
+
+TEST_F(FDCTest, FormatTrackWritesWholeTrack)
+{
+    using ::testing::Return;
+    using ::testing::_;
+    auto transfer = std::make_unique<MockDMATransfer>();
+
+    constexpr uint8_t cylinder = 2;
+    constexpr uint8_t head = 1;
+    EXPECT_CALL(*transfer, ReadToPeripheral(0, _))
+        .WillOnce([](auto, std::span<uint8_t> data) {
+            EXPECT_EQ(18 * 4, data.size());
+            for (size_t n = 0; n < 18; ++n) {
+                data[n * 4 + 0] = cylinder;
+                data[n * 4 + 1] = head;
+                data[n * 4 + 2] = n + 1;
+                data[n * 4 + 3] = 2;
+            }
+            return data.size();
+        });
+    EXPECT_CALL(*transfer, Complete());
+    EXPECT_CALL(dma, InitiateTransfer(2))
+        .WillOnce(Return(std::move(transfer)));
+    EXPECT_CALL(pic, AssertIRQ(PICInterface::IRQ::FDC));
+
+    EXPECT_CALL(imageProvider, Write(Image::Floppy0, (cylinder * 2 + head) * 18 * 512, _))
+        .WillOnce([](auto, auto, std::span<const uint8_t> data) {
+            EXPECT_EQ(18 * 512, data.size());
+            EXPECT_EQ(0xf6, data[0]);
+            return data.size();
+        });
+
+    io.Out8(0x3f5, 0x4d); // command: format track, MFM
+    io.Out8(0x3f5, 0x04); // hds/ds1/ds0
+    io.Out8(0x3f5, 0x02); // n
+    io.Out8(0x3f5, 0x12); // sc
+    io.Out8(0x3f5, 0x54); // gpl
+    io.Out8(0x3f5, 0xf6); // d
+    const auto [ st0, st1, st2, c, h, r, n ] = RetrieveExtendedStatus(io);
+    EXPECT_EQ(0b1100'0000, st0); // ic1/ic0
+    EXPECT_EQ(0, st1);
+}
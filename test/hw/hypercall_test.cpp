@@ -0,0 +1,98 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "bus/io.h"
+#include "bus/memory.h"
+#include "cpu/state.h"
+#include "hw/hypercall.h"
+#include "interface/tickinterface.h"
+
+#include <sstream>
+
+using ::testing::Return;
+
+namespace
+{
+    constexpr inline io_port Command = 0xe0;
+    constexpr inline io_port Argument0 = 0xe2;
+    constexpr inline io_port Argument1 = 0xe4;
+    constexpr inline io_port Argument2 = 0xe6;
+    constexpr inline io_port Argument3 = 0xe8;
+
+    struct TickMock : TickInterface
+    {
+        MOCK_METHOD(std::chrono::nanoseconds, GetTickCount, (), (override));
+    };
+
+    struct HypercallTest : ::testing::Test
+    {
+        IO io;
+        Memory memory;
+        cpu::State state{};
+        TickMock tick;
+        std::ostringstream output;
+        Hypercall hypercall{ io, memory, state, tick, output };
+    };
+}
+
+TEST_F(HypercallTest, NoExitCodeByDefault)
+{
+    EXPECT_FALSE(hypercall.GetExitCode());
+}
+
+TEST_F(HypercallTest, ArgumentsCanBeAccessedByWordOrByte)
+{
+    io.Out16(Argument0, 0x1234);
+    io.Out8(Argument1, 0x78);
+    io.Out8(Argument1 + 1, 0x56);
+    EXPECT_EQ(0x1234, io.In16(Argument0));
+    EXPECT_EQ(0x5678, io.In16(Argument1));
+    EXPECT_EQ(0x34, io.In8(Argument0));
+    EXPECT_EQ(0x12, io.In8(Argument0 + 1));
+}
+
+TEST_F(HypercallTest, ExitStoresTheExitCode)
+{
+    io.Out16(Argument0, 3);
+    io.Out8(Command, 0x01);
+    EXPECT_EQ(3, hypercall.GetExitCode());
+}
+
+TEST_F(HypercallTest, TimestampReturnsTimeAndDelta)
+{
+    EXPECT_CALL(tick, GetTickCount())
+        .WillOnce(Return(std::chrono::nanoseconds(1000)))
+        .WillOnce(Return(std::chrono::nanoseconds(0x123456789abc)));
+
+    io.Out16(Argument0, 1);
+    io.Out8(Command, 0x02);
+    io.Out16(Argument0, 2);
+    io.Out8(Command, 0x02);
+
+    EXPECT_EQ(0x9abc, io.In16(Argument0));
+    EXPECT_EQ(0x5678, io.In16(Argument1));
+    EXPECT_EQ(0x1234, io.In16(Argument2));
+    EXPECT_EQ(0x0000, io.In16(Argument3));
+    EXPECT_EQ("hypercall: timestamp 1 at 1000 ns\n"
+              "hypercall: timestamp 2 at 20015998343868 ns (+20015998342868 ns)\n", output.str());
+}
+
+TEST_F(HypercallTest, PrintWritesStringFromGuestMemory)
+{
+    const std::string text = "hello, world\n";
+    for (size_t n = 0; n < text.size(); ++n)
+        memory.WriteByte(0x12350 + n, text[n]);
+    memory.WriteByte(0x12350 + text.size(), 0);
+
+    io.Out16(Argument0, 0x0010);
+    io.Out16(Argument1, 0x1234);
+    io.Out8(Command, 0x03);
+    EXPECT_EQ(text, output.str());
+}
+
+TEST_F(HypercallTest, DumpStateWritesRegisters)
+{
+    state.m_ax = 0x1111; state.m_cs = 0xf000; state.m_ip = 0xfff0;
+    io.Out8(Command, 0x04);
+    EXPECT_THAT(output.str(), ::testing::HasSubstr("ax=1111"));
+    EXPECT_THAT(output.str(), ::testing::HasSubstr("cs:ip=f000:fff0"));
+}
@@ -2,6 +2,7 @@
 #include "gmock/gmock.h"
 #include "hw/pic.h"
 #include "bus/io.h"
+#include "state_helper.h"
 
 namespace
 {
@@ -93,3 +94,24 @@ TEST_F(PICTest, PendingIRQsAreTriggeredFromHighestToLowestPriority)
     const auto pendingIrq = pic.DequeuePendingIRQ();
     ASSERT_FALSE(pendingIrq);
 }
+
+TEST_F(PICTest, StateCanBeSavedAndRestored)
+{
+    io.Out8(Pic1Data, EnableIRQ(PICInterface::IRQ::PIT));
+    pic.AssertIRQ(PICInterface::IRQ::PIT);
+
+    state_helper::Writer writer;
+    pic.SaveState(writer);
+
+    ASSERT_TRUE(pic.DequeuePendingIRQ());
+    io.Out8(Pic1Data, 0xff);
+
+    state_helper::Reader reader(writer.data);
+    pic.LoadState(reader);
+    EXPECT_TRUE(reader.AtEnd());
+
+    EXPECT_EQ(EnableIRQ(PICInterface::IRQ::PIT), io.In8(Pic1Data));
+    const auto pendingIrq = pic.DequeuePendingIRQ();
+    ASSERT_TRUE(pendingIrq);
+    EXPECT_EQ(static_cast<int>(PICInterface::IRQ::PIT), *pendingIrq);
+}
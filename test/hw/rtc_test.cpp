@@ -3,6 +3,7 @@
 #include "bus/io.h"
 #include "hw/rtc.h"
 #include "interface/timeinterface.h"
+#include "state_helper.h"
 
 using ::testing::Return;
 
@@ -66,4 +67,68 @@ TEST_F(RTCTest, TimeIsProperlyReturned)
     EXPECT_EQ(0x08, ReadRegister(io, 0x08));
     EXPECT_EQ(0x23, ReadRegister(io, 0x09));
     EXPECT_EQ(0x20, ReadRegister(io, 0x32));
-}
\ No newline at end of file
+}
+
+TEST_F(RTCTest, CMOSRegistersCanBeWritten)
+{
+    io.Out8(0x70, 0x2d);
+    io.Out8(0x71, 0xa5);
+    EXPECT_EQ(0xa5, ReadRegister(io, 0x2d));
+    // NMI disable bit must not affect register selection
+    EXPECT_EQ(0xa5, ReadRegister(io, 0x80 | 0x2d));
+}
+
+TEST_F(RTCTest, TimeRegistersCannotBeWritten)
+{
+    constexpr LocalTime t{
+        .seconds = 1, .minutes = 2, .hours = 3,
+        .week_day = 4, .day = 5, .month = 6, .year = 2007
+    };
+
+    EXPECT_CALL(time, GetLocalTime())
+        .WillRepeatedly(Return(t));
+
+    io.Out8(0x70, 0x00);
+    io.Out8(0x71, 0x59);
+    EXPECT_EQ(0x01, ReadRegister(io, 0x00));
+}
+
+TEST_F(RTCTest, BlankExternalStorageReceivesDefaults)
+{
+    std::array<uint8_t, RTC::s_cmos_size> storage{};
+    rtc.SetCMOSStorage(storage);
+    EXPECT_EQ(0x40, storage[0x10]);
+}
+
+TEST_F(RTCTest, ExternalStorageIsUsedAndSurvivesReset)
+{
+    std::array<uint8_t, RTC::s_cmos_size> storage{};
+    storage[0x20] = 0x12;
+    rtc.SetCMOSStorage(storage);
+    EXPECT_EQ(0x12, ReadRegister(io, 0x20));
+    EXPECT_EQ(0x00, ReadRegister(io, 0x10)); // not blank, so no defaults applied
+
+    io.Out8(0x70, 0x21);
+    io.Out8(0x71, 0x34);
+    EXPECT_EQ(0x34, storage[0x21]);
+
+    rtc.Reset();
+    EXPECT_EQ(0x12, ReadRegister(io, 0x20));
+    EXPECT_EQ(0x34, ReadRegister(io, 0x21));
+}
+
+TEST_F(RTCTest, StateCanBeSavedAndRestored)
+{
+    io.Out8(0x70, 0x2d);
+    io.Out8(0x71, 0x5a);
+
+    state_helper::Writer writer;
+    rtc.SaveState(writer);
+    rtc.Reset();
+    EXPECT_EQ(0x00, ReadRegister(io, 0x2d));
+
+    state_helper::Reader reader(writer.data);
+    rtc.LoadState(reader);
+    EXPECT_TRUE(reader.AtEnd());
+    EXPECT_EQ(0x5a, ReadRegister(io, 0x2d));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "interface/stateinterface.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace state_helper
+{
+    struct Writer : StateWriter
+    {
+        std::vector<uint8_t> data;
+
+        void WriteBytes(std::span<const uint8_t> bytes) override
+        {
+            data.insert(data.end(), bytes.begin(), bytes.end());
+        }
+    };
+
+    struct Reader : StateReader
+    {
+        const std::vector<uint8_t>& data;
+        size_t offset = 0;
+
+        Reader(const std::vector<uint8_t>& data) : data(data) { }
+
+        void ReadBytes(std::span<uint8_t> bytes) override
+        {
+            if (offset + bytes.size() > data.size())
+                throw std::runtime_error("out of data");
+            std::memcpy(bytes.data(), data.data() + offset, bytes.size());
+            offset += bytes.size();
+        }
+
+        bool AtEnd() const { return offset == data.size(); }
+    };
+}
@@ -0,0 +1,203 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "bus/io.h"
+#include "bus/memory.h"
+#include "bios/diskservices.h"
+#include "bios/videoservices.h"
+#include "cpu/cpux86.h"
+#include "hw/ata.h"
+#include "hw/dma.h"
+#include "hw/fdc.h"
+#include "hw/keyboard.h"
+#include "hw/pic.h"
+#include "hw/pit.h"
+#include "hw/ppi.h"
+#include "hw/rtc.h"
+#include "hw/vga.h"
+#include "interface/imageprovider.h"
+#include "interface/tickinterface.h"
+#include "interface/timeinterface.h"
+#include "platform/hostio.h"
+#include "platform/snapshot.h"
+
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <string>
+
+namespace
+{
+    constexpr inline io_port PICData = 0x21;
+
+    struct NoImages : ImageProvider
+    {
+        Bytes GetSize(const Image) override { return 0; }
+        size_t Read(const Image, uint64_t, std::span<uint8_t>) override { return 0; }
+        size_t Write(const Image, uint64_t, std::span<const uint8_t>) override { return 0; }
+    };
+
+    struct FixedTick : TickInterface
+    {
+        std::chrono::nanoseconds GetTickCount() override { return {}; }
+    };
+
+    struct FixedTime : TimeInterface
+    {
+        LocalTime GetLocalTime() override { return {}; }
+    };
+
+    // Size of the pages of the mapping containing addr which have been
+    // copied on write, in kB
+    size_t GetAnonymousKB(const void* addr)
+    {
+        const auto address = reinterpret_cast<uintptr_t>(addr);
+        std::ifstream smaps("/proc/self/smaps");
+        bool inMapping = false;
+        std::string line;
+        while (std::getline(smaps, line)) {
+            unsigned long start, end;
+            char dash;
+            if (std::sscanf(line.c_str(), "%lx%c%lx", &start, &dash, &end) == 3 && dash == '-') {
+                inMapping = address >= start && address < end;
+                continue;
+            }
+            size_t kb;
+            if (inMapping && std::sscanf(line.c_str(), "Anonymous: %zu kB", &kb) == 1)
+                return kb;
+        }
+        ADD_FAILURE() << "mapping not found";
+        return 0;
+    }
+
+    struct CheckpointTest : ::testing::Test
+    {
+        IO io;
+        Memory memory;
+        CPUx86 cpu{ memory, io };
+        HostIO hostio;
+        NoImages images;
+        FixedTick tick;
+        FixedTime time;
+        ATA ata{ io, images };
+        PIC pic{ io };
+        PIT pit{ io, tick };
+        DMA dma{ io, memory };
+        PPI ppi{ io, pit };
+        RTC rtc{ io, time };
+        FDC fdc{ io, pic, dma, images };
+        VGA vga{ memory, io, hostio, tick };
+        Keyboard keyboard{ io, hostio };
+        Machine machine{ cpu, memory, vga, pic, pit, dma, fdc, ata, rtc, ppi, keyboard };
+
+        CheckpointTest()
+        {
+            memory.Reset();
+            cpu.Reset();
+            pic.Reset();
+        }
+
+        size_t GetCopiedKB() { return GetAnonymousKB(memory.GetPage(0).data()); }
+
+        // Touches all pages, so any that are not shared would show up
+        void ReadAllMemory()
+        {
+            for (size_t page = 0; page < Memory::s_page_count; ++page)
+                memory.ReadByte(page * Memory::s_page_size);
+        }
+    };
+}
+
+TEST_F(CheckpointTest, ForkRestoresMemoryAndDevices)
+{
+    memory.WriteByte(0x1000, 0x11);
+    cpu.GetState().m_ax = 0x1234;
+    io.Out8(PICData, 0x5a);
+
+    Checkpoint checkpoint;
+    checkpoint.Take(machine);
+
+    memory.WriteByte(0x1000, 0x22);
+    memory.WriteByte(0x20000, 0x33);
+    cpu.GetState().m_ax = 0;
+    io.Out8(PICData, 0xff);
+
+    checkpoint.Fork(machine);
+    EXPECT_EQ(0x11, memory.ReadByte(0x1000));
+    EXPECT_EQ(0, memory.ReadByte(0x20000));
+    EXPECT_EQ(0x1234, cpu.GetState().m_ax);
+    EXPECT_EQ(0x5a, io.In8(PICData));
+}
+
+TEST_F(CheckpointTest, ForkedMachinesShareMemoryPages)
+{
+    for (size_t page = 0; page < Memory::s_page_count; ++page)
+        memory.WriteByte(page * Memory::s_page_size, page & 0xff);
+
+    Checkpoint checkpoint;
+    checkpoint.Take(machine);
+    ReadAllMemory();
+    EXPECT_EQ(0, GetCopiedKB());
+
+    // Only the written pages are copied
+    memory.WriteByte(0x1000, 0x22);
+    memory.WriteByte(0x5000, 0x22);
+    EXPECT_EQ(2 * Memory::s_page_size / 1024, GetCopiedKB());
+
+    // A fork discards them and shares everything again
+    for (int n = 0; n < 2; ++n) {
+        checkpoint.Fork(machine);
+        ReadAllMemory();
+        EXPECT_EQ(0, GetCopiedKB());
+        EXPECT_EQ(0x01, memory.ReadByte(0x1000));
+        EXPECT_EQ(0x05, memory.ReadByte(0x5000));
+        memory.WriteByte(0x1000, 0x44);
+    }
+}
+
+TEST_F(CheckpointTest, SnapshotKeepsTrappedHandlers)
+{
+    // BIOS handlers at F000:1234 (INT 10h) and F000:5678 (INT 13h)
+    memory.WriteWord(0x10 * 4 + 0, 0x1234);
+    memory.WriteWord(0x10 * 4 + 2, 0xf000);
+    memory.WriteWord(0x13 * 4 + 0, 0x5678);
+    memory.WriteWord(0x13 * 4 + 2, 0xf000);
+
+    Snapshot withHandlers, withoutServices;
+    withoutServices.Save(machine);
+    {
+        DiskServices disk{ memory, images };
+        VideoServices video{ memory, io, vga };
+        machine.diskServices = &disk;
+        machine.videoServices = &video;
+
+        auto& state = cpu.GetState();
+        state.m_cs = 0;
+        state.m_ip = 0x7c00;
+        EXPECT_FALSE(disk.Handle(state));
+        EXPECT_FALSE(video.Handle(state));
+        EXPECT_TRUE(disk.IsActive());
+        EXPECT_TRUE(video.IsActive());
+        withHandlers.Save(machine);
+    }
+
+    // The operating system has hooked the vectors by now
+    memory.WriteWord(0x10 * 4 + 2, 0x0070);
+    memory.WriteWord(0x13 * 4 + 2, 0x0070);
+    DiskServices disk{ memory, images };
+    VideoServices video{ memory, io, vga };
+    machine.diskServices = &disk;
+    machine.videoServices = &video;
+    withoutServices.Restore(machine);
+    EXPECT_FALSE(disk.IsActive());
+    EXPECT_FALSE(video.IsActive());
+
+    withHandlers.Restore(machine);
+    EXPECT_TRUE(disk.IsActive());
+    EXPECT_TRUE(video.IsActive());
+
+    // Snapshots with handlers can be restored without the services as well
+    machine.diskServices = nullptr;
+    machine.videoServices = nullptr;
+    EXPECT_NO_THROW(withHandlers.Restore(machine));
+    EXPECT_EQ(0x7c00, cpu.GetState().m_ip);
+}
@@ -0,0 +1,266 @@
+#include "gtest/gtest.h"
+#include "hw/diskgeometry.h"
+#include "platform/directoryimage.h"
+#include "temppath.h"
+
+#include <array>
+#include <csignal>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+namespace
+{
+    constexpr size_t sectorSize = 512;
+
+    // 1.44MB floppy: boot sector, 2 FATs of 9 sectors, 14 root directory
+    // sectors and then the data area
+    constexpr uint64_t floppyFATOffset = 1 * sectorSize;
+    constexpr uint64_t floppyRootOffset = 19 * sectorSize;
+    constexpr uint64_t floppyDataOffset = 33 * sectorSize;
+    constexpr size_t entrySize = 32;
+
+    uint16_t Get16(const std::vector<uint8_t>& data, size_t offset)
+    {
+        return data[offset] | (data[offset + 1] << 8);
+    }
+
+    uint32_t Get32(const std::vector<uint8_t>& data, size_t offset)
+    {
+        return Get16(data, offset) | (Get16(data, offset + 2) << 16);
+    }
+
+    struct DirectoryImageTest : ::testing::Test
+    {
+        TempPath dir{ "directory" };
+        DirectoryImage image;
+
+        void SetUp() override { std::filesystem::create_directory(dir.Get()); }
+
+        void CreateFile(const std::string& name, const std::string& contents)
+        {
+            std::ofstream(dir.Get() / name, std::ios::binary) << contents;
+        }
+
+        std::string ReadHostFile(const std::string& name)
+        {
+            std::ifstream f(dir.Get() / name, std::ios::binary);
+            return { std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>() };
+        }
+
+        std::vector<uint8_t> Read(uint64_t offset, size_t length)
+        {
+            std::vector<uint8_t> data(length);
+            EXPECT_EQ(length, image.Read(offset, data));
+            return data;
+        }
+
+        void Write(uint64_t offset, const std::string& text)
+        {
+            const std::vector<uint8_t> data(text.begin(), text.end());
+            EXPECT_EQ(data.size(), image.Write(offset, data));
+        }
+
+        std::string ReadText(uint64_t offset, size_t length)
+        {
+            const auto data = Read(offset, length);
+            return { data.begin(), data.end() };
+        }
+
+        std::string GetRootEntryName(size_t entry)
+        {
+            return ReadText(floppyRootOffset + entry * entrySize, 11);
+        }
+
+        uint32_t GetFAT12Entry(const std::vector<uint8_t>& fat, uint32_t cluster)
+        {
+            const auto value = Get16(fat, cluster * 3 / 2);
+            return cluster % 2 ? value >> 4 : value & 0xfff;
+        }
+    };
+}
+
+TEST_F(DirectoryImageTest, FAT12EntriesArePacked)
+{
+    // Clusters 2; 3-5; 6
+    CreateFile("a.txt", "a");
+    CreateFile("b.txt", std::string(2 * sectorSize + 1, 'b'));
+    CreateFile("c.txt", std::string(sectorSize, 'c'));
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Floppy, false));
+    EXPECT_EQ(1474560, image.GetLength());
+
+    const auto fat = Read(floppyFATOffset, 9 * sectorSize);
+    EXPECT_EQ(0xff0, GetFAT12Entry(fat, 0)); // media descriptor
+    EXPECT_EQ(0xfff, GetFAT12Entry(fat, 1));
+    EXPECT_EQ(0xfff, GetFAT12Entry(fat, 2));
+    EXPECT_EQ(0x004, GetFAT12Entry(fat, 3));
+    EXPECT_EQ(0x005, GetFAT12Entry(fat, 4));
+    EXPECT_EQ(0xfff, GetFAT12Entry(fat, 5));
+    EXPECT_EQ(0xfff, GetFAT12Entry(fat, 6));
+    EXPECT_EQ(0x000, GetFAT12Entry(fat, 7));
+    EXPECT_EQ((std::vector<uint8_t>{ 0xf0, 0xff, 0xff, 0xff, 0x4f, 0x00, 0x05, 0xf0, 0xff, 0xff, 0x0f, 0x00 }),
+        std::vector<uint8_t>(fat.begin(), fat.begin() + 12));
+    EXPECT_EQ(fat, Read(floppyFATOffset + 9 * sectorSize, 9 * sectorSize));
+
+    EXPECT_EQ("B       TXT", GetRootEntryName(1));
+    const auto entry = Read(floppyRootOffset + entrySize, entrySize);
+    EXPECT_EQ(3, Get16(entry, 26)); // first cluster
+    EXPECT_EQ(2 * sectorSize + 1, Get32(entry, 28)); // size
+    EXPECT_EQ("a", ReadText(floppyDataOffset, 1));
+    EXPECT_EQ("c", ReadText(floppyDataOffset + 4 * sectorSize, 1));
+}
+
+TEST_F(DirectoryImageTest, NamesAreConvertedToShortNames)
+{
+    CreateFile("Long File Name.text", "");
+    CreateFile("README.TXT", "");
+    CreateFile("a+b.c", "");
+    CreateFile("longfilename.tex", "");
+    CreateFile("noext", "");
+    CreateFile("readme.txt", "");
+    CreateFile(".hidden", "");
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Floppy, false));
+
+    EXPECT_EQ("LONGFI~1TEX", GetRootEntryName(0)); // lossy
+    EXPECT_EQ("README  TXT", GetRootEntryName(1));
+    EXPECT_EQ("A_B~1   C  ", GetRootEntryName(2)); // invalid character
+    EXPECT_EQ("LONGFI~2TEX", GetRootEntryName(3)); // lossy, collides
+    EXPECT_EQ("NOEXT      ", GetRootEntryName(4));
+    EXPECT_EQ("README~1TXT", GetRootEntryName(5)); // collides
+    EXPECT_EQ(0, Read(floppyRootOffset + 6 * entrySize, 1)[0]);
+}
+
+TEST_F(DirectoryImageTest, HarddiskClusterSizeGrowsWithContents)
+{
+    CreateFile("small.txt", "small");
+    {
+        ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Harddisk, false));
+        // 67 cylinders, 16 heads and 63 sectors, of which the first track
+        // holds the partition table
+        EXPECT_EQ(67 * 16 * 63 * sectorSize, image.GetLength());
+        const auto mbr = Read(0, sectorSize);
+        EXPECT_EQ(0x80, mbr[0x1be]);
+        EXPECT_EQ(0x06, mbr[0x1be + 4]);
+        EXPECT_EQ(63, Get32(mbr, 0x1be + 8));
+        EXPECT_EQ(67 * 16 * 63 - 63, Get32(mbr, 0x1be + 12));
+
+        const auto boot = Read(63 * sectorSize, sectorSize);
+        EXPECT_EQ(sectorSize, Get16(boot, 11));
+        EXPECT_EQ(2, boot[13]); // sectors per cluster
+        EXPECT_EQ(0, Get16(boot, 19));
+        EXPECT_EQ(67 * 16 * 63 - 63, Get32(boot, 32));
+        EXPECT_EQ(0xf8, boot[21]);
+        EXPECT_EQ("FAT16   ", std::string(boot.begin() + 54, boot.begin() + 62));
+        EXPECT_EQ(0x55, boot[510]);
+        EXPECT_EQ(0xaa, boot[511]);
+    }
+
+    // Needs at least 80MB to leave as much free space, so 268 cylinders
+    // with 4KB clusters
+    std::filesystem::resize_file(dir.Get() / "small.txt", 40 * 1024 * 1024);
+    DirectoryImage large;
+    ASSERT_TRUE(large.Open(dir.c_str(), DirectoryImage::Type::Harddisk, false));
+    EXPECT_EQ(268 * 16 * 63 * sectorSize, large.GetLength());
+    std::vector<uint8_t> boot(sectorSize);
+    ASSERT_EQ(sectorSize, large.Read(63 * sectorSize, boot));
+    EXPECT_EQ(8, boot[13]);
+    EXPECT_EQ(0, Get16(boot, 19));
+    EXPECT_EQ(268 * 16 * 63 - 63, Get32(boot, 32));
+}
+
+TEST_F(DirectoryImageTest, HarddiskGeometryMatchesDiskGeometry)
+{
+    CreateFile("small.txt", "small");
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Harddisk, false));
+
+    // As reported by ATA IDENTIFY and INT 13h
+    const auto geometry = disk::GetHarddiskGeometry(image.GetLength());
+    const auto boot = Read(63 * sectorSize, sectorSize);
+    EXPECT_EQ(geometry.sectors_per_track, Get16(boot, 24));
+    EXPECT_EQ(geometry.heads, Get16(boot, 26));
+    EXPECT_EQ(geometry.cylinders * geometry.heads * geometry.sectors_per_track * sectorSize, image.GetLength());
+
+    // The partition ends on the last sector of the last cylinder
+    const auto mbr = Read(0, sectorSize);
+    EXPECT_EQ(geometry.heads - 1, mbr[0x1be + 5]);
+    EXPECT_EQ(geometry.sectors_per_track, mbr[0x1be + 6] & 0x3f);
+}
+
+TEST_F(DirectoryImageTest, GuestWritesTakePrecedence)
+{
+    CreateFile("file.txt", std::string(sectorSize, 'f') + "tail");
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Floppy, false));
+
+    Write(floppyDataOffset + 2, "guest");
+    Write(floppyDataOffset + sectorSize + 4, "!");
+    EXPECT_EQ("ffguestf", ReadText(floppyDataOffset, 8));
+    EXPECT_EQ("fftail!", ReadText(floppyDataOffset + sectorSize - 2, 7));
+
+    // The host file is left alone
+    EXPECT_EQ(std::string(sectorSize, 'f') + "tail", ReadHostFile("file.txt"));
+
+    // Also for the generated sectors
+    Write(floppyRootOffset, "RENAMED TXT");
+    EXPECT_EQ("RENAMED TXT", GetRootEntryName(0));
+}
+
+TEST_F(DirectoryImageTest, WriteBackOnlyWhileFileIsUnchanged)
+{
+    CreateFile("a.txt", std::string(sectorSize, 'a'));
+    CreateFile("b.txt", std::string(sectorSize, 'b'));
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Floppy, true));
+
+    Write(floppyDataOffset, "host");
+    EXPECT_EQ("host", ReadHostFile("a.txt").substr(0, 4));
+
+    // Once the directory entry changes, writes are kept in memory
+    Write(floppyRootOffset + 28, std::string("\x01\x00\x00\x00", 4)); // size
+    Write(floppyDataOffset, "mem!");
+    EXPECT_EQ("mem!", ReadText(floppyDataOffset, 4));
+    EXPECT_EQ("host", ReadHostFile("a.txt").substr(0, 4));
+
+    // The same applies once the FAT entry of its cluster changes
+    Write(floppyDataOffset + sectorSize, "host");
+    EXPECT_EQ("host", ReadHostFile("b.txt").substr(0, 4));
+    Write(floppyFATOffset + 4, std::string(1, '\x00')); // cluster 3 becomes free
+    Write(floppyDataOffset + sectorSize, "mem!");
+    EXPECT_EQ("mem!", ReadText(floppyDataOffset + sectorSize, 4));
+    EXPECT_EQ("host", ReadHostFile("b.txt").substr(0, 4));
+}
+
+TEST_F(DirectoryImageTest, WriteBackKeepsReadOnlyFilesInMemory)
+{
+    CreateFile("ro.txt", std::string(sectorSize, 'r'));
+    std::filesystem::permissions(dir.Get() / "ro.txt", std::filesystem::perms::owner_read);
+    if (access((dir.Get() / "ro.txt").c_str(), W_OK) == 0)
+        GTEST_SKIP() << "file permissions are not enforced for this user";
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Floppy, true));
+    EXPECT_EQ(0x21, Read(floppyRootOffset + 11, 1)[0]); // read-only, archive
+
+    Write(floppyDataOffset + 1, "guest");
+    EXPECT_EQ("rguestr", ReadText(floppyDataOffset, 7));
+    EXPECT_EQ(std::string(sectorSize, 'r'), ReadHostFile("ro.txt"));
+}
+
+TEST_F(DirectoryImageTest, WriteBackKeepsFailedWritesInMemory)
+{
+    CreateFile("file.txt", std::string(sectorSize, 'f'));
+    ASSERT_TRUE(image.Open(dir.c_str(), DirectoryImage::Type::Floppy, true));
+
+    // Any write to the host file fails
+    rlimit previousLimit;
+    getrlimit(RLIMIT_FSIZE, &previousLimit);
+    const auto previousHandler = std::signal(SIGXFSZ, SIG_IGN);
+    rlimit limit{ 0, previousLimit.rlim_max };
+    setrlimit(RLIMIT_FSIZE, &limit);
+    std::vector<uint8_t> data{ 'g', 'u', 'e', 's', 't' };
+    const auto result = image.Write(floppyDataOffset + 1, data);
+    setrlimit(RLIMIT_FSIZE, &previousLimit);
+    std::signal(SIGXFSZ, previousHandler);
+
+    EXPECT_EQ(data.size(), result);
+    EXPECT_EQ("fguestf", ReadText(floppyDataOffset, 7));
+    EXPECT_EQ(std::string(sectorSize, 'f'), ReadHostFile("file.txt"));
+}
@@ -0,0 +1,10 @@
+#include "cpu/disassembler.h"
+
+// The real disassembler requires capstone; the profiler only needs some text
+struct Disassembler::Impl
+{
+};
+
+Disassembler::Disassembler() : impl(std::make_unique<Impl>()) { }
+Disassembler::~Disassembler() = default;
+std::string Disassembler::Disassemble(MemoryInterface&, const cpu::State&) { return "insn"; }
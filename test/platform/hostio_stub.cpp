@@ -0,0 +1,16 @@
+#include "platform/hostio.h"
+
+// The devices only need a HostIO to exist; the real one requires SDL and a
+// display
+struct HostIO::Impl
+{
+};
+
+HostIO::HostIO() : impl(std::make_unique<Impl>()) { }
+HostIO::~HostIO() = default;
+void HostIO::Render() { }
+void HostIO::Update() { }
+void HostIO::putpixel(unsigned int, unsigned int, uint32_t) { }
+uint16_t HostIO::GetAndClearPendingScanCode() { return 0; }
+uint16_t HostIO::GetScancodeForKeyName(const char*) { return 0; }
+std::optional<HostIO::EventType> HostIO::GetPendingEvent() { return {}; }
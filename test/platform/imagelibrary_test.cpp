@@ -0,0 +1,332 @@
+#include "gtest/gtest.h"
+#include "platform/imagelibrary.h"
+#include "temppath.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <vector>
+#include <csignal>
+#include <sys/resource.h>
+
+namespace
+{
+    constexpr size_t overlayBlockSize = 4096;
+    // Ends with a partial block
+    constexpr size_t baseLength = 5 * overlayBlockSize + 512;
+    // Header, bitmap padded to the first block
+    constexpr size_t overlayHeaderSize = 24;
+    constexpr size_t overlayDataOffset = overlayBlockSize;
+
+    std::vector<uint8_t> ReadFile(const std::filesystem::path& path)
+    {
+        std::ifstream f(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>() };
+    }
+
+    void WriteFile(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+    {
+        std::ofstream f(path, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    std::vector<uint8_t> MakePattern(size_t length, uint8_t seed)
+    {
+        std::vector<uint8_t> data(length);
+        for (size_t n = 0; n < length; ++n)
+            data[n] = static_cast<uint8_t>(n * 7 + n / 256 + seed);
+        return data;
+    }
+
+    std::vector<uint8_t> ReadImage(ImageLibrary& library, uint64_t offset, size_t length)
+    {
+        std::vector<uint8_t> data(length);
+        EXPECT_EQ(length, library.GetImageProvider().Read(Image::Harddisk0, offset, data));
+        return data;
+    }
+
+    struct OverlayImageTest : ::testing::Test
+    {
+        TempPath dir{ "overlay" };
+        std::filesystem::path basePath, overlayPath;
+        std::vector<uint8_t> base;
+
+        void SetUp() override
+        {
+            std::filesystem::create_directory(dir.Get());
+            basePath = dir.Get() / "base.img";
+            overlayPath = dir.Get() / "changes.ovl";
+            base = MakePattern(baseLength, 0);
+            WriteFile(basePath, base);
+        }
+
+        bool Open(ImageLibrary& library)
+        {
+            return library.SetOverlayImage(Image::Harddisk0, basePath.c_str(), overlayPath.c_str());
+        }
+    };
+
+    constexpr uint32_t sparseBlockSize = 4096;
+    constexpr uint64_t sparseLength = 4 * sparseBlockSize + 512;
+    constexpr uint32_t sparseNumberOfBlocks = 5;
+    constexpr size_t sparseHeaderSize = 32;
+    constexpr size_t sparseDataOffset = sparseBlockSize;
+
+    // As created by scripts/sparse_image.py
+    std::vector<uint8_t> MakeSparseImage(uint32_t numberOfBlocks)
+    {
+        std::vector<uint8_t> image(sparseDataOffset);
+        const uint32_t version = 1;
+        std::memcpy(&image[0], "x86boxSP", 8);
+        std::memcpy(&image[8], &version, sizeof(version));
+        std::memcpy(&image[12], &sparseBlockSize, sizeof(sparseBlockSize));
+        std::memcpy(&image[16], &sparseLength, sizeof(sparseLength));
+        std::memcpy(&image[24], &numberOfBlocks, sizeof(numberOfBlocks));
+        return image;
+    }
+
+    uint32_t GetTableEntry(const std::vector<uint8_t>& image, uint32_t block)
+    {
+        uint32_t entry;
+        std::memcpy(&entry, &image[sparseHeaderSize + block * sizeof(entry)], sizeof(entry));
+        return entry;
+    }
+
+    struct SparseImageTest : ::testing::Test
+    {
+        TempPath path{ "sparse" };
+
+        void SetUp() override { WriteFile(path.Get(), MakeSparseImage(sparseNumberOfBlocks)); }
+
+        bool Open(ImageLibrary& library) { return library.SetImage(Image::Harddisk0, path.c_str()); }
+    };
+}
+
+TEST_F(OverlayImageTest, NewOverlayReadsBaseImage)
+{
+    ImageLibrary library;
+    ASSERT_TRUE(Open(library));
+    EXPECT_EQ(baseLength, library.GetImageProvider().GetSize(Image::Harddisk0));
+    EXPECT_EQ(base, ReadImage(library, 0, baseLength));
+
+    const auto overlay = ReadFile(overlayPath);
+    ASSERT_EQ(overlayHeaderSize + 1, overlay.size());
+    EXPECT_EQ(0, std::memcmp(overlay.data(), "x86boxOV", 8));
+    uint64_t length;
+    std::memcpy(&length, &overlay[16], sizeof(length));
+    EXPECT_EQ(baseLength, length);
+    EXPECT_EQ(0, overlay[overlayHeaderSize]);
+}
+
+TEST_F(OverlayImageTest, WritesSpanningBlocksGoToOverlay)
+{
+    // Starts and ends halfway a block, and fully covers the one in between
+    constexpr uint64_t offset = overlayBlockSize - 512;
+    const auto data = MakePattern(overlayBlockSize + 1024, 0x55);
+    {
+        ImageLibrary library;
+        ASSERT_TRUE(Open(library));
+        EXPECT_EQ(data.size(), library.GetImageProvider().Write(Image::Harddisk0, offset, data));
+
+        auto expected = base;
+        std::copy(data.begin(), data.end(), expected.begin() + offset);
+        EXPECT_EQ(expected, ReadImage(library, 0, baseLength));
+    }
+    EXPECT_EQ(base, ReadFile(basePath));
+
+    const auto overlay = ReadFile(overlayPath);
+    EXPECT_EQ(0b0111, overlay[overlayHeaderSize]);
+    ASSERT_EQ(overlayDataOffset + 3 * overlayBlockSize, overlay.size());
+    // Partially written blocks are completed from the base image
+    EXPECT_TRUE(std::equal(base.begin(), base.begin() + offset, overlay.begin() + overlayDataOffset));
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), overlay.begin() + overlayDataOffset + offset));
+    EXPECT_TRUE(std::equal(base.begin() + offset + data.size(), base.begin() + 3 * overlayBlockSize,
+        overlay.begin() + overlayDataOffset + offset + data.size()));
+}
+
+TEST_F(OverlayImageTest, ExistingOverlayIsReused)
+{
+    const auto first = MakePattern(512, 0x11);
+    const auto last = MakePattern(512, 0x22);
+    {
+        ImageLibrary library;
+        ASSERT_TRUE(Open(library));
+        EXPECT_EQ(first.size(), library.GetImageProvider().Write(Image::Harddisk0, 512, first));
+        EXPECT_EQ(last.size(), library.GetImageProvider().Write(Image::Harddisk0, baseLength - 512, last));
+    }
+
+    ImageLibrary library;
+    ASSERT_TRUE(Open(library));
+    auto expected = base;
+    std::copy(first.begin(), first.end(), expected.begin() + 512);
+    std::copy(last.begin(), last.end(), expected.begin() + baseLength - 512);
+    EXPECT_EQ(expected, ReadImage(library, 0, baseLength));
+
+    // Rewriting an allocated block does not grow the overlay
+    const auto size = std::filesystem::file_size(overlayPath);
+    library.GetImageProvider().Write(Image::Harddisk0, 1024, first);
+    EXPECT_EQ(size, std::filesystem::file_size(overlayPath));
+    EXPECT_EQ(first, ReadImage(library, 1024, 512));
+}
+
+TEST_F(OverlayImageTest, FailedBaseReadFailsWrite)
+{
+    ImageLibrary library;
+    ASSERT_TRUE(Open(library));
+    std::filesystem::resize_file(basePath, overlayBlockSize);
+
+    // The block can not be completed from the base image
+    const auto data = MakePattern(512, 0x33);
+    EXPECT_NE(data.size(), library.GetImageProvider().Write(Image::Harddisk0, overlayBlockSize + 512, data));
+    EXPECT_EQ(0, ReadFile(overlayPath)[overlayHeaderSize]);
+
+    // Full blocks do not need it
+    const auto block = MakePattern(overlayBlockSize, 0x44);
+    EXPECT_EQ(block.size(), library.GetImageProvider().Write(Image::Harddisk0, overlayBlockSize, block));
+    EXPECT_EQ(block, ReadImage(library, overlayBlockSize, overlayBlockSize));
+}
+
+TEST_F(OverlayImageTest, DirectoryBaseIsRejected)
+{
+    ImageLibrary library;
+    EXPECT_FALSE(library.SetOverlayImage(Image::Harddisk0, dir.c_str(), overlayPath.c_str()));
+    EXPECT_FALSE(std::filesystem::exists(overlayPath));
+}
+
+TEST_F(OverlayImageTest, MismatchingOverlayIsRejected)
+{
+    {
+        ImageLibrary library;
+        ASSERT_TRUE(Open(library));
+    }
+
+    // The base image has a different size than when the overlay was created
+    WriteFile(basePath, MakePattern(baseLength + 512, 0));
+    {
+        ImageLibrary library;
+        EXPECT_FALSE(Open(library));
+    }
+
+    WriteFile(basePath, base);
+    auto overlay = ReadFile(overlayPath);
+    overlay[0] = 'X';
+    WriteFile(overlayPath, overlay);
+    ImageLibrary library;
+    EXPECT_FALSE(Open(library));
+}
+
+TEST_F(SparseImageTest, UnallocatedBlocksReadAsZeroes)
+{
+    ImageLibrary library;
+    ASSERT_TRUE(Open(library));
+    EXPECT_EQ(sparseLength, library.GetImageProvider().GetSize(Image::Harddisk0));
+    EXPECT_EQ(std::vector<uint8_t>(sparseLength), ReadImage(library, 0, sparseLength));
+    EXPECT_EQ(sparseDataOffset, std::filesystem::file_size(path.Get()));
+}
+
+TEST_F(SparseImageTest, PartialBlockWriteAllocatesBlock)
+{
+    const auto data = MakePattern(512, 0x33);
+    ImageLibrary library;
+    ASSERT_TRUE(Open(library));
+    EXPECT_EQ(data.size(), library.GetImageProvider().Write(Image::Harddisk0, 2 * sparseBlockSize + 1024, data));
+
+    auto expected = std::vector<uint8_t>(sparseBlockSize);
+    std::copy(data.begin(), data.end(), expected.begin() + 1024);
+    EXPECT_EQ(expected, ReadImage(library, 2 * sparseBlockSize, sparseBlockSize));
+
+    const auto image = ReadFile(path.Get());
+    ASSERT_EQ(sparseDataOffset + sparseBlockSize, image.size());
+    EXPECT_EQ(0, GetTableEntry(image, 1));
+    EXPECT_EQ(1, GetTableEntry(image, 2));
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), image.begin() + sparseDataOffset));
+
+    // Writing to the same block again does not allocate another one
+    library.GetImageProvider().Write(Image::Harddisk0, 2 * sparseBlockSize, data);
+    EXPECT_EQ(sparseDataOffset + sparseBlockSize, std::filesystem::file_size(path.Get()));
+    EXPECT_EQ(data, ReadImage(library, 2 * sparseBlockSize, data.size()));
+}
+
+TEST_F(SparseImageTest, BlocksAreAllocatedInWriteOrder)
+{
+    const auto tail = MakePattern(512, 0x44);
+    const auto spanning = MakePattern(1024, 0x66);
+    {
+        ImageLibrary library;
+        ASSERT_TRUE(Open(library));
+        // Partial last block, then a write crossing from block 0 into block 1
+        library.GetImageProvider().Write(Image::Harddisk0, sparseLength - 512, tail);
+        library.GetImageProvider().Write(Image::Harddisk0, sparseBlockSize - 512, spanning);
+    }
+
+    const auto image = ReadFile(path.Get());
+    ASSERT_EQ(sparseDataOffset + 3 * sparseBlockSize, image.size());
+    EXPECT_EQ(2, GetTableEntry(image, 0));
+    EXPECT_EQ(3, GetTableEntry(image, 1));
+    EXPECT_EQ(0, GetTableEntry(image, 2));
+    EXPECT_EQ(0, GetTableEntry(image, 3));
+    EXPECT_EQ(1, GetTableEntry(image, 4));
+
+    // After reopening, new blocks are appended after the existing ones
+    ImageLibrary library;
+    ASSERT_TRUE(Open(library));
+    EXPECT_EQ(tail, ReadImage(library, sparseLength - 512, tail.size()));
+    EXPECT_EQ(spanning, ReadImage(library, sparseBlockSize - 512, spanning.size()));
+
+    library.GetImageProvider().Write(Image::Harddisk0, 3 * sparseBlockSize, tail);
+    EXPECT_EQ(4, GetTableEntry(ReadFile(path.Get()), 3));
+    EXPECT_EQ(tail, ReadImage(library, 3 * sparseBlockSize, tail.size()));
+    EXPECT_EQ(spanning, ReadImage(library, sparseBlockSize - 512, spanning.size()));
+}
+
+TEST_F(SparseImageTest, InconsistentHeaderIsRejected)
+{
+    WriteFile(path.Get(), MakeSparseImage(sparseNumberOfBlocks - 1));
+    ImageLibrary library;
+    EXPECT_FALSE(Open(library));
+}
+
+TEST_F(SparseImageTest, BufferedWritesAreKeptUntilFlushed)
+{
+    const auto data = MakePattern(1024, 0x77);
+    ImageLibrary library;
+    library.SetSyncPolicy(ImageLibrary::SyncPolicy::OnClose);
+    ASSERT_TRUE(Open(library));
+    library.GetImageProvider().Write(Image::Harddisk0, 512, data);
+    EXPECT_EQ(sparseDataOffset, std::filesystem::file_size(path.Get()));
+    EXPECT_EQ(data, ReadImage(library, 512, data.size()));
+
+    EXPECT_TRUE(library.Flush());
+    EXPECT_EQ(sparseDataOffset + sparseBlockSize, std::filesystem::file_size(path.Get()));
+    EXPECT_EQ(data, ReadImage(library, 512, data.size()));
+}
+
+TEST_F(SparseImageTest, FailedWritesRemainPending)
+{
+    const auto data = MakePattern(1024, 0x77);
+    ImageLibrary library;
+    library.SetSyncPolicy(ImageLibrary::SyncPolicy::OnClose);
+    ASSERT_TRUE(Open(library));
+    library.GetImageProvider().Write(Image::Harddisk0, 512, data);
+
+    // Keep the image from growing, so that allocating the block fails
+    rlimit previousLimit;
+    getrlimit(RLIMIT_FSIZE, &previousLimit);
+    const auto previousHandler = std::signal(SIGXFSZ, SIG_IGN);
+    rlimit limit{ sparseDataOffset, previousLimit.rlim_max };
+    setrlimit(RLIMIT_FSIZE, &limit);
+    const auto failedFlush = library.Flush();
+    setrlimit(RLIMIT_FSIZE, &previousLimit);
+    std::signal(SIGXFSZ, previousHandler);
+
+    EXPECT_FALSE(failedFlush);
+    EXPECT_EQ(data, ReadImage(library, 512, data.size()));
+    EXPECT_TRUE(library.Flush());
+    EXPECT_EQ(sparseDataOffset + sparseBlockSize, std::filesystem::file_size(path.Get()));
+
+    ImageLibrary reopened;
+    ASSERT_TRUE(Open(reopened));
+    EXPECT_EQ(data, ReadImage(reopened, 512, data.size()));
+}
@@ -0,0 +1,98 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "platform/inputlog.h"
+#include "temppath.h"
+
+#include <fstream>
+
+using ::testing::Return;
+
+namespace
+{
+    struct TimeMock : TimeInterface
+    {
+        MOCK_METHOD(LocalTime, GetLocalTime, (), (override));
+    };
+
+    constexpr LocalTime recordedTime{
+        .seconds = 59, .minutes = 30, .hours = 23, .week_day = 5, .day = 31, .month = 12, .year = 2023
+    };
+
+    struct InputLogTest : ::testing::Test
+    {
+        TempPath path{ "inputlog" };
+        uint64_t instructionCount = 0;
+        TimeMock time;
+
+        void Record()
+        {
+            InputLog log(InputLog::Mode::Record, instructionCount);
+            ASSERT_TRUE(log.Open(path.c_str()));
+
+            instructionCount = 100;
+            EXPECT_EQ(0x1e, log.Scancode(0x1e));
+            EXPECT_EQ(0, log.Scancode(0));
+            log.InterruptDelivered(1);
+
+            // Needs several bytes for the instruction delta and the scancode
+            instructionCount = 100 + (1ull << 40);
+            EXPECT_EQ(0xe053, log.Scancode(0xe053));
+            EXPECT_EQ(2, log.ImageChange(2));
+            EXPECT_CALL(time, GetLocalTime()).WillOnce(Return(recordedTime));
+            log.GetLocalTime(time);
+        }
+    };
+}
+
+TEST_F(InputLogTest, ReplayRejectsOtherFiles)
+{
+    std::ofstream(path.Get()) << "not an input log";
+    InputLog log(InputLog::Mode::Replay, instructionCount);
+    EXPECT_FALSE(log.Open(path.c_str()));
+}
+
+TEST_F(InputLogTest, RecordedEventsAreReplayedAtTheSameInstruction)
+{
+    Record();
+
+    instructionCount = 0;
+    InputLog log(InputLog::Mode::Replay, instructionCount);
+    ASSERT_TRUE(log.Open(path.c_str()));
+    EXPECT_EQ(InputLog::Mode::Replay, log.GetMode());
+
+    // Host input is ignored while replaying
+    EXPECT_EQ(0, log.Scancode(0x10));
+    EXPECT_EQ(std::nullopt, log.ImageChange(1));
+
+    instructionCount = 100;
+    EXPECT_EQ(0x1e, log.Scancode(0));
+    EXPECT_EQ(0, log.Scancode(0));
+    log.InterruptDelivered(1);
+
+    instructionCount = 100 + (1ull << 40);
+    EXPECT_EQ(0xe053, log.Scancode(0));
+    EXPECT_EQ(2, log.ImageChange(std::nullopt));
+    EXPECT_CALL(time, GetLocalTime()).Times(0);
+    const auto t = log.GetLocalTime(time);
+    EXPECT_EQ(recordedTime.seconds, t.seconds);
+    EXPECT_EQ(recordedTime.minutes, t.minutes);
+    EXPECT_EQ(recordedTime.hours, t.hours);
+    EXPECT_EQ(recordedTime.week_day, t.week_day);
+    EXPECT_EQ(recordedTime.day, t.day);
+    EXPECT_EQ(recordedTime.month, t.month);
+    EXPECT_EQ(recordedTime.year, t.year);
+
+    // At the end of the recording, nothing is replayed
+    ++instructionCount;
+    EXPECT_EQ(0, log.Scancode(0x1e));
+}
+
+TEST_F(InputLogTest, TimeFollowsInstructions)
+{
+    InstructionTickProvider tick(instructionCount);
+    instructionCount = 1000;
+    const auto t1 = tick.GetTickCount();
+    instructionCount = 2000;
+    EXPECT_EQ(2 * t1, tick.GetTickCount());
+    EXPECT_GT(t1.count(), 0);
+}
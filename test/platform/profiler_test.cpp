@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "bus/memory.h"
+#include "cpu/state.h"
+#include "platform/profiler.h"
+#include "temppath.h"
+
+#include <fstream>
+#include <sstream>
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+namespace
+{
+    // Excerpt of a MAP file as written by the Microsoft linker
+    constexpr auto mapFile = R"( Start  Stop   Length Name               Class
+ 00000H 0012FH 00130H _TEXT              CODE
+ 00130H 0023FH 00110H _DATA              DATA
+
+ Origin   Group
+ 0013:0   DGROUP
+
+  Address         Publics by Name
+
+ 0013:0004       _counter
+ 0000:0100       _helper
+ 0000:0010       _main
+ 0000:0000  Abs  __acrtused
+
+  Address         Publics by Value
+
+ 0000:0000  Abs  __acrtused
+ 0000:0010       _main
+ 0000:0100       _helper
+ 0013:0004       _counter
+
+Program entry point at 0000:0010
+)";
+
+    struct ProfilerTest : ::testing::Test
+    {
+        TempPath path{ "profiler.map" };
+        Memory memory;
+        Profiler profiler{ memory };
+
+        void Sample(uint16_t cs, uint16_t ip)
+        {
+            cpu::State state{};
+            state.m_cs = cs;
+            state.m_ip = ip;
+            profiler.Sample(state);
+        }
+
+        std::string GetReport()
+        {
+            std::ostringstream os;
+            profiler.WriteReport(os, 10);
+            return os.str();
+        }
+    };
+}
+
+TEST_F(ProfilerTest, MissingMapIsRejected)
+{
+    EXPECT_FALSE(profiler.LoadMap(path.c_str(), 0));
+}
+
+TEST_F(ProfilerTest, ReportWithoutSymbols)
+{
+    Sample(0x1000, 0x0010);
+    Sample(0x1000, 0x0010);
+    Sample(0x0fff, 0x0020); // same linear address
+    Sample(0x2000, 0x0000);
+    EXPECT_EQ(4, profiler.GetNumberOfSamples());
+
+    const auto report = GetReport();
+    EXPECT_THAT(report, HasSubstr("4 samples, 2 distinct addresses\n"));
+    EXPECT_THAT(report, Not(HasSubstr("By symbol")));
+    EXPECT_THAT(report, HasSubstr(" 75.00%          3 10010"));
+    EXPECT_THAT(report, HasSubstr(" 25.00%          1 20000"));
+}
+
+TEST_F(ProfilerTest, SamplesAreAttributedToSymbols)
+{
+    std::ofstream(path.Get()) << mapFile;
+    ASSERT_TRUE(profiler.LoadMap(path.c_str(), 0x1000));
+
+    Sample(0x1000, 0x0010);
+    Sample(0x1000, 0x0010);
+    Sample(0x1000, 0x0015);
+    Sample(0x1000, 0x0105);
+    Sample(0x1013, 0x0004);
+    Sample(0x0000, 0x0500); // before the first symbol
+    Sample(0x3000, 0x0000); // too far beyond the last symbol
+    Sample(0x2000, 0x0000);
+
+    const auto report = GetReport();
+    EXPECT_THAT(report, HasSubstr("\nBy symbol:\n"
+        " 37.50%          3 _main\n"
+        " 25.00%          2 <unknown>\n"
+        " 25.00%          2 _counter\n"
+        " 12.50%          1 _helper\n"));
+    EXPECT_THAT(report, HasSubstr(" 25.00%          2 10010 _main                    insn\n"));
+    EXPECT_THAT(report, HasSubstr("10015 _main+5 "));
+    EXPECT_THAT(report, HasSubstr("10105 _helper+5 "));
+    EXPECT_THAT(report, HasSubstr("10134 _counter "));
+    EXPECT_THAT(report, HasSubstr("20000 _counter+fecc "));
+    EXPECT_THAT(report, HasSubstr("00500                          insn\n"));
+    EXPECT_THAT(report, HasSubstr("30000                          insn\n"));
+}
@@ -0,0 +1,153 @@
+#include "gtest/gtest.h"
+#include "bus/io.h"
+#include "bus/memory.h"
+#include "cpu/cpux86.h"
+#include "hw/ata.h"
+#include "hw/dma.h"
+#include "hw/fdc.h"
+#include "hw/keyboard.h"
+#include "hw/pic.h"
+#include "hw/pit.h"
+#include "hw/ppi.h"
+#include "hw/rtc.h"
+#include "hw/vga.h"
+#include "interface/imageprovider.h"
+#include "interface/tickinterface.h"
+#include "interface/timeinterface.h"
+#include "platform/hostio.h"
+#include "platform/rewind.h"
+#include "platform/snapshot.h"
+
+#include <limits>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+    constexpr inline io_port PICData = 0x21;
+    constexpr size_t baseSize = Memory::s_page_count * Memory::s_page_size;
+
+    struct NoImages : ImageProvider
+    {
+        Bytes GetSize(const Image) override { return 0; }
+        size_t Read(const Image, uint64_t, std::span<uint8_t>) override { return 0; }
+        size_t Write(const Image, uint64_t, std::span<const uint8_t>) override { return 0; }
+    };
+
+    struct FixedTick : TickInterface
+    {
+        std::chrono::nanoseconds GetTickCount() override { return {}; }
+    };
+
+    struct FixedTime : TimeInterface
+    {
+        LocalTime GetLocalTime() override { return {}; }
+    };
+
+    struct RewindTest : ::testing::Test
+    {
+        IO io;
+        Memory memory;
+        CPUx86 cpu{ memory, io };
+        HostIO hostio;
+        NoImages images;
+        FixedTick tick;
+        FixedTime time;
+        ATA ata{ io, images };
+        PIC pic{ io };
+        PIT pit{ io, tick };
+        DMA dma{ io, memory };
+        PPI ppi{ io, pit };
+        RTC rtc{ io, time };
+        FDC fdc{ io, pic, dma, images };
+        VGA vga{ memory, io, hostio, tick };
+        Keyboard keyboard{ io, hostio };
+        Machine machine{ cpu, memory, vga, pic, pit, dma, fdc, ata, rtc, ppi, keyboard };
+
+        RewindTest()
+        {
+            memory.Reset();
+            cpu.Reset();
+            pic.Reset();
+        }
+
+        // Changes one byte of memory, the CPU and the PIC
+        void Modify(memory::Address addr, uint8_t value)
+        {
+            memory.WriteByte(addr, value);
+            cpu.GetState().m_ax = value;
+            io.Out8(PICData, value);
+        }
+
+        // Memory used by a point with a single changed page
+        size_t GetPointSize()
+        {
+            RewindBuffer probe(machine, 1ms, std::numeric_limits<size_t>::max());
+            probe.Capture();
+            const auto devicesSize = probe.GetMemoryUsage() - baseSize;
+            return devicesSize + sizeof(uint16_t) + Memory::s_page_size;
+        }
+    };
+}
+
+TEST_F(RewindTest, RewindsToIntermediatePoint)
+{
+    RewindBuffer rewind(machine, 10ms, std::numeric_limits<size_t>::max());
+    Modify(0x1000, 0x11);
+    rewind.Update(0ms);
+    Modify(0x2000, 0x22);
+    rewind.Update(5ms); // too soon
+    EXPECT_EQ(1, rewind.GetNumberOfPoints());
+    rewind.Update(10ms);
+    Modify(0x1000, 0x33);
+    rewind.Update(20ms);
+    EXPECT_EQ(3, rewind.GetNumberOfPoints());
+    Modify(0x3000, 0x44);
+
+    EXPECT_FALSE(rewind.Rewind(3));
+    ASSERT_TRUE(rewind.Rewind(1));
+    EXPECT_EQ(0x11, memory.ReadByte(0x1000));
+    EXPECT_EQ(0x22, memory.ReadByte(0x2000));
+    EXPECT_EQ(0x00, memory.ReadByte(0x3000));
+    EXPECT_EQ(0x22, cpu.GetState().m_ax);
+    EXPECT_EQ(0x22, io.In8(PICData));
+
+    // The later point is gone, the restored one can be returned to again
+    EXPECT_EQ(2, rewind.GetNumberOfPoints());
+    Modify(0x2000, 0x55);
+    ASSERT_TRUE(rewind.Rewind(0));
+    EXPECT_EQ(0x22, memory.ReadByte(0x2000));
+    EXPECT_EQ(0x22, cpu.GetState().m_ax);
+    EXPECT_EQ(0x22, io.In8(PICData));
+}
+
+TEST_F(RewindTest, RewindsPastEvictedPoint)
+{
+    // Room for the full memory image and three points
+    const auto pointSize = GetPointSize();
+    const auto budget = baseSize + (pointSize - sizeof(uint16_t) - Memory::s_page_size) + 2 * pointSize;
+    RewindBuffer rewind(machine, 1ms, budget);
+    Modify(0x1000, 0x11);
+    rewind.Capture();
+    Modify(0x1000, 0x22);
+    rewind.Capture();
+    Modify(0x2000, 0x33);
+    rewind.Capture();
+    EXPECT_EQ(3, rewind.GetNumberOfPoints());
+
+    // The oldest point is dropped and the next one folded into the base
+    Modify(0x3000, 0x44);
+    rewind.Capture();
+    EXPECT_EQ(3, rewind.GetNumberOfPoints());
+    EXPECT_LE(rewind.GetMemoryUsage(), budget);
+
+    Modify(0x4000, 0x55);
+    EXPECT_FALSE(rewind.Rewind(3));
+    ASSERT_TRUE(rewind.Rewind(2));
+    EXPECT_EQ(0x22, memory.ReadByte(0x1000));
+    EXPECT_EQ(0x00, memory.ReadByte(0x2000));
+    EXPECT_EQ(0x00, memory.ReadByte(0x3000));
+    EXPECT_EQ(0x00, memory.ReadByte(0x4000));
+    EXPECT_EQ(0x22, cpu.GetState().m_ax);
+    EXPECT_EQ(0x22, io.In8(PICData));
+}
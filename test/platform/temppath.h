@@ -0,0 +1,28 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+// Unique path in the temporary directory, removed along with anything
+// created there when the test is done
+class TempPath final
+{
+    std::filesystem::path path;
+
+public:
+    TempPath(const std::string& name)
+        : path(std::filesystem::temp_directory_path() / ("x86box-" + std::to_string(getpid()) + "-" + name))
+    {
+        std::filesystem::remove_all(path);
+    }
+
+    ~TempPath()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+
+    const std::filesystem::path& Get() const { return path; }
+    const char* c_str() const { return path.c_str(); }
+};